@@ -3,6 +3,8 @@ from qgis.utils import *
 
 import pandas as pd
 
+from municipality_series import load_experiment_municipality_series
+
 vlayer = QgsVectorLayer("/Users/ahmadh/Downloads/WijkBuurtkaart_2018_v3/gemeente_2018_v3.shp", "gemeente_2018_v3", "ogr")
 vlayer.isValid()
 QgsProject.instance().addMapLayer(vlayer)
@@ -10,24 +12,20 @@ QgsProject.instance().addMapLayer(vlayer)
 # Contains list of municipality names in alphabetical order (column: Regio's
 municipalities_info = pd.read_csv("/Users/ahmadh/cbs-covid/src/data/inwoners_gemeente_2018.csv")
 
-freq = 1
-experiment = 'experiments_2023-08-22_22-07-08/0e45e32e-4128-11ee-a9c4-a63f12acbeef'
+experiment = 'experiments_2023-08-22_22-07-08'
+uuid = '0e45e32e-4128-11ee-a9c4-a63f12acbeef'
 options = ['total_per_municipality', 'total_infected_per_municipality']
 query = 1
-totalT = 2280
 
 max_value = 50
 
-for t in range(2280):
-    if (t % freq) != 0:
-        continue
-    # Load the data file that we need to link the municipality names to
-    data = pd.read_csv(f"/Users/ahmadh/snellius/cbs-covid/build/output/{experiment}/{options[query]}_t{t}.csv")
-
-    column_to_replace = 'x'
-    replacement_column = "Regio's"
+# One (time x municipality) matrix per option, averaged over the repetitions
+hours, infected, located = load_experiment_municipality_series(f"/Users/ahmadh/snellius/cbs-covid/build/output/{experiment}", uuid)
+heatmap = [located, infected][query]
 
-    data[column_to_replace] = municipalities_info[replacement_column]
+for row, t in enumerate(hours):
+    # Link the values to the municipality names
+    data = pd.DataFrame({'x': municipalities_info["Regio's"], 'y': heatmap[row]})
     data.to_csv("/tmp/qgis_infected.csv", index=False)
 
     csv_layer = QgsVectorLayer("file:///tmp/qgis_infected.csv?type=csv&maxFields=20000&detectTypes=yes&geomType=none&subsetIndex=no&watchFile=no", "data", "delimitedtext")
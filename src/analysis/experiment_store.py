@@ -0,0 +1,65 @@
+import json, os
+import numpy as np
+
+# Reads the experiments of a study from its store (see
+# src/experiment_store.h), e.g. output/experiments_<date>/experiments.store
+
+header_type = np.dtype([('magic', 'S8'), ('version', '<u4'),
+                        ('entry_size', '<u4')])
+index_type = np.dtype([('offset', '<u8'), ('size', '<u8'), ('mse', '<f8'),
+                       ('time', '<f8'), ('uuid', 'S40')])
+
+def store_path(experiment_dir):
+    return os.path.join(experiment_dir, 'experiments.store')
+
+# The index of the store: one row per experiment with the position of its
+# block, its error, the time it was stored and its UUID
+def read_index(path):
+    raw = np.fromfile(path + '.idx', dtype=np.uint8)
+    header = np.frombuffer(raw, dtype=header_type, count=1)[0]
+    if header['magic'] != b'CBSINDEX' or header['version'] != 1 or \
+            header['entry_size'] != index_type.itemsize:
+        raise ValueError(f'{path}.idx is not an experiment store index')
+    # An entry that is still being written is left out
+    count = (len(raw) - header_type.itemsize) // index_type.itemsize
+    return np.frombuffer(raw, dtype=index_type, count=count,
+                         offset=header_type.itemsize)
+
+def _read_string(block, pos):
+    size = int(np.frombuffer(block, dtype='<u8', count=1, offset=pos)[0])
+    pos += 8
+    value = block[pos:pos + size].decode()
+    return value, (pos + size + 7) // 8 * 8
+
+# Parses the block of one experiment into its parameters (with the metadata
+# of ExportResults, e.g. "mse") and a dict of its time series, each a dict of
+# the columns 'x', 'y' and, if present, 'y_error_low' and 'y_error_high'
+def parse_block(block):
+    param, pos = _read_string(block, 0)
+    num_series = int(np.frombuffer(block, dtype='<u8', count=1, offset=pos)[0])
+    pos += 8
+    series = {}
+    for _ in range(num_series):
+        name, pos = _read_string(block, pos)
+        length, num_columns = np.frombuffer(block, dtype='<u8', count=2,
+                                            offset=pos)
+        pos += 16
+        columns = np.frombuffer(block, dtype='<f8',
+                                count=int(length * num_columns), offset=pos)
+        columns = columns.reshape(int(num_columns), int(length))
+        pos += columns.nbytes
+        names = ['x', 'y', 'y_error_low', 'y_error_high'][:int(num_columns)]
+        series[name] = dict(zip(names, columns))
+    return json.loads(param), series
+
+# Yields (index entry, parameters, series) per experiment of the store,
+# optionally only of the experiments whose index entry passes `select`
+def read_store(path, select=None):
+    index = read_index(path)
+    with open(path, 'rb') as f:
+        for entry in index:
+            if select is not None and not select(entry):
+                continue
+            f.seek(int(entry['offset']))
+            params, series = parse_block(f.read(int(entry['size'])))
+            yield entry, params, series
@@ -5,8 +5,42 @@ import json
 import pandas as pd
 from collections import defaultdict
 
+from experiment_store import read_store, store_path
+
 param_filter = ['root_style', '_typename']
 
+# Adds the parameters and metadata of one experiment (see ExportResults)
+def add_params(data, uuid, timestamp, params):
+    # Remove uninteresting parameters to avoid clutter
+    for f in param_filter:
+        params['bdm::SimParam'].pop(f, None)
+    data['uuid'].append(uuid)
+    data['run_at'].append(timestamp)
+    data['resolution'].append(params['resolution'])
+    data['repetitions'].append(params['repetitions'])
+    # The 95% confidence interval of the metric of the repetitions, if tracked
+    # (see SimParam::repetition_ci_target)
+    data['repetition_metric_ci'].append(params.get('repetition_metric_ci'))
+    data['mse'].append(params['mse'])
+    # Aborted runs only have a lower bound of the error, skipped runs none
+    data['aborted'].append(params.get('aborted', False))
+    data['skipped'].append(params.get('skipped', False))
+    for k, v in params['bdm::SimParam'].items():
+        data[k].append(v)
+
+# Adds the experiments of the store of a study, which replaces the directory
+# per experiment
+def add_store(data, path, timestamp):
+    for entry, params, series in read_store(path):
+        add_params(data, entry['uuid'].decode(), timestamp, params)
+        for name, columns in series.items():
+            if not name.startswith('ts_'):
+                continue
+            data[name].append(columns['y'].tolist())
+            if 'y_error_low' in columns:
+                data[name + '_error_low'].append(columns['y_error_low'].tolist())
+                data[name + '_error_high'].append(columns['y_error_high'].tolist())
+
 def files_to_dataframe(base_dir, experiment):
     if not os.path.exists(base_dir):
         print(f"Directory {base_dir} does not exist.")
@@ -25,6 +59,9 @@ def files_to_dataframe(base_dir, experiment):
         timestamp = experiment_dir.split("experiments_")[1]
         timestamp = datetime.datetime.strptime(timestamp, '%Y-%m-%d_%H-%M-%S')
         experiment_path = os.path.join(base_dir, experiment_dir)
+        if os.path.exists(store_path(experiment_path)):
+            add_store(data, store_path(experiment_path), timestamp)
+            continue
         uuid_dirs = os.listdir(experiment_path)
 
         for uuid_dir in uuid_dirs:
@@ -42,17 +79,7 @@ def files_to_dataframe(base_dir, experiment):
                 with open(mse_path) as json_file:
                     # Load the JSON data into a Python object
                     params = json.load(json_file)
-                    # Remove uninteresting parameters to avoid clutter
-                    for f in param_filter:
-                        del params['bdm::SimParam'][f]
-
-                data['uuid'].append(uuid_dir)
-                data['run_at'].append(timestamp)
-                data['resolution'].append(params['resolution'])
-                data['repetitions'].append(params['repetitions'])
-                data['mse'].append(params['mse'])
-                for k, v in params['bdm::SimParam'].items():
-                    data[k].append(v)
+                add_params(data, uuid_dir, timestamp, params)
 
             for data_file in data_files:
                 data_path = os.path.join(uuid_path, data_file)
@@ -80,5 +107,5 @@ if __name__ == "__main__":
         sys.exit(1)
 
     base_dir = sys.argv[1]
-    df = files_to_dataframe(base_dir)
+    df = files_to_dataframe(base_dir, None)
     print(df)
@@ -0,0 +1,37 @@
+import glob, gzip, os
+import numpy as np
+
+# Reads the per-municipality statistics of one run, as written by
+# MunicipalitySeriesWriter (see src/municipality_series.h). Returns the hours
+# of the records and two dense (time x municipality) matrices: the infectious
+# persons per home municipality and the persons per location.
+def load_municipality_series(path):
+    opener = gzip.open if path.endswith('.gz') else open
+    with opener(path, 'rb') as f:
+        raw = f.read()
+    header_type = np.dtype([('magic', 'S4'), ('version', '<u4'),
+                            ('num_municipalities', '<u4'),
+                            ('frequency', '<u4')])
+    header = np.frombuffer(raw, dtype=header_type, count=1)[0]
+    if header['magic'] != b'CBSM' or header['version'] != 1:
+        raise ValueError(f'{path} is not a municipality series')
+    n = int(header['num_municipalities'])
+    record_type = np.dtype([('hour', '<u4'), ('infected', '<f4', (n,)),
+                            ('located', '<f4', (n,))])
+    records = np.frombuffer(raw, dtype=record_type,
+                            offset=header_type.itemsize)
+    return records['hour'], records['infected'], records['located']
+
+# The mean over the repetitions of the experiment `uuid` of a study (see
+# ExportResults)
+def load_experiment_municipality_series(study_dir, uuid):
+    pattern = os.path.join(study_dir, f'{uuid}_municipalities_*')
+    files = sorted(glob.glob(pattern))
+    if not files:
+        raise FileNotFoundError(f'No municipality series of {uuid} in {study_dir}')
+    runs = [load_municipality_series(f) for f in files]
+    length = min(len(hours) for hours, _, _ in runs)
+    hours = runs[0][0][:length]
+    infected = np.mean([r[1][:length] for r in runs], axis=0)
+    located = np.mean([r[2][:length] for r in runs], axis=0)
+    return hours, infected, located
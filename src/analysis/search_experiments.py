@@ -5,24 +5,37 @@ import datetime
 
 from pprint import pprint
 
+from experiment_store import read_store, store_path
+
 parser = argparse.ArgumentParser()
 parser.add_argument('--from-files', type=str, required=True)
 args = parser.parse_args()
 
 experiment_dirs = [d for d in os.listdir(args.from_files) if d.startswith('experiments_')]
 
+# The parameters of the first experiment of a study: from its store (see
+# src/experiment_store.h), or from the directory of an experiment
+def first_parameters(full_dirpath):
+  if os.path.exists(store_path(full_dirpath)):
+    for entry, parameters, series in read_store(store_path(full_dirpath)):
+      return parameters
+    return None
+  # Use os.path.join() to create full paths for each item
+  full_paths = [os.path.join(full_dirpath, file) for file in os.listdir(full_dirpath)]
+  # Use os.path.isdir() to filter only directories
+  subdirectories = [path for path in full_paths if os.path.isdir(path)]
+  for subdirectory in subdirectories:
+    params_file_path = os.path.join(subdirectory, 'param.json')
+    if os.path.exists(params_file_path):
+      with open(params_file_path, 'r') as params_file:
+        return json.load(params_file)
+  return None
+
 experiment_parameters = {}
 for experiment_dir in experiment_dirs:
   full_dirpath = os.path.join(args.from_files, experiment_dir)
-  experiment_files = os.listdir(full_dirpath)
-  if len(experiment_files) != 0:
-    # Use os.path.join() to create full paths for each item
-    full_paths = [os.path.join(full_dirpath, file) for file in experiment_files]
-    # Use os.path.isdir() to filter only directories
-    subdirectories = [path for path in full_paths if os.path.isdir(path)]
-    params_file_path = os.path.join(subdirectories[0], 'param.json')
-    with open(params_file_path, 'r') as params_file:
-      parameters = json.load(params_file)
+  parameters = first_parameters(full_dirpath)
+  if parameters is not None:
     experiment_parameters[experiment_dir] = parameters.get("bdm::OptimizationParam", {})
 
 pprint(experiment_parameters)
@@ -0,0 +1,216 @@
+#ifndef ANALYTICAL_MODEL_H_
+#define ANALYTICAL_MODEL_H_
+
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <vector>
+
+#include "biodynamo.h"
+
+#include "calibration.h"
+#include "covid_environment.h"
+#include "csv_helper.h"
+#include "data_processing_helpers.h"
+#include "initialization.h"
+#include "input_bundle.h"
+#include "interventions.h"
+#include "metapopulation.h"
+#include "model_facts.h"
+#include "operations/update_step_context_op.h"
+#include "sim_param.h"
+
+namespace bdm {
+
+// The inputs of SolveAnalytical that do not depend on the parameters, mapped
+// from the InputBundle
+struct AnalyticalInputs {
+  MatrixView<float> m_freq;
+  MatrixView<float> m_inc;
+  // Inhabitants per municipality
+  ArrayView<uint32_t> population;
+  // Initial infections per day and municipality (see InitialInfectionOp)
+  ArrayView<int> initial_infected;
+
+  static const AnalyticalInputs& Get() {
+    static const AnalyticalInputs kInputs = Read();
+    return kInputs;
+  }
+
+ private:
+  static AnalyticalInputs Read() {
+    const auto& bundle = InputBundle::Get();
+    AnalyticalInputs inputs;
+    inputs.m_freq = bundle.GetMatrix<float>("M_freq.csv");
+    inputs.m_inc = bundle.GetMatrix<float>("M_inc.csv");
+    inputs.population = bundle.GetArray<uint32_t>("inwoners_gemeente_2018.csv");
+    inputs.initial_infected =
+        bundle.GetArray<int>("initial_infected_per_municipality_per_day.csv");
+    return inputs;
+  }
+};
+
+// Solves the whole scenario of Simulate (the initial infections, the phases
+// with their betas, contact structures and interventions) with the
+// deterministic SEIR model of the Metapopulation over all municipalities and
+// demographies. The persons of each municipality are split over the
+// demographies with the national fractions. Returns the same time series as
+// the collectors of the agent model, in persons, with one value per hour.
+// Only the first `hours` hours are solved if it is not 0.
+inline TimeSeries SolveAnalytical(const SimParam* sparam, uint64_t hours = 0) {
+  const auto& inputs = AnalyticalInputs::Get();
+  auto phase_mixing = CovidEnvironment::LoadPhaseMixing(sparam);
+  std::array<ContactRates, kNumPhases> contacts;
+  for (uint8_t phase = 0; phase < kNumPhases; phase++) {
+    contacts[phase] = CovidEnvironment::ToContactRates(phase_mixing[phase]);
+  }
+
+  Metapopulation meta;
+  meta.SetMobility(inputs.m_freq, inputs.m_inc,
+                   sparam->metapopulation_mobility_cutoff);
+  meta.SetRates(GetTransitionRates(sparam));
+  std::array<real_t, kNumDemographies> population{};
+  for (uint16_t m = 0; m < kNumMunicipalities; m++) {
+    for (uint8_t d = 0; d < kNumDemographies; d++) {
+      auto persons = inputs.population[m] * kNationalFractionPerDemography[d];
+      meta.GetCompartments(m, d).susceptible = persons;
+      population[d] += persons;
+    }
+  }
+
+  // The last hour of each phase of the CovidEnvironment, as in Simulate
+  std::array<uint64_t, kNumPhases> phase_end;
+  phase_end[0] = sparam->init_infection_time + sparam->phase_1_hours;
+  phase_end[1] = phase_end[0] + sparam->phase_2_hours;
+  phase_end[2] = phase_end[1] + sparam->phase_3_hours;
+  phase_end[3] = phase_end[2] + sparam->phase_4_hours;
+  if (hours == 0) {
+    hours = phase_end[3];
+  }
+
+  // Moves `persons` of the susceptible persons of municipality `m` to `state`,
+  // spread over the demographies like the susceptible persons
+  auto seed = [&](uint16_t m, real_t persons, State state) {
+    real_t susceptible = 0;
+    for (uint8_t d = 0; d < kNumDemographies; d++) {
+      susceptible += meta.GetCompartments(m, d).susceptible;
+    }
+    if (susceptible <= 0) {
+      return;
+    }
+    auto share = std::min<real_t>(persons / susceptible, 1);
+    for (uint8_t d = 0; d < kNumDemographies; d++) {
+      auto& c = meta.GetCompartments(m, d);
+      auto moved = share * c.susceptible;
+      c.susceptible -= moved;
+      if (state == State::kInfectious) {
+        c.infectious += moved;
+        c.hospital_pending += kHospitalizationPerDemography[d] * moved;
+      } else {
+        c.exposed += moved;
+      }
+    }
+  };
+  const auto num_days = inputs.initial_infected.size() / kNumMunicipalities;
+
+  MunicipalityGrid fractions{};
+  MunicipalityGrid total;
+  MunicipalityGrid infected;
+  std::vector<real_t> x_values;
+  std::vector<real_t> exposed;
+  std::vector<real_t> infectious;
+  std::vector<real_t> hospitalized;
+  x_values.reserve(hours);
+  uint8_t phase = 0;
+  meta.SetHomeStay(HomeStayShares(sparam, phase, population));
+  for (uint64_t t = 0; t < hours; t++) {
+    while (phase + 1 < kNumPhases && t >= phase_end[phase]) {
+      phase++;
+      meta.SetHomeStay(HomeStayShares(sparam, phase, population));
+    }
+    auto hour_of_day = t % kHoursPerDay;
+    meta.Step(hour_of_day, PhaseToBeta(sparam, phase), contacts[phase],
+              fractions);
+
+    // The initial infections of InitialInfectionOp, once per day
+    auto day = t / kHoursPerDay;
+    if (hour_of_day == 0 && day < num_days &&
+        t < static_cast<uint64_t>(sparam->init_infection_time)) {
+      for (uint16_t m = 0; m < kNumMunicipalities; m++) {
+        real_t persons = inputs.initial_infected[day * kNumMunicipalities + m];
+        if (persons <= 0) {
+          continue;
+        }
+        if (t > sparam->incubation_scale_param) {
+          seed(m, persons, State::kInfectious);
+        }
+        seed(m, persons * sparam->initial_exposed_infected_ratio,
+             State::kExposed);
+      }
+    }
+
+    for (auto& row : total) {
+      row.fill(0);
+    }
+    for (auto& row : infected) {
+      row.fill(0);
+    }
+    meta.AddPresence(HourToRegime(hour_of_day), &total, &infected);
+    real_t sum_exposed = 0;
+    real_t sum_infectious = 0;
+    real_t sum_hospitalized = 0;
+    for (uint16_t m = 0; m < kNumMunicipalities; m++) {
+      for (uint8_t d = 0; d < kNumDemographies; d++) {
+        if (total[m][d] > 0) {
+          fractions[m][d] = infected[m][d] / total[m][d];
+        }
+        const auto& c = meta.GetCompartments(m, d);
+        sum_exposed += c.exposed;
+        sum_infectious += c.infectious;
+        sum_hospitalized += c.hospitalized;
+      }
+    }
+    x_values.push_back(t);
+    exposed.push_back(sum_exposed);
+    infectious.push_back(sum_infectious);
+    hospitalized.push_back(sum_hospitalized);
+  }
+
+  TimeSeries result;
+  result.Add("ts_exposed", x_values, exposed);
+  result.Add("ts_infectious", x_values, infectious);
+  result.Add("ts_hospitalized", x_values, hospitalized);
+  return result;
+}
+
+// The error of the analytical solution against the observed data
+inline real_t AnalyticalError(const SimParam* sparam) {
+  TimeSeries observed;
+  ImportObservedData(&observed);
+  return ComputeError(observed,
+                      SolveAnalytical(sparam, GetCalibrationHorizon(1)));
+}
+
+// The lowest analytical error of all calibration runs of this process so far
+inline real_t* GetBestAnalyticalError() {
+  static real_t best = std::numeric_limits<real_t>::infinity();
+  return &best;
+}
+
+// Decides if the agent run with the parameters `sparam` can be skipped,
+// because the analytical error of its parameters exceeds the best analytical
+// error so far times SimParam::analytical_prescreen_factor. Stores the
+// analytical error in `analytical_error`.
+inline bool RejectByAnalyticalPrescreen(const SimParam* sparam,
+                                        real_t* analytical_error) {
+  *analytical_error = AnalyticalError(sparam);
+  auto* best = GetBestAnalyticalError();
+  bool reject =
+      *analytical_error > *best * sparam->analytical_prescreen_factor;
+  *best = std::min(*best, *analytical_error);
+  return reject;
+}
+
+}  // namespace bdm
+
+#endif  // ANALYTICAL_MODEL_H_
@@ -1,8 +1,10 @@
 #ifndef CHANGE_SITUATION_BEHAVIOR_H_
 #define CHANGE_SITUATION_BEHAVIOR_H_
 
+#include "covid_environment.h"
 #include "model_facts.h"
 #include "person.h"
+#include "step_context.h"
 
 #include "core/simulation.h"
 
@@ -20,21 +22,42 @@ struct ChangeSituationBehavior : public Behavior {
   ChangeSituationBehavior() {}
 
   void Run(Agent* agent) override {
-    Person* person = bdm_static_cast<Person*>(agent);
-    auto sim = Simulation::GetActive();
-    auto current_timestep = sim->GetScheduler()->GetSimulatedSteps();
-    auto hour_of_day = current_timestep % kHoursPerDay;
+    Run(bdm_static_cast<Person*>(agent), GetStepContext());
+  }
+
+  void Run(Person* person, const StepContext& ctx) {
+    if (ctx.regime == HourRegime::kDaytime) {
+      Update<HourRegime::kDaytime, true>(person);
+    } else {
+      Update<HourRegime::kOffHours, true>(person);
+    }
+  }
+
+  // For code that does not know the regime at compile time
+  template <bool kHomeStay>
+  static void UpdateInRegime(Person* person, HourRegime regime) {
+    if (regime == HourRegime::kDaytime) {
+      Update<HourRegime::kDaytime, kHomeStay>(person);
+    } else {
+      Update<HourRegime::kOffHours, kHomeStay>(person);
+    }
+  }
+
+  // `kHomeStay` can be set to false when nobody stays at home (i.e. before
+  // the first intervention), which removes that check at compile time
+  template <HourRegime kRegime, bool kHomeStay>
+  static void Update(Person* person) {
     auto is_home = person->home_location_ == person->location_;
     auto demography = person->demography_;
 
-    if (hour_of_day < 9 || hour_of_day > 17) {
+    if (kRegime != HourRegime::kDaytime) {
       if (is_home) {
         person->situation_ = kHome;
       } else {
         person->situation_ = kOther;
       }
     } else {
-      if (person->home_stay_) {
+      if (kHomeStay && person->home_stay_) {
         person->situation_ = kHome;
       } else if (is_home) {
         person->situation_ = kDayTimeMixingHome[demography];
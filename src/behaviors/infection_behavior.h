@@ -1,16 +1,20 @@
 #ifndef INFECTION_BEHAVIOR_H_
 #define INFECTION_BEHAVIOR_H_
 
-#include <random>
+#include <algorithm>
+#include <cmath>
 
 #include "core/behavior/behavior.h"
 #include "core/container/math_array.h"
 
 #include "covid_environment.h"
+#include "disease_lanes.h"
 #include "model_facts.h"
 #include "operations/update_statistics_op.h"
 #include "person.h"
+#include "random_draws.h"
 #include "sim_param.h"
+#include "step_context.h"
 
 // For each person we run the SEIR model. Depending on their state (Susceptible,
 // Exposed, Infectious, Recovered), we compute the next likely state.
@@ -19,24 +23,15 @@
 // 2) Restrictions imposed by government / municipality
 // 3) Mixing with other Persons
 
-static std::default_random_engine generator;
-
 namespace bdm {
 
-inline float DemographicMixing(Person* person) {
+inline float DemographicMixing(Person* person, const StepContext& ctx) {
   float ret = 0;
 
-  auto* sim = Simulation::GetActive();
-  auto* env = bdm_static_cast<CovidEnvironment*>(sim->GetEnvironment());
-
-  UpdateStatisticsOp* stat_op = sim->GetScheduler()
-                                    ->GetOps("update statistics")[0]
-                                    ->GetImplementation<UpdateStatisticsOp>();
-
-  const auto& fractions = stat_op->fractions_;
+  const auto& fractions = ctx.stats->fractions_;
   auto demography = person->demography_;
   auto municipality = person->location_;
-  const auto mix_mat = env->GetMixingMatrix(person->situation_);
+  const auto& mix_mat = ctx.env->GetMixingMatrix(person->situation_);
 
   // fetch contact matrix
   for (auto other_demo = 0; other_demo < kNumDemographies; other_demo++) {
@@ -48,18 +43,6 @@ inline float DemographicMixing(Person* person) {
   return ret;
 }
 
-inline real_t PhaseToBeta(const SimParam* sparam, uint8_t phase) {
-  if (phase == 0) {
-    return sparam->beta1;
-  } else if (phase == 1) {
-    return sparam->beta2;
-  } else if (phase == 1) {
-    return sparam->beta3;
-  } else {
-    return sparam->beta4;
-  }
-}
-
 struct InfectionBehavior : public Behavior {
   BDM_BEHAVIOR_HEADER(InfectionBehavior, Behavior, 1);
 
@@ -69,19 +52,16 @@ struct InfectionBehavior : public Behavior {
     auto* sparam = sim->GetParam()->Get<SimParam>();
 
     // Draw from weibull distribution to determine incubation / infection time
-    std::weibull_distribution<float> incubation_distribution(
-        sparam->incubation_shape_param, sparam->incubation_scale_param);
-    std::weibull_distribution<float> infection_distribution(
-        sparam->infection_shape_param, sparam->infection_scale_param);
-    std::weibull_distribution<float> hospitalization_distribution(
-        sparam->hospitalization_shape_param,
-        sparam->hospitalization_scale_param);
-    std::lognormal_distribution<float> hospitalization_los(
-        sparam->hospital_average_mean, sparam->hospital_average_sigma);
-    incubation_time_threshold_ = incubation_distribution(generator);
-    infection_time_threshold_ = infection_distribution(generator);
-    hospitalization_time_threshold_ = hospitalization_distribution(generator);
-    hospital_length_of_stay_ = kHoursPerDay * hospitalization_los(generator);
+    incubation_time_threshold_ = DrawWeibull(
+        sparam->incubation_shape_param, sparam->incubation_scale_param, rand);
+    infection_time_threshold_ = DrawWeibull(
+        sparam->infection_shape_param, sparam->infection_scale_param, rand);
+    hospitalization_time_threshold_ =
+        DrawWeibull(sparam->hospitalization_shape_param,
+                    sparam->hospitalization_scale_param, rand);
+    hospital_length_of_stay_ =
+        kHoursPerDay * DrawLogNormal(sparam->hospital_average_mean,
+                                     sparam->hospital_average_sigma, rand);
 
     // For those initialized with non-kSusceptible state, we also initialize
     // the time they are in that state
@@ -97,29 +77,211 @@ struct InfectionBehavior : public Behavior {
   virtual ~InfectionBehavior() {}
 
   void Run(Agent* a) override {
-    auto* person = bdm_static_cast<Person*>(a);
-    auto* sim = Simulation::GetActive();
-    auto* random = sim->GetRandom();
-    auto* sparam = sim->GetParam()->Get<SimParam>();
+    Run(bdm_static_cast<Person*>(a), GetStepContext());
+  }
+
+  void Run(Person* person, const StepContext& ctx) {
+    if (ctx.regime == HourRegime::kAsleep) {
+      Update<false>(person, ctx);
+    } else {
+      Update<true>(person, ctx);
+    }
+  }
+
+  // Without transmission (`kTransmission` is false when nobody is awake)
+  // susceptible persons cannot become exposed, so only the disease
+  // progression is updated
+  template <bool kTransmission>
+  void Update(Person* person, const StepContext& ctx) {
+    auto* random = Simulation::GetActive()->GetRandom();
     auto g = person->demography_;
-    // We only decided once per agent if they will be hospitalized based on the changes defined at kHospitalizationPerDemography
+    DecideHospitalization(person, random);
+    if (person->state_ == kSusceptible) {
+      if (kTransmission) {
+        auto mix_sum = DemographicMixing(person, ctx);
+        auto lambda =
+            kSusceptibility[g] * ctx.beta * ctx.sleep_weight * mix_sum;
+        if (person->weight_ > 1) {
+          if (lambda > 0) {
+            ExposeSplit(person, random->Binomial(person->weight_,
+                                                 std::min<real_t>(lambda, 1)));
+          }
+        } else if (random->Uniform(0, 1) <= lambda && lambda > 0) {
+          person->state_ = kExposed;
+        }
+      }
+    } else {
+      ProgressDisease(person);
+    }
+  }
+
+  // Advances the other repetitions of an ensemble (see DiseaseLanes) by one
+  // hour, with the same rules as `Update`. Each lane is infected by the
+  // infected fractions of its own repetition.
+  template <bool kTransmission>
+  static void UpdateLanes(Person* person, const StepContext& ctx) {
+    DiseaseLanes lanes(person);
+    // Susceptible lanes are not touched, so these are the lanes that were
+    // susceptible at the start of the hour
+    lanes.Progress();
+    if (!kTransmission) {
+      return;
+    }
+    auto d = person->demography_;
+    auto location = person->location_;
+    const auto& mix_mat = ctx.env->GetMixingMatrix(person->situation_);
+    real_t contacts = 0;
+    for (auto other_demo = 0; other_demo < kNumDemographies; other_demo++) {
+      contacts += mix_mat[d][other_demo];
+    }
+    auto scale = kSusceptibility[d] * ctx.beta * ctx.sleep_weight * contacts;
+    if (scale <= 0) {
+      return;
+    }
+    auto* random = Simulation::GetActive()->GetRandom();
+    auto* states = lanes[DiseaseLanes::kState];
+    for (uint32_t l = 0; l < lanes.GetNumLanes(); l++) {
+      if (states[l] != kSusceptible) {
+        continue;
+      }
+      auto lambda = scale * ctx.stats->lane_fractions_[l][location][d];
+      if (lambda > 0 && random->Uniform(0, 1) <= lambda) {
+        states[l] = kExposed;
+      }
+    }
+  }
+
+  // Advances `person` by one timestep of `ctx.step_hours` hours (see
+  // SimParam::step_hours). `exposure[h]` is the sleep weight times the
+  // demographic mixing of hour `h` of the step (only used for susceptible
+  // persons). The person gets infected with probability 1 - exp(-sum(lambda)).
+  // The hour of the infection is derived from the same random number, such
+  // that the incubation of a newly exposed person starts in the right hour.
+  void UpdateStep(Person* person, const StepContext& ctx,
+                  const real_t* exposure) {
+    auto* random = Simulation::GetActive()->GetRandom();
+    DecideHospitalization(person, random);
+    if (person->state_ != kSusceptible) {
+      for (uint32_t h = 0; h < ctx.step_hours; h++) {
+        ProgressDisease(person);
+      }
+      return;
+    }
+    auto scale = kSusceptibility[person->demography_] * ctx.beta;
+    real_t total = 0;
+    for (uint32_t h = 0; h < ctx.step_hours; h++) {
+      total += scale * exposure[h];
+    }
+    if (total <= 0) {
+      return;
+    }
+    if (person->weight_ > 1) {
+      // The hour of the infection is not resolved for super agents; the split
+      // persons start their incubation with the next step
+      ExposeSplit(person,
+                  random->Binomial(person->weight_, -std::expm1(-total)));
+      return;
+    }
+    // The cumulative hazard at which this person gets infected
+    auto hazard = -std::log1p(-random->Uniform(0, 1));
+    if (hazard >= total) {
+      return;
+    }
+    person->state_ = kExposed;
+    real_t cumulative = 0;
+    uint32_t h = 0;
+    for (; h < ctx.step_hours; h++) {
+      cumulative += scale * exposure[h];
+      if (cumulative > hazard) {
+        break;
+      }
+    }
+    for (h++; h < ctx.step_hours; h++) {
+      ProgressDisease(person);
+    }
+  }
+
+  // Splits `exposed` of the persons that the super agent `person` represents
+  // (see SimParam::super_agent_weight) off into exposed agents of their own.
+  // The new agents are added to the simulation after this timestep. If all
+  // persons are exposed, `person` itself becomes the last of them.
+  void ExposeSplit(Person* person, uint32_t exposed) {
+    exposed = std::min(exposed, person->weight_);
+    bool all = exposed == person->weight_;
+    auto* ctxt = Simulation::GetActive()->GetExecutionContext();
+    for (uint32_t i = all ? 1 : 0; i < exposed; i++) {
+      auto* split = person->Split(1);
+      split->state_ = kExposed;
+      ctxt->AddAgent(split);
+    }
+    if (all) {
+      person->state_ = kExposed;
+    }
+  }
+
+  // Advances the disease progression of `person` by `hours` hours without
+  // transmission, which is equivalent to calling `Update<false>` `hours` times.
+  // `on_hour(h, person)` is called with the state after each hour `h`. Persons
+  // whose state cannot change during these hours (susceptible persons, and
+  // recovered persons that are done with the hospital) skip the hourly loop
+  // and are passed once to `on_all_hours(person)` instead.
+  template <typename F, typename G>
+  void FastForward(Person* person, uint32_t hours, Random* random, F&& on_hour,
+                   G&& on_all_hours) {
+    DecideHospitalization(person, random);
+    auto state = person->state_;
+    if (state == kSusceptible) {
+      on_all_hours(person);
+      return;
+    }
+    if (state == kRecovered &&
+        (!hospitalize_person_ || time_in_hospital_ > hospital_length_of_stay_)) {
+      hospitalization_time_ += hours;
+      if (hospitalize_person_) {
+        // Readmitted and discharged again within every hour
+        person->hospitalized_ = false;
+      }
+      on_all_hours(person);
+      return;
+    }
+    for (uint32_t h = 0; h < hours; h++) {
+      ProgressDisease(person);
+      on_hour(h, person);
+    }
+  }
+
+  // Initializes the disease course of a person that is handed over from the
+  // compartmental model in `person->state_` (see ActivateMunicipality).
+  // `hospitalize` decides the hospitalization, and `hospitalized` whether the
+  // person is already admitted.
+  void InitializeCourse(Person* person, bool hospitalize, bool hospitalized) {
+    auto* random = Simulation::GetActive()->GetRandom();
+    DrawFromDistributions(person->state_);
+    initialized_ = true;
+    hospitalize_person_ = hospitalize;
+    if (hospitalized) {
+      hospitalization_time_ = hospitalization_time_threshold_ + 1;
+      time_in_hospital_ = random->Uniform(0, hospital_length_of_stay_);
+      person->hospitalized_ = true;
+    } else if (hospitalize) {
+      hospitalization_time_ =
+          random->Uniform(0, hospitalization_time_threshold_);
+    }
+  }
+
+  // We only decided once per agent if they will be hospitalized based on the changes defined at kHospitalizationPerDemography
+  void DecideHospitalization(Person* person, Random* random) {
     if (!initialized_) {
-      if (random->Uniform(0, 1) <= kHospitalizationPerDemography[g]) {
+      if (random->Uniform(0, 1) <= kHospitalizationPerDemography[person->demography_]) {
         hospitalize_person_ = true;
       }
       initialized_ = true;
     }
-    if (person->state_ == kSusceptible) {
-      auto t = sim->GetScheduler()->GetSimulatedSteps();
-      uint8_t hour_of_day = t % kHoursPerDay;
-      auto s = kDailySleepPattern[hour_of_day];
-      auto mix_sum = DemographicMixing(person);
-      auto lambda =
-          kSusceptibility[g] * PhaseToBeta(sparam, kActivePhase) * s * mix_sum;
-      if (random->Uniform(0, 1) <= lambda && lambda > 0) {
-        person->state_ = kExposed;
-      }
-    } else if (person->state_ == kExposed) {
+  }
+
+  // Advances a person that is not susceptible by one hour
+  void ProgressDisease(Person* person) {
+    if (person->state_ == kExposed) {
       if (incubation_time_ > incubation_time_threshold_) {
         person->state_ = kInfectious;
       } else {
@@ -1,8 +1,10 @@
 #ifndef TRAVEL_BEHAVIOR_H_
 #define TRAVEL_BEHAVIOR_H_
 
+#include "covid_environment.h"
 #include "model_facts.h"
 #include "person.h"
+#include "step_context.h"
 
 namespace bdm {
 
@@ -12,15 +14,21 @@ struct TravelBehavior : public Behavior {
   TravelBehavior() {}
 
   void Run(Agent* agent) override {
-    Person* person = bdm_static_cast<Person*>(agent);
+    Run(bdm_static_cast<Person*>(agent), GetStepContext());
+  }
+
+  void Run(Person* person, const StepContext& ctx) {
+    Update<true>(person, ctx.hour_of_week);
+  }
+
+  // `kHomeStay` can be set to false when nobody stays at home (i.e. before
+  // the first intervention), which removes that check at compile time
+  template <bool kHomeStay>
+  static void Update(Person* person, uint16_t hour_of_week) {
     // If a person is working from home, we put this person at home
-    if (person->home_stay_) {
+    if (kHomeStay && person->home_stay_) {
       person->location_ = person->home_location_;
     } else {
-      auto sim = Simulation::GetActive();
-      auto current_timestep = sim->GetScheduler()->GetSimulatedSteps();
-      auto hour_of_week = current_timestep % (kHoursPerDay * kDaysPerWeek);
-
       auto* schedule = person->GetWeeklyTravelSchedule();
       auto next_location = (*schedule)[hour_of_week];
       person->Travel(next_location);
@@ -0,0 +1,139 @@
+#ifndef BRANCHING_H_
+#define BRANCHING_H_
+
+#include <unistd.h>
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "biodynamo.h"
+#include "omp.h"
+
+#include "concurrent_repetitions.h"
+#include "export_queue.h"
+
+namespace bdm {
+
+// The branches that a simulation forks at the start of a phase (see
+// SimulateImpl). Everything before the fork, e.g. building the population, is
+// only done once.
+struct BranchPlan {
+  // The phase at whose start the branches are forked, as in the output of
+  // Simulate ("Starting Phase ..."); 0 forks right after the population was
+  // built
+  uint8_t phase = 0;
+  // Per branch, a JSON patch of the parameters (see Param::MergeJsonPatch)
+  // that applies from the fork on; empty for none
+  std::vector<std::string> patches;
+  // Per branch, the index of its run, which selects its random numbers (see
+  // GetRunIndex)
+  std::vector<uint64_t> runs;
+  // Per branch, the plan by which it branches again at a later phase (a
+  // scenario tree, see BuildScenarioTree). Empty if the branches are leaves.
+  std::vector<BranchPlan> subplans;
+
+  // The number of runs that the plan results in
+  size_t GetNumLeaves() const {
+    if (subplans.empty()) {
+      return runs.size();
+    }
+    size_t leaves = 0;
+    for (const auto& subplan : subplans) {
+      leaves += subplan.GetNumLeaves();
+    }
+    return leaves;
+  }
+};
+
+// The number of branches that this process may run at a time; 0 for one per
+// thread. A branch gets its share of the slots of its parent, for the branches
+// that it forks in turn.
+inline size_t* GetBranchSlots() {
+  static size_t slots = 0;
+  return &slots;
+}
+
+// Forks one child process per branch of `plan`. The children share the memory
+// of the parent copy-on-write, and run with one OpenMP thread each, as libgomp
+// cannot start a new thread team in a forked child. At most one child per
+// thread of the parent runs at a time (see GetBranchSlots). Returns the index
+// of the branch in a child, which sends its results through `*fd` (see
+// FinishBranch). Returns -1 in the parent, after all children have finished
+// and their results were stored in `results`, in the order of the leaves.
+inline int ForkBranches(const BranchPlan& plan,
+                        std::vector<TimeSeries>* results, int* fd) {
+  auto branches = plan.runs.size();
+  results->assign(plan.GetNumLeaves(), TimeSeries());
+  size_t concurrent = *GetBranchSlots();
+  if (concurrent == 0) {
+    concurrent = std::max(1, ThreadInfo::GetInstance()->GetMaxThreads());
+  }
+  size_t leaf = 0;
+  // Otherwise the children print the buffered output again
+  std::cout.flush();
+  // The children must not inherit locks held by the export thread
+  GetExportQueue()->Wait();
+  for (size_t first = 0; first < branches; first += concurrent) {
+    auto last = std::min(branches, first + concurrent);
+    std::vector<int> fds;
+    std::vector<pid_t> pids;
+    for (size_t b = first; b < last; b++) {
+      int pipe_fds[2];
+      if (pipe(pipe_fds) != 0) {
+        Log::Fatal("ForkBranches", "Could not create a pipe");
+      }
+      auto pid = fork();
+      if (pid < 0) {
+        Log::Fatal("ForkBranches", "Could not fork branch ", b);
+      }
+      if (pid == 0) {
+        close(pipe_fds[0]);
+        for (auto other : fds) {
+          close(other);
+        }
+        // The pipe to the parent of this process belongs to the parent
+        if (*fd >= 0) {
+          close(*fd);
+        }
+        omp_set_num_threads(1);
+        ThreadInfo::GetInstance()->Renew();
+        *GetBranchSlots() = std::max<size_t>(1, concurrent / (last - first));
+        *fd = pipe_fds[1];
+        return b;
+      }
+      close(pipe_fds[1]);
+      fds.push_back(pipe_fds[0]);
+      pids.push_back(pid);
+    }
+    auto data = CollectWorkerOutput(fds, pids, "ForkBranches");
+    for (size_t b = first; b < last; b++) {
+      size_t leaves =
+          plan.subplans.empty() ? 1 : plan.subplans[b].GetNumLeaves();
+      size_t offset = 0;
+      for (size_t l = 0; l < leaves; l++) {
+        if (!ReadTimeSeries(data[b - first], &offset, &(*results)[leaf++])) {
+          Log::Fatal("ForkBranches", "Branch ", b, " did not return ", leaves,
+                     " results");
+        }
+      }
+    }
+  }
+  return -1;
+}
+
+// Sends the results of a branch, one per leaf, to its parent and ends the
+// branch
+inline void FinishBranch(int fd, const std::vector<TimeSeries>& results) {
+  std::cout.flush();
+  bool sent = true;
+  for (const auto& result : results) {
+    sent = sent && WriteTimeSeries(fd, result);
+  }
+  close(fd);
+  _exit(sent ? 0 : 1);
+}
+
+}  // namespace bdm
+
+#endif  // BRANCHING_H_
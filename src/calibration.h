@@ -0,0 +1,114 @@
+#ifndef CALIBRATION_H_
+#define CALIBRATION_H_
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include "biodynamo.h"
+
+#include "model_facts.h"
+#include "sim_param.h"
+
+namespace bdm {
+
+// The observed hospitalizations (see ImportObservedData) correspond to the
+// simulated hours 384 until 720, with one value per day
+static const uint64_t kCalibrationStartHour = 384;
+static const uint64_t kCalibrationEndHour = 720;
+
+// All modes except "sim-and-analytical" run the fitting routine
+inline bool IsCalibrationRun(const SimParam* sparam) {
+  return sparam->mode != "sim-and-analytical";
+}
+
+// Selects the simulated values at 0:00 of each day of the calibration
+// interval. `hours` are the x-values of the time series (see CollectHour); if
+// a timestep spans multiple hours, the last value at or before 0:00 is used.
+// Stops at the first day that has not been simulated yet.
+inline std::vector<real_t> SelectDailySamples(
+    const std::vector<real_t>& hours, const std::vector<real_t>& values) {
+  std::vector<real_t> samples;
+  size_t t = 0;
+  for (real_t hour = kCalibrationStartHour; hour <= kCalibrationEndHour;
+       hour += kHoursPerDay) {
+    if (hours.empty() || hours.back() < hour) {
+      break;
+    }
+    while (t + 1 < hours.size() && hours[t + 1] <= hour) {
+      t++;
+    }
+    if (hours[t] <= hour) {
+      samples.push_back(values[t]);
+    }
+  }
+  return samples;
+}
+
+// The number of hours to simulate, such that all values that ComputeError
+// needs are available
+inline uint64_t GetCalibrationHorizon(uint32_t step_hours) {
+  uint64_t hours = kCalibrationEndHour + 1;
+  return (hours + step_hours - 1) / step_hours * step_hours;
+}
+
+// Whether the runs of this mode may stop before the end of the last phase,
+// at the calibration horizon or when they are aborted. The runs of the
+// "scenario-tree" mode fork their branches in later phases, so they always
+// run to the end.
+inline bool MayStopEarly(const SimParam* sparam) {
+  return IsCalibrationRun(sparam) && sparam->mode != "scenario-tree";
+}
+
+// The number of hours after which a run stops (see
+// SimParam::calibration_horizon)
+inline uint64_t GetRunHorizon(const SimParam* sparam) {
+  if (!MayStopEarly(sparam) || !sparam->calibration_horizon) {
+    return std::numeric_limits<uint64_t>::max();
+  }
+  return GetCalibrationHorizon(sparam->step_hours);
+}
+
+// The part of the mean squared error against `observed` that is known from
+// `samples`, which can be fewer than the observed values. The error of the
+// complete run is at least this value.
+inline real_t PartialError(const std::vector<real_t>& observed,
+                           const std::vector<real_t>& samples) {
+  if (observed.empty()) {
+    return 0;
+  }
+  real_t sum = 0;
+  auto n = std::min(observed.size(), samples.size());
+  for (size_t i = 0; i < n; i++) {
+    sum += (observed[i] - samples[i]) * (observed[i] - samples[i]);
+  }
+  return sum / observed.size();
+}
+
+// The lowest error of all calibration runs of this process so far
+inline real_t* GetBestCalibrationError() {
+  static real_t best = std::numeric_limits<real_t>::infinity();
+  return &best;
+}
+
+inline void ReportCalibrationError(real_t err) {
+  auto* best = GetBestCalibrationError();
+  *best = std::min(*best, err);
+}
+
+// Calibration runs whose error is known to exceed this threshold are aborted
+inline real_t GetAbortThreshold(const SimParam* sparam) {
+  auto threshold = std::numeric_limits<real_t>::infinity();
+  if (sparam->abort_mse_threshold > 0) {
+    threshold = sparam->abort_mse_threshold;
+  }
+  if (sparam->abort_best_mse_factor > 0) {
+    threshold = std::min(
+        threshold, *GetBestCalibrationError() * sparam->abort_best_mse_factor);
+  }
+  return threshold;
+}
+
+}  // namespace bdm
+
+#endif  // CALIBRATION_H_
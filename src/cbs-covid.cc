@@ -13,6 +13,8 @@
 // -----------------------------------------------------------------------------
 #include "cbs-covid.h"
 #include "data_processing_helpers.h"
+#include "multi_fidelity.h"
+#include "scenario_tree.h"
 
 #include "core/multi_simulation/experiment.h"
 #include "core/multi_simulation/multi_simulation.h"
@@ -21,40 +23,69 @@ using namespace bdm;
 
 const ParamGroupUid SimParam::kUid = ParamGroupUidGenerator::Get()->NewUid();
 
+// Creates the output directory `prefix` followed by the current time in
+// `format`, and returns its path
+std::string MakeStudyOutputDir(const std::string& prefix,
+                               const char* format = "%Y-%m-%d_%H-%M-%S") {
+  auto t = std::time(nullptr);
+  auto tm = *std::localtime(&t);
+  std::ostringstream oss;
+  oss << std::put_time(&tm, format);
+  std::string experiments_output_dir = Concat(prefix, oss.str());
+  if (system(Concat("mkdir -p ", experiments_output_dir).c_str())) {
+    Log::Fatal("Simulation::ExportResults", "Failed to make output directory ",
+               experiments_output_dir);
+  } else {
+    Log::Info("Simulation::ExportResults", "Created output directory ",
+              experiments_output_dir);
+  }
+  return experiments_output_dir;
+}
+
 void ExperimentSimAndAnalytical(int argc, const char** argv, const Param* param,
                                 uint64_t repeat) {
-  auto sim_wrapper = L2F([&](Param* param, TimeSeries* result) {
+  TimeSeries observed;
+  ImportObservedData(&observed);
+
+  // The repetitions that were simulated up front by concurrent workers, which
+  // are aggregated in order
+  std::vector<TimeSeries> precomputed;
+  auto workers = param->Get<SimParam>()->concurrent_repetitions;
+  if (workers > 1 && repeat > 1) {
+    precomputed = RunConcurrentRepetitions(argc, argv, repeat, workers);
+  }
+  size_t next = 0;
+  auto simulate = [&](Param* param, TimeSeries* result) {
+    if (next < precomputed.size()) {
+      *result = std::move(precomputed[next++]);
+      return;
+    }
     Simulate(argc, argv, result, param);
-  });
+  };
 
-  auto export_results =
-      L2F([&](const std::vector<TimeSeries>& results, const TimeSeries& mean,
-              const TimeSeries& analytical, const Param& param, real_t err) {
-        auto t = std::time(nullptr);
-        auto today = *std::localtime(&t);
-        std::ostringstream oss;
-        oss << std::put_time(&today, "%Y-%m-%d");
-        std::string experiments_output_dir =
-            "output/single_experiments/" + oss.str();
-        if (system(Concat("mkdir -p ", experiments_output_dir).c_str())) {
-          Log::Fatal("Simulation::ExportResults",
-                     "Failed to make output directory ",
-                     experiments_output_dir);
-        } else {
-          Log::Info("Simulation::ExportResults", "Created output directory ",
-                    experiments_output_dir);
-        }
-        ExportResults(results, mean, param, err, experiments_output_dir);
-      });
+  auto export_results = [&](const RepetitionAggregator& aggregate,
+                            const Param& param, real_t err) {
+    auto experiments_output_dir =
+        MakeStudyOutputDir("output/single_experiments/", "%Y-%m-%d");
+    // Solve the deterministic model of the same parameters for comparison
+    auto analytical_start = std::chrono::steady_clock::now();
+    auto solution = SolveAnalytical(param.Get<SimParam>());
+    std::chrono::duration<double> analytical_duration =
+        std::chrono::steady_clock::now() - analytical_start;
+    std::cout << "Analytical MSE " << ComputeError(observed, solution)
+              << " (solved in " << analytical_duration.count() << " s)"
+              << std::endl;
+    ExportResults(aggregate, param, err, experiments_output_dir, &solution);
+  };
 
-  auto compute_error = L2F([&](TimeSeries observed, TimeSeries simulated) {
+  auto compute_error = [&](const TimeSeries& observed,
+                           const TimeSeries& simulated) {
     return ComputeError(observed, simulated);
-  });
+  };
 
-  TimeSeries observed;
-  ImportObservedData(&observed);
-  real_t mse = Experiment(sim_wrapper, repeat, param, &observed, &compute_error,
-                          &export_results);
+  auto aggregate = MakeRepetitionAggregator(param->Get<SimParam>(), &observed);
+  real_t mse = StreamingExperiment(simulate, repeat, *param, &aggregate,
+                                   observed, compute_error, export_results);
   std::cout << " MSE " << mse << std::endl;
 }
 
@@ -75,43 +106,57 @@ int main(int argc, const char** argv) {
   auto* sparam = param->Get<SimParam>();
   auto* opt_param = param->Get<OptimizationParam>();
 
+  // A worker process of RunConcurrentRepetitions
+  if (IsRepetitionWorker()) {
+    return RunRepetitionWorker(
+        [&](Param* final_params, TimeSeries* result) {
+          Simulate(argc, argv, result, final_params);
+        },
+        param);
+  }
+
   // Run the simulation once and compute the error against the observed data
   if (sparam->mode == "sim-and-analytical") {
     std::cout << "Repeat: " << sparam->repeat << std::endl;
     ExperimentSimAndAnalytical(argc, argv, param, sparam->repeat);
+    FlushResults();
+    std::cout << "Simulation completed successfully!" << std::endl;
+    return 0;
+  } else if (sparam->mode == "multi-fidelity") {
+    auto experiments_output_dir = MakeStudyOutputDir("output/multi_fidelity_");
+    MultiFidelityCalibration(argc, argv, param, experiments_output_dir);
+    FlushResults();
+    std::cout << "Simulation completed successfully!" << std::endl;
+    return 0;
+  } else if (sparam->mode == "scenario-tree") {
+    auto experiments_output_dir = MakeStudyOutputDir("output/scenario_tree_");
+    ScenarioTreeSweep(argc, argv, param, experiments_output_dir);
+    FlushResults();
     std::cout << "Simulation completed successfully!" << std::endl;
     return 0;
   } else {  // Run the multi-simulation fitting routine
     // Create a timestamped output directory for the experiments as part of the
     // calibration routine (only master rank)
-    auto t = std::time(nullptr);
-    auto tm = *std::localtime(&t);
-    std::ostringstream oss;
-    oss << std::put_time(&tm, "%Y-%m-%d_%H-%M-%S");
-    std::string experiments_output_dir =
-        Concat("output/experiments_", oss.str());
-    if (system(Concat("mkdir -p ", experiments_output_dir).c_str())) {
-      Log::Fatal("Simulation::ExportResults",
-                 "Failed to make output directory ", experiments_output_dir);
-    } else {
-      Log::Info("Simulation::ExportResults", "Created output directory ",
-                experiments_output_dir);
-    }
+    auto experiments_output_dir = MakeStudyOutputDir("output/experiments_");
 
-    // Generate the analytical data
+    // Generate the analytical data. The best error so far is the threshold
+    // for aborting the next runs early (see SimParam::abort_best_mse_factor)
     auto compute_error = L2F([&](TimeSeries observed, TimeSeries simulated) {
-      return ComputeError(observed, simulated);
+      auto err = ComputeError(observed, simulated);
+      ReportCalibrationError(err);
+      return err;
     });
     auto export_results =
         L2F([&](const std::vector<TimeSeries>& results, const TimeSeries& mean,
                 const TimeSeries& analytical, const Param& param, real_t err) {
-          ExportResults(results, mean, param, err, experiments_output_dir);
+          ExportResults(results, param, err, experiments_output_dir);
         });
 
     TimeSeries observed;
     ImportObservedData(&observed);
     MultiSimulation ms(argc, argv, &observed);
     auto ret = ms.Execute(Simulate, &compute_error, &export_results);
+    FlushResults();
     std::cout << "Simulation completed successfully!" << std::endl;
     return ret;
   }
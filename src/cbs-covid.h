@@ -1,21 +1,64 @@
 #ifndef CBS_COVID_H_
 #define CBS_COVID_H_
 
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <limits>
+#include <memory>
+#include <string>
+
 #include "biodynamo.h"
 #include "core/multi_simulation/optimization_param.h"
 #include "core/randomized_rm.h"
 
+#include "analytical_model.h"
+#include "branching.h"
+#include "calibration.h"
+#include "concurrent_repetitions.h"
 #include "covid_environment.h"
+#include "data_processing_helpers.h"
+#include "disease_lanes.h"
 #include "evaluate.h"
+#include "fast_forward.h"
 #include "initialization.h"
 #include "interventions.h"
+#include "municipality_series.h"
 #include "operations/export_statistics_op.h"
+#include "operations/hourly_kernel_op.h"
+#include "operations/update_step_context_op.h"
 #include "sim_param.h"
+#include "surrogate.h"
 
 namespace bdm {
 
-inline int Simulate(int argc, const char** argv, TimeSeries* result,
-                    Param* final_params = nullptr) {
+// Seeds the random number generators of all threads of `sim` from `seed` and
+// the index of the run (see GetRunIndex)
+inline void SeedRun(Simulation* sim, uint64_t seed, uint64_t run) {
+#pragma omp parallel
+  {
+    uint64_t tid = ThreadInfo::GetInstance()->GetMyThreadId();
+    sim->GetRandom()->SetSeed(seed * 0x9E3779B97F4A7C15ull ^ (run << 16) ^ tid);
+  }
+}
+
+// Simulates the scenario with the parameters `final_params`. With a `plan`,
+// the run forks its branches at the start of the phase of the plan and
+// returns their results in `branch_results` instead of `result` (see
+// ForkBranches).
+inline int SimulateImpl(int argc, const char** argv, TimeSeries* result,
+                        Param* final_params, const BranchPlan* plan,
+                        std::vector<TimeSeries>* branch_results) {
+  // Return the next repetition if it was already simulated as part of an
+  // ensemble (see SimParam::ensemble_lanes)
+  std::string ensemble_key =
+      final_params != nullptr ? final_params->ToJsonString() : "";
+  if (!ensemble_key.empty() &&
+      EnsembleResults::GetInstance()->Take(ensemble_key, result)) {
+    return 0;
+  }
+
   auto set_param = [&](Param* param) {
     param->Restore(std::move(*final_params));
   };
@@ -48,9 +91,152 @@ inline int Simulate(int argc, const char** argv, TimeSeries* result,
   auto* param = simulation.GetParam();
   auto* sparam = param->Get<SimParam>();
   auto* scheduler = simulation.GetScheduler();
+  // Every run of this process gets its own random numbers, also for the travel
+  // schedules and the disease course thresholds
+  uint64_t seed =
+      sparam->no_fixed_seed ? std::time(nullptr) : param->random_seed;
+  auto run = (*GetRunIndex())++;
+  SeedRun(&simulation, seed, run);
+  if (sparam->hybrid_metapopulation && randominit) {
+    Log::Fatal("Simulate",
+               "hybrid_metapopulation requires the register data (--cbsdir)");
+  }
+  auto step_hours = sparam->step_hours;
+  if (step_hours == 0 || kHoursPerDay % step_hours != 0 ||
+      sparam->phase_1_hours % step_hours != 0 ||
+      sparam->phase_2_hours % step_hours != 0 ||
+      sparam->phase_3_hours % step_hours != 0 ||
+      sparam->phase_4_hours % step_hours != 0) {
+    Log::Fatal("Simulate", "step_hours (", step_hours,
+               ") must divide 24 and the duration of each phase");
+  }
+  // The number of repetitions that this run simulates at once
+  int repetitions = sparam->mode == "sim-and-analytical"
+                        ? sparam->repeat
+                        : param->Get<OptimizationParam>()->repetition;
+  uint32_t lanes = ensemble_key.empty()
+                       ? 1
+                       : std::min<uint32_t>(sparam->ensemble_lanes,
+                                            std::max(repetitions, 1));
+  if (lanes > 1 && (step_hours != 1 || sparam->super_agent_weight > 1 ||
+                    sparam->hybrid_metapopulation)) {
+    Log::Fatal("Simulate",
+               "ensemble_lanes requires step_hours 1, super_agent_weight 1 "
+               "and no hybrid_metapopulation");
+  }
+
+  // Fork the repetitions from one simulation (see SimParam::fork_phase). The
+  // first one is the result of this call, the others are returned by the next
+  // calls with the same parameters.
+  BranchPlan repetition_plan;
+  if (plan == nullptr && sparam->fork_phase >= 0 && repetitions > 1 &&
+      !ensemble_key.empty()) {
+    repetition_plan.phase = sparam->fork_phase;
+    repetition_plan.patches.assign(repetitions, "");
+    for (int r = 0; r < repetitions; r++) {
+      repetition_plan.runs.push_back(run + r);
+    }
+    *GetRunIndex() += repetitions - 1;
+    plan = &repetition_plan;
+  }
+  if (plan != nullptr && lanes > 1) {
+    Log::Fatal("Simulate",
+               "Forked branches (fork_phase or a scenario tree) and "
+               "ensemble_lanes exclude each other");
+  }
+  std::vector<TimeSeries> forked;
+  int branch_fd = -1;
+  std::shared_ptr<MunicipalitySeriesWriter> municipality_series;
+  auto municipality_series_file = [&]() {
+    return MunicipalitySeriesFile(sparam->municipality_series_dir, getpid(),
+                                  run, sparam->compress_municipality_series);
+  };
+  // Forks the branches of `plan` if they start at `phase`. Returns true in the
+  // parent, whose run ends there; the branches continue with their own
+  // parameters and random numbers.
+  auto fork_at = [&](uint8_t phase) {
+    if (plan == nullptr || plan->phase != phase) {
+      return false;
+    }
+    if (municipality_series != nullptr) {
+      municipality_series->Flush();
+    }
+    auto branch = ForkBranches(*plan, &forked, &branch_fd);
+    if (branch < 0) {
+      // The branches continue the statistics in files of their own
+      if (municipality_series != nullptr) {
+        municipality_series->Discard();
+      }
+      return true;
+    }
+    if (!plan->patches[branch].empty()) {
+      param->MergeJsonPatch(plan->patches[branch]);
+      sparam = param->Get<SimParam>();
+    }
+    run = plan->runs[branch];
+    SeedRun(&simulation, seed, run);
+    if (municipality_series != nullptr) {
+      municipality_series->Branch(municipality_series_file());
+    }
+    plan = plan->subplans.empty() ? nullptr : &plan->subplans[branch];
+    return false;
+  };
+  // Hands the results of the leaves on: to the parent of a branch, or to the
+  // caller
+  auto finish_forked = [&]() {
+    if (branch_fd >= 0) {
+      FinishBranch(branch_fd, forked);
+    }
+    if (branch_results != nullptr) {
+      *branch_results = std::move(forked);
+      return 0;
+    }
+    *result = std::move(forked[0]);
+    forked.erase(forked.begin());
+    EnsembleResults::GetInstance()->Store(ensemble_key, std::move(forked));
+    return 0;
+  };
+  // Points that are ruled out before the agent run are reported with the
+  // largest error
+  auto skip_run = [&](const std::string& estimate, real_t error) {
+    result->Add("aborted_mse", {0}, {std::numeric_limits<real_t>::max()});
+    result->Add(estimate, {0}, {error});
+    result->Add("resolution", {0}, {0});
+    result->Add("repetitions", {0},
+                {static_cast<real_t>(
+                    param->Get<OptimizationParam>()->repetition)});
+    return 0;
+  };
+
+  // Skip the agent run if the analytical model already rules out this point
+  real_t analytical_error = 0;
+  if (MayStopEarly(sparam) && sparam->analytical_prescreen_factor > 0 &&
+      RejectByAnalyticalPrescreen(sparam, &analytical_error)) {
+    std::cout << "Rejected by the analytical pre-screen (MSE "
+              << analytical_error << ")" << std::endl;
+    return skip_run("analytical_mse", analytical_error);
+  }
+
+  // Skip the agent run if the surrogate is confident that this point is bad
+  auto* surrogate = MayStopEarly(sparam) ? GetSurrogate(param) : nullptr;
+  if (surrogate != nullptr) {
+    auto x = surrogate->Features(json::parse(param->ToJsonString()));
+    if (surrogate->ShouldSkip(x, sparam)) {
+      real_t predicted = 0;
+      real_t lower_bound = 0;
+      surrogate->Predict(x, sparam->surrogate_confidence, &predicted,
+                         &lower_bound);
+      std::cout << "Skipped by the surrogate (predicted MSE " << predicted
+                << ", at least " << lower_bound << ")" << std::endl;
+      return skip_run("surrogate_mse", predicted);
+    }
+  }
+
   // turn off load balancing as the custom environment does not support it
   scheduler->UnscheduleOp(scheduler->GetOps("load balancing")[0]);
   scheduler->UnscheduleOp(scheduler->GetOps("mechanical forces")[0]);
+  // the hourly kernel runs the behaviors of all persons
+  scheduler->UnscheduleOp(scheduler->GetOps("behavior")[0]);
 
   auto* covid_env = new CovidEnvironment();
   simulation.SetEnvironment(covid_env);
@@ -63,16 +249,49 @@ inline int Simulate(int argc, const char** argv, TimeSeries* result,
 
   {
     Timing timer("Initialization", scheduler->GetOpTimes());
-    InitializePopulation(cbsdir, randominit);
+    InitializePopulation(cbsdir, randominit, seed);
+    if (lanes > 1) {
+      InitializeDiseaseLanes(lanes - 1);
+    }
   }
 
   // Add counters to the simulations to create statistics for plotting
   SetupResultCollection(&simulation);
 
+  // Build the read-only context of each timestep once, before the agents run
+  auto* update_step_context_op = NewOperation("update step context");
+  scheduler->ScheduleOp(update_step_context_op, OpType::kPreSchedule);
+
+  auto* hourly_kernel_op = NewOperation("hourly kernel");
+  scheduler->ScheduleOp(hourly_kernel_op);
+
+  // Advance the municipalities without agents (must be BEFORE update
+  // statistics)
+  if (sparam->hybrid_metapopulation) {
+    auto* metapopulation_op = NewOperation("metapopulation");
+    scheduler->ScheduleOp(metapopulation_op);
+  }
+
   // Schedule the operation for updating the statistical data of this model
   auto* update_statistics_op = NewOperation("update statistics");
+  update_statistics_op->GetImplementation<UpdateStatisticsOp>()->SetNumLanes(
+      lanes - 1);
   scheduler->ScheduleOp(update_statistics_op);
 
+  // Used to generate a heat map of the infections of the country
+  if (sparam->export_infected_per_timestep_frequency != 0) {
+    const auto& dir = sparam->municipality_series_dir;
+    if (system(Concat("mkdir -p ", dir).c_str())) {
+      Log::Fatal("Simulate", "Failed to make output directory ", dir);
+    }
+    municipality_series = std::make_shared<MunicipalitySeriesWriter>(
+        municipality_series_file(),
+        sparam->export_infected_per_timestep_frequency,
+        sparam->compress_municipality_series);
+    update_statistics_op->GetImplementation<UpdateStatisticsOp>()
+        ->municipality_series_ = municipality_series;
+  }
+
   // Schedule the operation for initializing the infections (must be AFTER update statistics)
   auto* initial_infections = NewOperation("initial infection");
   scheduler->ScheduleOp(initial_infections);
@@ -82,57 +301,136 @@ inline int Simulate(int argc, const char** argv, TimeSeries* result,
     scheduler->ScheduleOp(export_statistics_op);
   }
 
+  if (fork_at(0)) {
+    return finish_forked();
+  }
+
   Timing timer("Simulation", scheduler->GetOpTimes());
+  auto sim_start = std::chrono::steady_clock::now();
 
   // Run simulation - phase 0 (initial infections)
   // Run until we reach a total number of infection count greater or equal to the estimated initial infections
   std::cout << "Starting Phase 0..." << std::endl;
-  kActivePhase = 0;
-  std::vector<int> initial_infected;
-  std::string data_dir = GetDataDir();
-  std::string init_infected_file =
-      data_dir + "/initial_infected_per_municipality.csv";
-
-  CsvToVector<int>(init_infected_file, &initial_infected, 1, 0);
+  auto initial_infected = InputBundle::Get().GetArray<int>(
+      "initial_infected_per_municipality.csv");
   auto real_infection_count = std::accumulate(initial_infected.begin(), initial_infected.end(), 0) / GetAgentToPersonRatio();
   auto init_infection_time = sparam->init_infection_time;
   auto infection_reached = [&]() {
-    if (scheduler->GetSimulatedSteps() < init_infection_time) {
+    if (GetSimulatedHours() < init_infection_time) {
       return false;
     } else {
       return true;
     }
   };
   scheduler->SimulateUntil(infection_reached);
-  std::cout << "It took " << scheduler->GetSimulatedSteps() << " timesteps to reach the initial infection situation" << std::endl;
+  std::cout << "It took " << GetSimulatedHours() << " hours to reach the initial infection situation" << std::endl;
 
   // Now that we reached the estimated initial state, we can remove the artificial infection behavior and let the model run the SEIR behavior only
   scheduler->UnscheduleOp(scheduler->GetOps("initial infection")[0]);
+  if (fork_at(1)) {
+    return finish_forked();
+  }
+
+  // The export statistics operation needs the behaviors to run every hour, the
+  // metapopulation is advanced per timestep, and the lanes of an ensemble are
+  // not fast-forwarded
+  auto fast_forward = sparam->fast_forward_night && !exportstats &&
+                      !sparam->hybrid_metapopulation && step_hours == 1 &&
+                      lanes == 1;
+
+  // A calibration run stops after the last hour that ComputeError needs, and
+  // is aborted as soon as its error is known to exceed the abort threshold
+  auto horizon = GetRunHorizon(sparam);
+  auto abort_threshold = std::numeric_limits<real_t>::infinity();
+  if (MayStopEarly(sparam) &&
+      param->Get<OptimizationParam>()->repetition <= 1) {
+    abort_threshold = GetAbortThreshold(sparam);
+  }
+  std::vector<real_t> observed;
+  if (abort_threshold != std::numeric_limits<real_t>::infinity()) {
+    TimeSeries observed_ts;
+    ImportObservedData(&observed_ts);
+    observed = observed_ts.GetYValues("observed_hospitalization");
+  }
+  bool stopped = false;
+  real_t aborted_error = -1;
+  // Simulates at most one day at a time, such that the error can be checked in
+  // between. The days end at noon if possible, so that the nights are not
+  // split for fast-forwarding.
+  auto simulate_phase = [&](uint64_t hours) {
+    const uint64_t day_end = 12 % step_hours == 0 ? 12 : 0;
+    while (!stopped && hours > 0) {
+      auto now = GetSimulatedHours();
+      if (now >= horizon) {
+        stopped = true;
+        break;
+      }
+      uint64_t chunk =
+          kHoursPerDay - (now + kHoursPerDay - day_end) % kHoursPerDay;
+      chunk = std::min({chunk, hours, horizon - now});
+      SimulateHours(&simulation, chunk, fast_forward);
+      hours -= chunk;
+      if (!observed.empty()) {
+        auto* ts = simulation.GetTimeSeries();
+        auto err = PartialError(
+            observed, SelectDailySamples(ts->GetXValues("ts_hospitalized"),
+                                         ts->GetYValues("ts_hospitalized")));
+        if (err > abort_threshold) {
+          aborted_error = err;
+          stopped = true;
+        }
+      }
+    }
+  };
 
   // Run simulation - phase 1
   std::cout << "Starting Phase 1..." << std::endl;
-  kActivePhase = 0;
-  scheduler->Simulate(sparam->phase_1_hours);
+  simulate_phase(sparam->phase_1_hours);
 
   // Prepare for phase 2 - working from home policy
-  std::cout << "Starting Phase 2..." << std::endl;
-  kActivePhase = 1;
-  MobilityReductionPhase2();
-  AdjustMixingMatrices(kActivePhase);
-  SchoolClosure();
-  scheduler->Simulate(sparam->phase_2_hours);
-
-  std::cout << "Starting Phase 3..." << std::endl;
-  kActivePhase = 2;
-  MobilityReductionPhase3();
-  scheduler->Simulate(sparam->phase_3_hours);
-
-  std::cout << "Starting Phase 4..." << std::endl;
-  kActivePhase = 3;
-  AdjustMixingMatrices(kActivePhase);
-  scheduler->Simulate(sparam->phase_4_hours);
+  if (!stopped && fork_at(2)) {
+    return finish_forked();
+  }
+  if (!stopped) {
+    std::cout << "Starting Phase 2..." << std::endl;
+    MobilityReductionPhase2();
+    AdjustMixingMatrices(1);
+    SchoolClosure();
+    simulate_phase(sparam->phase_2_hours);
+  }
+
+  if (!stopped && fork_at(3)) {
+    return finish_forked();
+  }
+  if (!stopped) {
+    std::cout << "Starting Phase 3..." << std::endl;
+    MobilityReductionPhase3();
+    AdjustMixingMatrices(2);
+    simulate_phase(sparam->phase_3_hours);
+  }
+
+  if (!stopped && fork_at(4)) {
+    return finish_forked();
+  }
+  if (!stopped) {
+    std::cout << "Starting Phase 4..." << std::endl;
+    AdjustMixingMatrices(3);
+    simulate_phase(sparam->phase_4_hours);
+  }
+
+  if (aborted_error >= 0) {
+    std::cout << "Aborted at hour " << GetSimulatedHours()
+              << ", the error is at least " << aborted_error << std::endl;
+    simulation.GetTimeSeries()->Add("aborted_mse", {0}, {aborted_error});
+  }
 
   timer.~Timing();
+  std::chrono::duration<double> sim_duration =
+      std::chrono::steady_clock::now() - sim_start;
+  // The agent-hours that the behaviors were run for; each lane of an ensemble
+  // is an agent of its own
+  auto* kernel = hourly_kernel_op->GetImplementation<HourlyKernelOp>();
+  auto agent_hours = kernel->GetAgentHours() * lanes;
 
   if (exportstats) {
     auto op = scheduler->GetOps("export statistics")[0]
@@ -143,28 +441,21 @@ inline int Simulate(int argc, const char** argv, TimeSeries* result,
                                     op->avg_person_interactions_over_time);
   }
 
-  // We keep track of all timesteps at the operation, and then we add a timeseries entry per timestep (because Timeseries::Data cannot handle tracking vector<real> per timestep)
-  // Used to generate a heat map of the hospital admissions of the country
-  auto f = sparam->export_infected_per_timestep_frequency;
-  if (f != 0) {
-    auto update_stat_op = Simulation::GetActive()
-                        ->GetScheduler()
-                        ->GetOps("update statistics")[0]
-                        ->GetImplementation<UpdateStatisticsOp>();
-    auto& total_inf_per_mun_over_time = update_stat_op->total_infected_per_municipality_;
-    auto& total_per_mun_over_time = update_stat_op->total_per_municipality_;
-    for (size_t t = 0; t < total_inf_per_mun_over_time.size(); t++) {
-      std::vector<real_t> x_values(total_inf_per_mun_over_time[t].size());
-      std::iota(std::begin(x_values), std::end(x_values), 0);
-      std::string ts_name = "total_infected_per_municipality_t" + std::to_string(t * f);
-      std::string ts_name2 = "total_per_municipality_t" + std::to_string(t * f);
-      simulation.GetTimeSeries()->Add(ts_name, x_values, total_inf_per_mun_over_time[t]);
-      simulation.GetTimeSeries()->Add(ts_name2, x_values, total_per_mun_over_time[t]);
-    }
+  // The per-municipality statistics were streamed to a file; the result only
+  // refers to it (see ExportResults)
+  if (municipality_series != nullptr) {
+    municipality_series->Flush();
+    simulation.GetTimeSeries()->Add("municipality_series",
+                                    {static_cast<real_t>(getpid())},
+                                    {static_cast<real_t>(run)});
   }
 
   if (print_timings) {
     std::cout << *(scheduler->GetOpTimes()) << std::endl;
+    std::cout << "Agent-hours per second: "
+              << agent_hours / sim_duration.count() << " ("
+              << kernel->GetSkippedHours() << " of " << GetSimulatedHours()
+              << " hours fast-forwarded)" << std::endl;
   }
 
   // Add any other results or metadata of interest
@@ -180,9 +471,27 @@ inline int Simulate(int argc, const char** argv, TimeSeries* result,
 
   // move time series data from simulation to result
   *result = std::move(*simulation.GetTimeSeries());
+  if (lanes > 1) {
+    EnsembleResults::GetInstance()->Store(
+        ensemble_key, GetLaneResults(GetStatistics(&simulation), *result));
+  }
+  // A run that stopped before it forked its branches is the result of all
+  // their leaves
+  if (plan != nullptr) {
+    forked.assign(plan->GetNumLeaves(), *result);
+    return finish_forked();
+  }
+  if (branch_fd >= 0) {
+    FinishBranch(branch_fd, {*result});
+  }
   return 0;
 }
 
+inline int Simulate(int argc, const char** argv, TimeSeries* result,
+                    Param* final_params = nullptr) {
+  return SimulateImpl(argc, argv, result, final_params, nullptr, nullptr);
+}
+
 }  // namespace bdm
 
 #endif  // CBS_COVID_H_
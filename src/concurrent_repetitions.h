@@ -0,0 +1,235 @@
+#ifndef CONCURRENT_REPETITIONS_H_
+#define CONCURRENT_REPETITIONS_H_
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "TBufferFile.h"
+#include "biodynamo.h"
+
+extern char** environ;
+
+namespace bdm {
+
+// The environment variable that makes a process a worker of
+// RunConcurrentRepetitions: "<fd> <first> <stride> <repetitions>"
+constexpr const char* kRepetitionWorkerEnv = "CBS_COVID_REPETITION_WORKER";
+
+// The index of the next run of Simulate in this process. It selects the random
+// streams of the run (see SeedRun), such that the repetitions of this process
+// differ, and a worker reproduces the repetition that it is assigned.
+inline uint64_t* GetRunIndex() {
+  static uint64_t index = 0;
+  return &index;
+}
+
+// Writes `ts` to `fd`, prefixed with its size
+inline bool WriteTimeSeries(int fd, const TimeSeries& ts) {
+  TBufferFile buffer(TBuffer::kWrite);
+  buffer.WriteObjectAny(&ts, TimeSeries::Class());
+  uint64_t size = buffer.Length();
+  auto write_all = [&](const char* data, size_t n) {
+    while (n > 0) {
+      auto written = write(fd, data, n);
+      if (written <= 0) {
+        return false;
+      }
+      data += written;
+      n -= written;
+    }
+    return true;
+  };
+  return write_all(reinterpret_cast<const char*>(&size), sizeof(size)) &&
+         write_all(buffer.Buffer(), size);
+}
+
+// Reads the time series that start at `*offset` of `data` (see
+// WriteTimeSeries) and advances `*offset`. Returns false at the end.
+inline bool ReadTimeSeries(const std::vector<char>& data, size_t* offset,
+                           TimeSeries* ts) {
+  uint64_t size = 0;
+  if (*offset + sizeof(size) > data.size()) {
+    return false;
+  }
+  std::memcpy(&size, data.data() + *offset, sizeof(size));
+  *offset += sizeof(size);
+  if (*offset + size > data.size()) {
+    return false;
+  }
+  TBufferFile buffer(TBuffer::kRead, size,
+                     const_cast<char*>(data.data() + *offset), false);
+  auto* read = reinterpret_cast<TimeSeries*>(
+      buffer.ReadObjectAny(TimeSeries::Class()));
+  *offset += size;
+  if (read == nullptr) {
+    return false;
+  }
+  *ts = std::move(*read);
+  delete read;
+  return true;
+}
+
+// Reads everything that the child processes `pids` write to the pipes `fds`
+// until they exit. All pipes are read at the same time, such that no child
+// blocks on a full pipe. Fails if a child did not exit normally.
+inline std::vector<std::vector<char>> CollectWorkerOutput(
+    const std::vector<int>& fds, const std::vector<pid_t>& pids,
+    const char* caller) {
+  std::vector<std::vector<char>> data(fds.size());
+  std::vector<pollfd> polled(fds.size());
+  for (size_t w = 0; w < fds.size(); w++) {
+    polled[w] = {fds[w], POLLIN, 0};
+  }
+  size_t open = fds.size();
+  std::vector<char> chunk(1 << 16);
+  while (open > 0) {
+    if (poll(polled.data(), polled.size(), -1) < 0) {
+      continue;
+    }
+    for (size_t w = 0; w < polled.size(); w++) {
+      if (polled[w].fd < 0 || polled[w].revents == 0) {
+        continue;
+      }
+      auto n = read(polled[w].fd, chunk.data(), chunk.size());
+      if (n > 0) {
+        data[w].insert(data[w].end(), chunk.begin(), chunk.begin() + n);
+      } else {
+        close(polled[w].fd);
+        polled[w].fd = -1;
+        open--;
+      }
+    }
+  }
+  for (size_t w = 0; w < pids.size(); w++) {
+    int status = 0;
+    waitpid(pids[w], &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      Log::Fatal(caller, "Worker ", w, " failed");
+    }
+  }
+  return data;
+}
+
+// Runs the repetitions `0, ..., repetitions - 1` of a simulation in `workers`
+// concurrent processes, each with its own Simulation and an equal share of the
+// OpenMP threads. This pays off for small populations, whose runs do not scale
+// to all threads. The workers are new instances of this executable with the
+// same command line (see RunRepetitionWorker), which send their results back
+// through a pipe. Returns the results in the order of the repetitions.
+inline std::vector<TimeSeries> RunConcurrentRepetitions(int argc,
+                                                        const char** argv,
+                                                        uint64_t repetitions,
+                                                        uint32_t workers) {
+  workers = std::min<uint64_t>(workers, repetitions);
+  auto max_threads = ThreadInfo::GetInstance()->GetMaxThreads();
+  auto threads = std::max(1, max_threads / static_cast<int>(workers));
+
+  // Everything the workers need is prepared before forking, such that they
+  // only have to exec
+  std::vector<char*> args;
+  for (int i = 0; i < argc; i++) {
+    args.push_back(const_cast<char*>(argv[i]));
+  }
+  args.push_back(nullptr);
+  std::vector<std::array<int, 2>> pipes(workers);
+  std::vector<std::vector<std::string>> env_strings(workers);
+  std::vector<std::vector<char*>> envs(workers);
+  for (uint32_t w = 0; w < workers; w++) {
+    if (pipe2(pipes[w].data(), O_CLOEXEC) != 0) {
+      Log::Fatal("RunConcurrentRepetitions", "Could not create a pipe");
+    }
+    for (char** e = environ; *e != nullptr; e++) {
+      if (std::strncmp(*e, "OMP_NUM_THREADS=", 16) != 0) {
+        env_strings[w].push_back(*e);
+      }
+    }
+    env_strings[w].push_back(Concat("OMP_NUM_THREADS=", threads));
+    env_strings[w].push_back(Concat(kRepetitionWorkerEnv, "=", pipes[w][1],
+                                    " ", w, " ", workers, " ", repetitions));
+    for (auto& e : env_strings[w]) {
+      envs[w].push_back(&e[0]);
+    }
+    envs[w].push_back(nullptr);
+  }
+
+  std::vector<pid_t> pids(workers);
+  for (uint32_t w = 0; w < workers; w++) {
+    pids[w] = fork();
+    if (pids[w] < 0) {
+      Log::Fatal("RunConcurrentRepetitions", "Could not fork a worker");
+    }
+    if (pids[w] == 0) {
+      // The write end of its own pipe is the only one the worker inherits
+      fcntl(pipes[w][1], F_SETFD, 0);
+      execve("/proc/self/exe", args.data(), envs[w].data());
+      _exit(127);
+    }
+    close(pipes[w][1]);
+  }
+
+  std::vector<int> fds(workers);
+  for (uint32_t w = 0; w < workers; w++) {
+    fds[w] = pipes[w][0];
+  }
+  auto data = CollectWorkerOutput(fds, pids, "RunConcurrentRepetitions");
+
+  std::vector<TimeSeries> results(repetitions);
+  for (uint32_t w = 0; w < workers; w++) {
+    size_t offset = 0;
+    for (uint64_t r = w; r < repetitions; r += workers) {
+      if (!ReadTimeSeries(data[w], &offset, &results[r])) {
+        Log::Fatal("RunConcurrentRepetitions", "Worker ", w,
+                   " did not return repetition ", r);
+      }
+    }
+  }
+  // The next runs of this process continue with new random streams
+  *GetRunIndex() += repetitions;
+  return results;
+}
+
+// True if this process is a worker of RunConcurrentRepetitions
+inline bool IsRepetitionWorker() {
+  return std::getenv(kRepetitionWorkerEnv) != nullptr;
+}
+
+// Simulates the repetitions that RunConcurrentRepetitions assigned to this
+// process with `simulate(param, result)`, and sends the results back. Returns
+// the exit code of the worker.
+inline int RunRepetitionWorker(
+    const std::function<void(Param*, TimeSeries*)>& simulate,
+    const Param* param) {
+  std::istringstream assignment(std::getenv(kRepetitionWorkerEnv));
+  int fd = -1;
+  uint64_t first = 0;
+  uint64_t stride = 1;
+  uint64_t repetitions = 0;
+  assignment >> fd >> first >> stride >> repetitions;
+  for (uint64_t r = first; r < repetitions; r += stride) {
+    *GetRunIndex() = r;
+    // The simulation consumes its parameters
+    Param copy(*param);
+    TimeSeries result;
+    simulate(&copy, &result);
+    if (!WriteTimeSeries(fd, result)) {
+      Log::Warning("RunRepetitionWorker", "Could not send repetition ", r);
+      return 1;
+    }
+  }
+  close(fd);
+  return 0;
+}
+
+}  // namespace bdm
+
+#endif  // CONCURRENT_REPETITIONS_H_
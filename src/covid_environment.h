@@ -4,68 +4,190 @@
 #include "core/environment/environment.h"
 
 #include "csv_helper.h"
+#include "input_bundle.h"
+#include "metapopulation.h"
+#include "mobility_data.h"
 #include "model_facts.h"
 #include "person.h"
 #include "sim_param.h"
+#include "step_context.h"
 
+#include <memory>
 #include <string>
 #include <vector>
 
 namespace bdm {
 
+// A contact matrix between all demographic groups
+using MixingMatrix =
+    std::array<std::array<real_t, kNumDemographies>, kNumDemographies>;
+// The contact matrices of all situations (indexed by `Situation`)
+using MixingTensor = std::array<MixingMatrix, kNumSituations>;
+
+// The contact structure of every phase
+using PhaseMixing = std::array<MixingTensor, kNumPhases>;
+
 class CovidEnvironment : public Environment {
  public:
   CovidEnvironment() {
+    auto* sparam = Simulation::GetActive()->GetParam()->Get<SimParam>();
+    phase_mixing_ = LoadPhaseMixing(sparam);
+    SetPhase(0);
+    step_context_.env = this;
+    step_context_.sparam = sparam;
+  }
+
+  // Builds the contact structure of every phase from the mixing matrices of
+  // the InputBundle. Does not depend on the active simulation (see
+  // SolveAnalytical).
+  static PhaseMixing LoadPhaseMixing(const SimParam* sparam) {
     std::vector<std::string> filenames = {"Mix_h.csv", "Mix_o.csv", "Mix_s.csv",
                                           "Mix_w.csv", "Mix_ws.csv"};
     std::vector<Situation> situation_name = {
         Situation::kHome, Situation::kOther, Situation::kSchool,
         Situation::kWork, Situation::kWorkSchool};
 
-    // Convert rapidcsv::Document to 2D array (indexed as [row][column])
+    PhaseMixing phase_mixing;
+    auto& base = phase_mixing[0];
     int idx = 0;
     for (auto file : filenames) {
-      std::string data_dir = GetDataDir();
-      std::string full_path = data_dir + "/" + file;
-      CsvTo2DMatrix<real_t, kNumDemographies>(
-          full_path, &(mixing_matrices_[situation_name[idx]]));
+      CopyMixingMatrix(file, &(base[situation_name[idx]]));
       idx++;
     }
-    NormalizeInteractions();
+    NormalizeInteractions(sparam, &base);
+    BuildPhaseTensors(&phase_mixing);
+    return phase_mixing;
   }
 
   // Apply normalizations on hourly interactions, such that they make sense on a daily level
-  void NormalizeInteractions() {
-    auto* sparam = Simulation::GetActive()->GetParam()->Get<SimParam>();
+  static void NormalizeInteractions(const SimParam* sparam,
+                                    MixingTensor* tensor) {
     real_t norm_factor = sparam->avg_interactions / sparam->emperical_avg_interactions;
-    for (auto& mixmat : mixing_matrices_) {
+    for (auto& mixmat : *tensor) {
       for (size_t row = 0; row < kNumDemographies; row++) {
         for (size_t col = 0; col < kNumDemographies; col++) {
-          mixmat.second[row][col] = mixmat.second[row][col] * norm_factor;
+          mixmat[row][col] = mixmat[row][col] * norm_factor;
         }
       }
     }
   }
 
-  const std::array<std::array<real_t, kNumDemographies>, kNumDemographies>&
-  GetMixingMatrix(Situation situation) {
-    return mixing_matrices_[situation];
-  }
-
   // Peforms a element-wise multiplication of the reduction_matrix with all
-  // mixing matrices
-  void ApplyReduction(const std::array<std::array<real_t, kNumDemographies>,
-                                       kNumDemographies>& reduction_matrix) {
-    for (auto& mixmat : mixing_matrices_) {
-      assert(reduction_matrix.size() == mixmat.second.size());
+  // mixing matrices of `tensor`
+  static void ApplyReduction(const MixingMatrix& reduction_matrix,
+                             MixingTensor* tensor) {
+    for (auto& mixmat : *tensor) {
       for (size_t row = 0; row < kNumDemographies; row++) {
         for (size_t col = 0; col < kNumDemographies; col++) {
-          mixmat.second[row][col] = mixmat.second[row][col] * reduction_matrix[row][col];
+          mixmat[row][col] = mixmat[row][col] * reduction_matrix[row][col];
         }
       }
     }
   }
 
+  // The reductions are cumulative: each phase starts from the contact
+  // structure of the previous phase and applies its own reduction matrix (if
+  // any) on top of it. An empty file name means the phase keeps the contact
+  // structure of the previous phase.
+  static void BuildPhaseTensors(PhaseMixing* phase_mixing) {
+    const std::array<std::string, kNumPhases> reduction_files = {
+        "", "mixmat_phase2.csv", "", "mixmat_phase4.csv"};
+    for (uint8_t phase = 1; phase < kNumPhases; phase++) {
+      (*phase_mixing)[phase] = (*phase_mixing)[phase - 1];
+      if (reduction_files[phase].empty()) {
+        continue;
+      }
+      MixingMatrix reduction_matrix;
+      CopyMixingMatrix(reduction_files[phase], &reduction_matrix);
+      ApplyReduction(reduction_matrix, &(*phase_mixing)[phase]);
+    }
+  }
+
+  // Copies the matrix of the input file `file` of the InputBundle
+  static void CopyMixingMatrix(const std::string& file, MixingMatrix* matrix) {
+    auto values = InputBundle::Get().GetMatrix<real_t>(file);
+    if (values.size() != kNumDemographies ||
+        values.GetNumCols() != kNumDemographies) {
+      Log::Fatal("CovidEnvironment::CopyMixingMatrix", "Size mismatch: ", file,
+                 " is a (", values.size(), "x", values.GetNumCols(),
+                 ") matrix instead of (", kNumDemographies, "x",
+                 kNumDemographies, ")");
+    }
+    for (size_t row = 0; row < kNumDemographies; row++) {
+      for (size_t col = 0; col < kNumDemographies; col++) {
+        if (std::isnan(values[row][col])) {
+          Log::Warning("CovidEnvironment::CopyMixingMatrix",
+                       "Found NaN value in ", file, ". Entry (", row, ",", col,
+                       ")");
+        }
+        (*matrix)[row][col] = values[row][col];
+      }
+    }
+  }
+
+  // Per situation and demography, the summed contacts with all demographies
+  // (see DemographicMixing) of `phase`
+  ContactRates GetContactRates(uint8_t phase) const {
+    return ToContactRates(phase_mixing_[phase]);
+  }
+
+  static ContactRates ToContactRates(const MixingTensor& tensor) {
+    ContactRates contacts;
+    for (uint8_t s = 0; s < kNumSituations; s++) {
+      for (uint8_t d = 0; d < kNumDemographies; d++) {
+        contacts[s][d] = 0;
+        for (uint8_t other = 0; other < kNumDemographies; other++) {
+          contacts[s][d] += tensor[s][d][other];
+        }
+      }
+    }
+    return contacts;
+  }
+
+  // Switches the contact structure to the (precomputed) one of `phase`
+  void SetPhase(uint8_t phase) {
+    assert(phase < kNumPhases && "Phase out of range");
+    phase_ = phase;
+    active_mixing_ = &phase_mixing_[phase];
+  }
+
+  uint8_t GetPhase() const { return phase_; }
+
+  const MixingMatrix& GetMixingMatrix(Situation situation) const {
+    return (*active_mixing_)[situation];
+  }
+
+  void SetStepContext(const StepContext& ctx) { step_context_ = ctx; }
+
+  const StepContext& GetStepContext() const { return step_context_; }
+
+  // Marks the timesteps before `timestep` as fast-forwarded
+  void SetFastForwardUntil(uint64_t timestep) {
+    fast_forward_until_ = timestep;
+  }
+
+  uint64_t GetFastForwardUntil() const { return fast_forward_until_; }
+
+  // The summed weight of all agents (0 if not set, i.e. one per agent)
+  void SetTotalWeight(uint64_t total_weight) { total_weight_ = total_weight; }
+
+  uint64_t GetTotalWeight() const { return total_weight_; }
+
+  // The municipalities that are not simulated with agents (nullptr unless
+  // SimParam::hybrid_metapopulation is set)
+  void SetMetapopulation(std::unique_ptr<Metapopulation> metapopulation) {
+    metapopulation_ = std::move(metapopulation);
+  }
+
+  Metapopulation* GetMetapopulation() const { return metapopulation_.get(); }
+
+  // The mobility data of this simulation (see InitializeMobilityData)
+  void SetMobilityData(std::unique_ptr<MobilityData> mobility_data) {
+    mobility_data_ = std::move(mobility_data);
+  }
+
+  MobilityData* GetMobilityData() const { return mobility_data_.get(); }
+
   void Clear() override {}
 
   void UpdateImplementation() override {}
@@ -102,11 +224,33 @@ class CovidEnvironment : public Environment {
                        const Agent* query_agent = nullptr) override{};
 
  private:
-  std::unordered_map<Situation, std::array<std::array<real_t, kNumDemographies>,
-                                           kNumDemographies>>
-      mixing_matrices_;
+  // The normalized and reduced contact structure of every phase. These are
+  // built once and never modified afterwards, such that a phase change only
+  // swaps `active_mixing_`
+  PhaseMixing phase_mixing_;
+  const MixingTensor* active_mixing_ = nullptr;
+  uint8_t phase_ = 0;
+  StepContext step_context_;
+  uint64_t fast_forward_until_ = 0;
+  uint64_t total_weight_ = 0;
+  std::unique_ptr<Metapopulation> metapopulation_;
+  std::unique_ptr<MobilityData> mobility_data_;
 };
 
+// Returns the context of the current timestep of the active simulation
+inline const StepContext& GetStepContext() {
+  auto* env = bdm_static_cast<CovidEnvironment*>(
+      Simulation::GetActive()->GetEnvironment());
+  return env->GetStepContext();
+}
+
+// Returns the mobility data of the active simulation
+inline MobilityData* GetMobilityData() {
+  auto* env = bdm_static_cast<CovidEnvironment*>(
+      Simulation::GetActive()->GetEnvironment());
+  return env->GetMobilityData();
+}
+
 }  // namespace bdm
 
 #endif  // COVID_ENVIRONMENT_H_
@@ -1,42 +1,65 @@
 #ifndef CSV_HELPER_H_
 #define CSV_HELPER_H_
 
-#include "core/util/csv_reader.h"
-#include "core/util/log.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <string>
+#include <vector>
 
-#ifdef __APPLE__
-#ifdef _LIBCPP_DEPRECATED_EXPERIMENTAL_FILESYSTEM
-#include <experimental/filesystem>
-namespace fs = std::experimental::filesystem;
-#else
-#include <filesystem>
-namespace fs = std::__fs::filesystem;
-#endif
-#else
-#include <experimental/filesystem>
-namespace fs = std::experimental::filesystem;
-#endif
+#include "core/util/log.h"
 
+#include "csv_parser.h"
+#include "input_bundle.h"
 
 namespace bdm {
 
+// The loaders below take the values of the model inputs from the InputBundle
+// instead of parsing the file again
+template <typename T>
+inline bool FindBundled(const std::string& file_path, bool matrix,
+                        size_t column, int skip_header,
+                        MatrixView<T>* values) {
+  auto data_dir = GetDataDir() + "/";
+  return file_path.compare(0, data_dir.size(), data_dir) == 0 &&
+         InputBundle::Get().Lookup(file_path, matrix, column, skip_header,
+                                   values);
+}
+
+// Parses a numeric CSV into a contiguous row-major table (see ParseCsv). With
+// `validate`, rows of different lengths and cells that are not numbers are
+// fatal.
+template <typename T>
+inline CsvTable<T> CsvToTable(const std::string& file_path,
+                              int skip_header = -1, int column = -1,
+                              bool validate = false) {
+  CsvOptions options;
+  options.header_row = skip_header;
+  options.column = column;
+  options.validate = validate;
+  CsvTable<T> table;
+  auto error = ParseCsv(file_path, options, &table);
+  if (!error.empty()) {
+    Log::Fatal("CsvToTable", error);
+  }
+  return table;
+}
+
 // Reads in a CSV and converts it to a C++ 2D vector
 template <typename T>
 inline void CsvTo2DMatrix(const std::string& file_path,
                           std::vector<std::vector<T>>* matrix,
                           int skip_header = -1) {
-  if (!fs::exists(file_path)) {
-    Log::Fatal("CsvTo2DMatrix", "File not found: ", file_path);
+  MatrixView<T> bundled;
+  if (FindBundled(file_path, true, 0, skip_header, &bundled)) {
+    for (size_t row = 0; row < bundled.size(); row++) {
+      matrix->emplace_back(bundled[row].begin(), bundled[row].end());
+    }
+    return;
   }
-  rapidcsv::ConverterParams converter(true);
-  rapidcsv::SeparatorParams separator;
-  rapidcsv::LabelParams labels(skip_header);  // no header
-
-  auto doc = rapidcsv::Document(file_path, labels, separator, converter);
-  auto num_rows = doc.GetRowCount();
-
-  for (size_t row = 0; row < num_rows; row++) {
-    matrix->push_back(doc.GetRow<T>(row));
+  auto table = CsvToTable<T>(file_path, skip_header);
+  for (size_t row = 0; row < table.rows; row++) {
+    matrix->emplace_back(table[row], table[row] + table.cols);
   }
 }
 
@@ -45,30 +68,25 @@ template <typename T, int size>
 inline void CsvTo2DMatrix(const std::string& file_path,
                           std::array<std::array<T, size>, size>* matrix,
                           int skip_header = -1) {
-  if (!fs::exists(file_path)) {
-    Log::Fatal("CsvTo2DMatrix", "File not found: ", file_path);
+  MatrixView<T> values;
+  CsvTable<T> table;
+  if (!FindBundled(file_path, true, 0, skip_header, &values)) {
+    table = CsvToTable<T>(file_path, skip_header);
+    values = MatrixView<T>(table.values.data(), table.rows, table.cols);
   }
-  rapidcsv::ConverterParams converter(true);
-  rapidcsv::SeparatorParams separator;
-  rapidcsv::LabelParams labels(skip_header);  // no header
-
-  auto doc = rapidcsv::Document(file_path, labels, separator, converter);
-  auto num_rows = doc.GetRowCount();
-  auto num_cols = doc.GetColumnCount();
-
-  if (static_cast<int>(num_rows) != size ||
-      static_cast<int>(num_cols) != size) {
-    Log::Fatal("CsvTo2DMatrix", "Size mismatch: trying to read a (", num_rows,
-               "x", num_rows, ") CSV matrix into a (", size, "x", size,
-               ") C++ 2D array");
+  if (static_cast<int>(values.size()) != size ||
+      static_cast<int>(values.GetNumCols()) != size) {
+    Log::Fatal("CsvTo2DMatrix", "Size mismatch: trying to read a (",
+               values.size(), "x", values.GetNumCols(),
+               ") CSV matrix into a (", size, "x", size, ") C++ 2D array");
   }
 
-  for (size_t row = 0; row < num_rows; row++) {
-    for (size_t col = 0; col < num_cols; col++) {
-      if (std::isnan(doc.GetCell<T>(col, row))) {
+  for (int row = 0; row < size; row++) {
+    for (int col = 0; col < size; col++) {
+      if (std::isnan(values[row][col])) {
         Log::Warning("CsvTo2DMatrix", "Found NaN value in ", file_path, ". Entry (", row, ",", col, ")");
       }
-      (*matrix)[row][col] = doc.GetCell<T>(col, row);
+      (*matrix)[row][col] = values[row][col];
     }
   }
 }
@@ -77,16 +95,12 @@ inline void CsvTo2DMatrix(const std::string& file_path,
 template <typename T>
 inline void CsvToVector(const std::string& file_path, std::vector<T>* vector,
                         size_t column = 0, int skip_header = -1) {
-  if (!fs::exists(file_path)) {
-    Log::Fatal("CsvToVector", "File not found: ", file_path);
+  MatrixView<T> bundled;
+  if (FindBundled(file_path, false, column, skip_header, &bundled)) {
+    vector->assign(bundled[0].begin(), bundled[0].end());
+    return;
   }
-  rapidcsv::ConverterParams converter(true);
-  rapidcsv::SeparatorParams separator;
-  rapidcsv::LabelParams labels(skip_header);  // no header
-
-  auto doc = rapidcsv::Document(file_path, labels, separator, converter);
-
-  *vector = doc.GetColumn<T>(column);
+  *vector = CsvToTable<T>(file_path, skip_header, column).values;
 }
 
 }  // namespace bdm
@@ -0,0 +1,292 @@
+#ifndef CSV_PARSER_H_
+#define CSV_PARSER_H_
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace bdm {
+
+// How ParseCsv reads a file
+struct CsvOptions {
+  // The index of the header row: this row and all rows before it are skipped
+  // (-1 for none, as rapidcsv::LabelParams)
+  int header_row = -1;
+  // Only read this column, one value per row (-1 reads all columns)
+  int column = -1;
+  // Only read these distinct columns, in this order, one value each per row
+  // (replaces `column` if not empty)
+  std::vector<int> columns;
+  // Fail on rows of different lengths, missing columns and cells that are not
+  // numbers, instead of filling them with the default value (NaN for floating
+  // point numbers, 0 for integers)
+  bool validate = false;
+};
+
+// The numbers of a CSV file, in row-major order
+template <typename T>
+struct CsvTable {
+  std::vector<T> values;
+  size_t rows = 0;
+  size_t cols = 0;
+  // The cells that are not numbers, or NaN
+  size_t invalid = 0;
+
+  const T* operator[](size_t row) const { return values.data() + row * cols; }
+};
+
+namespace csv_parser_detail {
+
+// A read-only memory mapping of a whole file
+class MappedFile {
+ public:
+  explicit MappedFile(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return;
+    }
+    struct stat st = {};
+    if (fstat(fd, &st) == 0) {
+      size_ = st.st_size;
+      found_ = true;
+      if (size_ != 0) {
+        void* data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+          found_ = false;
+        } else {
+          data_ = static_cast<const char*>(data);
+          madvise(data, size_, MADV_SEQUENTIAL);
+        }
+      }
+    }
+    close(fd);
+  }
+
+  ~MappedFile() {
+    if (data_ != nullptr) {
+      munmap(const_cast<char*>(data_), size_);
+    }
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  bool IsFound() const { return found_; }
+  const char* begin() const { return data_; }
+  const char* end() const { return data_ + size_; }
+
+ private:
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+  bool found_ = false;
+};
+
+inline bool Convert(const char* s, char** end, float* value) {
+  *value = std::strtof(s, end);
+  return true;
+}
+inline bool Convert(const char* s, char** end, double* value) {
+  *value = std::strtod(s, end);
+  return true;
+}
+template <typename T>
+inline bool Convert(const char* s, char** end, T* value) {
+  if (std::is_signed<T>::value) {
+    *value = static_cast<T>(std::strtoll(s, end, 10));
+  } else {
+    *value = static_cast<T>(std::strtoull(s, end, 10));
+  }
+  return true;
+}
+
+template <typename T>
+inline T DefaultValue() {
+  return std::numeric_limits<T>::has_quiet_NaN
+             ? std::numeric_limits<T>::quiet_NaN()
+             : T();
+}
+
+// Converts the cell [begin, end) (without quotes). Returns false if it is not
+// a number, or only starts with one and `strict` is set.
+template <typename T>
+inline bool ParseValue(const char* begin, const char* end, bool strict,
+                       T* value) {
+  while (begin < end && (*begin == ' ' || *begin == '\t')) {
+    begin++;
+  }
+  while (end > begin && (end[-1] == ' ' || end[-1] == '\t')) {
+    end--;
+  }
+  // The conversion functions need a terminated string; numbers are short
+  char buffer[64];
+  size_t length = end - begin;
+  if (length == 0 || length >= sizeof(buffer)) {
+    *value = DefaultValue<T>();
+    return false;
+  }
+  std::memcpy(buffer, begin, length);
+  buffer[length] = '\0';
+  char* parsed = buffer;
+  Convert(buffer, &parsed, value);
+  if (parsed == buffer || (strict && parsed != buffer + length)) {
+    *value = DefaultValue<T>();
+    return false;
+  }
+  return !std::isnan(static_cast<double>(*value));
+}
+
+}  // namespace csv_parser_detail
+
+// Parses the numeric CSV file `path` into `table`. The file is mapped into
+// memory and scanned once: lines and separators are found with memchr (which
+// the C library vectorizes) and each cell is converted in place, without
+// building strings per cell or row. Cells may be quoted; quoted line breaks
+// are not supported. Returns an empty string on success, otherwise a
+// description of the problem.
+template <typename T>
+inline std::string ParseCsv(const std::string& path, const CsvOptions& options,
+                            CsvTable<T>* table) {
+  using csv_parser_detail::ParseValue;
+  table->values.clear();
+  table->rows = 0;
+  table->cols = 0;
+  table->invalid = 0;
+  csv_parser_detail::MappedFile file(path);
+  if (!file.IsFound()) {
+    return "File not found: " + path;
+  }
+  // The columns to read, and the index of each column within a row of
+  // `table` (-1 if not read) up to the last column to read
+  auto columns = options.columns;
+  if (columns.empty() && options.column >= 0) {
+    columns.push_back(options.column);
+  }
+  std::vector<int> slots;
+  for (size_t i = 0; i < columns.size(); i++) {
+    auto column = columns[i];
+    if (column >= 0 && static_cast<size_t>(column) >= slots.size()) {
+      slots.resize(column + 1, -1);
+    }
+    if (column < 0 || slots[column] >= 0) {
+      return "Invalid or repeated column to read: " + std::to_string(column);
+    }
+    slots[column] = i;
+  }
+  bool all_columns = columns.empty();
+  if (!all_columns) {
+    table->cols = columns.size();
+  }
+  std::ostringstream error;
+  const char* p = file.begin();
+  const char* end = file.end();
+  int line = -1;
+  while (p != nullptr && p < end) {
+    line++;
+    auto* newline = static_cast<const char*>(std::memchr(p, '\n', end - p));
+    const char* line_end = newline != nullptr ? newline : end;
+    const char* next = newline != nullptr ? newline + 1 : end;
+    if (line_end > p && line_end[-1] == '\r') {
+      line_end--;
+    }
+    if (line <= options.header_row || line_end == p) {
+      p = next;
+      continue;
+    }
+
+    // The cells of a row that are not read, or not found, keep the default
+    size_t row_begin = table->values.size();
+    if (!all_columns) {
+      table->values.resize(row_begin + table->cols,
+                           csv_parser_detail::DefaultValue<T>());
+    }
+    size_t found = 0;
+    size_t col = 0;
+    const char* field = p;
+    while (true) {
+      const char* cell_begin = field;
+      const char* cell_end;
+      const char* separator;
+      if (field < line_end && *field == '"') {
+        cell_begin = field + 1;
+        cell_end = static_cast<const char*>(
+            std::memchr(cell_begin, '"', line_end - cell_begin));
+        if (cell_end == nullptr) {
+          cell_end = line_end;
+        }
+        separator = static_cast<const char*>(
+            std::memchr(cell_end, ',', line_end - cell_end));
+      } else {
+        separator = static_cast<const char*>(
+            std::memchr(field, ',', line_end - field));
+        cell_end = separator != nullptr ? separator : line_end;
+      }
+
+      if (all_columns || slots[col] >= 0) {
+        T value;
+        if (!ParseValue(cell_begin, cell_end, options.validate, &value)) {
+          table->invalid++;
+          if (options.validate) {
+            error << path << ": line " << line + 1 << ", column " << col + 1
+                  << " is not a number: '"
+                  << std::string(cell_begin, cell_end) << "'";
+            return error.str();
+          }
+        }
+        if (all_columns) {
+          table->values.push_back(value);
+        } else {
+          table->values[row_begin + slots[col]] = value;
+          found++;
+        }
+      }
+      col++;
+      if (separator == nullptr || (!all_columns && col >= slots.size())) {
+        break;
+      }
+      field = separator + 1;
+    }
+
+    if (all_columns && table->rows == 0) {
+      table->cols = col;
+    }
+    if (!all_columns && found != table->cols) {
+      if (options.validate) {
+        for (auto column : columns) {
+          if (static_cast<size_t>(column) >= col) {
+            error << path << ": line " << line + 1 << " has no column "
+                  << column + 1;
+            return error.str();
+          }
+        }
+      }
+      table->invalid += table->cols - found;
+    } else if (all_columns && col != table->cols) {
+      if (options.validate) {
+        error << path << ": line " << line + 1 << " has " << col
+              << " values instead of " << table->cols;
+        return error.str();
+      }
+      // Pads or cuts the row to the length of the first row
+      table->values.resize(table->rows * table->cols + col);
+      table->values.resize((table->rows + 1) * table->cols,
+                           csv_parser_detail::DefaultValue<T>());
+      table->invalid += table->cols > col ? table->cols - col : 0;
+    }
+    table->rows++;
+    p = next;
+  }
+  return "";
+}
+
+}  // namespace bdm
+
+#endif  // CSV_PARSER_H_
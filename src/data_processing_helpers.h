@@ -1,6 +1,22 @@
+#ifndef DATA_PROCESSING_HELPERS_H_
+#define DATA_PROCESSING_HELPERS_H_
+
+#include "calibration.h"
 #include "person.h"
 #include "csv_helper.h"
+#include "evaluate.h"
+#include "experiment_store.h"
+#include "export_queue.h"
+#include "input_bundle.h"
+#include "municipality_series.h"
+#include "repetition_aggregator.h"
 #include "sim_param.h"
+#include "surrogate.h"
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <stdexcept>
 
 #include <json.hpp>
 
@@ -9,9 +25,9 @@ using bdm::experimental::TimeSeries;
 using nlohmann::json;
 
 inline void ImportObservedData(TimeSeries* observed) {
-  auto file = GetDataDir() + "/observed_hospital_doubling.csv";
-  std::vector<real_t> observed_vec;
-  CsvToVector(file, &observed_vec);
+  auto observed_data =
+      InputBundle::Get().GetArray<real_t>("observed_hospital_doubling.csv");
+  std::vector<real_t> observed_vec(observed_data.begin(), observed_data.end());
   observed->Add("observed_hospitalization", {}, observed_vec);
 }
 
@@ -19,17 +35,18 @@ inline void ImportObservedData(TimeSeries* observed) {
 // between 13 and 27 March, to correspond with the observed data interval. There
 // are 384 hours between 28 Feb 2020 and 14 March 2020 There are 696 hours
 // between 27 Feb 2020 and 27 March 2020. We add an additional 24 hours to
-// get the hospitalized results at the end of each day
+// get the hospitalized results at the end of each day (see SelectDailySamples)
 inline real_t ComputeError(TimeSeries observed, TimeSeries simulated) {
-  auto simulated_vec = simulated.GetYValues("ts_hospitalized");
-
-  std::vector<real_t> simulated_doubling_hospitalization;
-  for (size_t t = 0; t < simulated_vec.size(); t++) {
-    if (t % kHoursPerDay == 0 && t >= 384 && t <= 720) {
-      simulated_doubling_hospitalization.push_back(simulated_vec[t]);
-    }
+  if (simulated.Contains("aborted_mse")) {
+    // The run was aborted once its error exceeded the abort threshold, so we
+    // only know a lower bound of the error
+    return simulated.GetYValues("aborted_mse")[0];
   }
 
+  auto simulated_doubling_hospitalization =
+      SelectDailySamples(simulated.GetXValues("ts_hospitalized"),
+                         simulated.GetYValues("ts_hospitalized"));
+
   real_t err = std::numeric_limits<real_t>::infinity();
   auto observed_vec = observed.GetYValues("observed_hospitalization");
   if (observed_vec.size() != simulated_doubling_hospitalization.size()) {
@@ -57,34 +74,259 @@ inline real_t ComputeError(TimeSeries observed, TimeSeries simulated) {
   return err;
 }
 
-inline void ExportResults(const std::vector<TimeSeries>& results,
-                          const TimeSeries& mean, const Param& param,
-                          real_t err,
-                          const std::string& experiments_output_dir) {
+// Appends the series `names` of `ts` that it contains to `series`, with
+// `prefix` before their names
+inline void AddStoredSeries(const TimeSeries& ts,
+                            const std::vector<std::string>& names,
+                            const std::string& prefix,
+                            std::vector<StoredSeries>* series) {
+  for (const auto& name : names) {
+    if (!ts.Contains(name)) {
+      continue;
+    }
+    StoredSeries s;
+    s.name = prefix + name;
+    const auto& x = ts.GetXValues(name);
+    const auto& y = ts.GetYValues(name);
+    const auto& low = ts.GetYErrorLow(name);
+    const auto& high = ts.GetYErrorHigh(name);
+    s.x.assign(x.begin(), x.end());
+    s.y.assign(y.begin(), y.end());
+    s.y_error_low.assign(low.begin(), low.end());
+    s.y_error_high.assign(high.begin(), high.end());
+    series->push_back(std::move(s));
+  }
+}
+
+// The results of one experiment, as handed to the ExportQueue. The parameters
+// are serialized by the simulating thread (see ExportResults), because the
+// ROOT I/O behind Param::ToJsonString must not run concurrently with the
+// next simulation.
+struct ExperimentResults {
+  std::string uuid;
+  std::string output_dir;
+  // The parameters as JSON (see Param::ToJsonString)
+  std::string param;
+  // See SimParam::experiment_directories
+  bool experiment_directories = false;
+  real_t err = 0;
+  // A run was aborted, such that `err` is only a lower bound, or skipped
+  // before the agent run (see SimParam::abort_best_mse_factor,
+  // analytical_prescreen_factor and surrogate_file)
+  bool aborted = false;
+  bool skipped = false;
+  real_t repetitions = 0;
+  real_t resolution = 0;
+  // The metric of the repetitions and the 95% confidence interval of its
+  // mean, if tracked (see NeedsMoreRepetitions)
+  std::string metric;
+  real_t metric_mean = 0;
+  real_t metric_half_width = 0;
+  // The municipality series of the repetitions (see MunicipalitySeriesFile)
+  std::vector<std::string> municipality_series;
+  // The aggregate of the repetitions and the names of its series (see
+  // RepetitionAggregator::GetSummary)
+  TimeSeries mean;
+  std::vector<std::string> series_names;
+  // The full results of the repetitions, if SimParam::keep_repetitions
+  std::vector<TimeSeries> kept_repetitions;
+  std::shared_ptr<TimeSeries> analytical;
+};
+
+// Writes the results of one experiment to the ExperimentStore of its study.
+// Throws if they could not be written.
+inline void WriteResults(const ExperimentResults& results) {
+  const auto& dir = results.output_dir;
+  const auto& uuid = results.uuid;
+
+  // Add additional parameters of interests to parameter file
+  auto j_param = json::parse(results.param);
+  j_param["mse"] = results.err;
+  j_param["aborted"] = results.aborted;
+  j_param["skipped"] = results.skipped;
+  j_param["repetitions"] = results.repetitions;
+  j_param["resolution"] = results.resolution;
+  if (!results.metric.empty()) {
+    j_param["repetition_metric"] = results.metric;
+    j_param["repetition_metric_mean"] = results.metric_mean;
+    j_param["repetition_metric_ci"] = {
+        results.metric_mean - results.metric_half_width,
+        results.metric_mean + results.metric_half_width};
+  }
+
+  // Move the per-municipality statistics of the repetitions next to the store
+  // (see MunicipalitySeriesWriter). Runs that stopped before they forked share
+  // the file of the run.
+  std::map<std::string, std::string> series_files;
+  for (const auto& from : results.municipality_series) {
+    auto& to = series_files[from];
+    if (to.empty()) {
+      auto extension = from.substr(from.find('.', from.rfind('/')));
+      to = Concat(uuid, "_municipalities_", series_files.size() - 1,
+                  extension);
+      if (rename(from.c_str(), Concat(dir, "/", to).c_str()) != 0) {
+        Log::Warning("Simulation::ExportResults", "Could not move ", from,
+                     " to ", dir);
+        to = from;
+      }
+    }
+    j_param["municipality_series"].push_back(to);
+  }
+
+  std::vector<StoredSeries> series;
+  AddStoredSeries(results.mean, results.series_names, "", &series);
+  auto names = ResultSeriesNames();
+  if (results.analytical != nullptr) {
+    AddStoredSeries(*results.analytical, names, "analytical_", &series);
+  }
+  for (size_t r = 0; r < results.kept_repetitions.size(); r++) {
+    AddStoredSeries(results.kept_repetitions[r], names,
+                    Concat("repetition_", r, "_"), &series);
+  }
+  ExperimentStore store(ExperimentStoreFile(dir));
+  if (!store.Append(uuid, j_param.dump(), results.err, series)) {
+    throw std::runtime_error(Concat("Failed to append to ", store.GetPath()));
+  }
+
+  if (results.experiment_directories) {
+    std::string experiment_output_dir = Concat(dir, "/", uuid);
+    if (system(Concat("mkdir -p ", experiment_output_dir).c_str())) {
+      throw std::runtime_error(
+          Concat("Failed to make output directory ", experiment_output_dir));
+    }
+
+    // Save all collectors to file
+    results.mean.SaveCsv(experiment_output_dir);
+    if (results.analytical != nullptr) {
+      auto analytical_dir = Concat(experiment_output_dir, "/analytical");
+      if (system(Concat("mkdir -p ", analytical_dir).c_str())) {
+        throw std::runtime_error(
+            Concat("Failed to make output directory ", analytical_dir));
+      }
+      results.analytical->SaveCsv(analytical_dir);
+    }
+
+    std::ofstream param_file;
+    param_file.open(Concat(experiment_output_dir, "/param.json"));
+    param_file << j_param.dump(4);
+    param_file .close();
+  }
+}
+
+// The peak of the hospitalized persons of a run
+inline real_t PeakHospitalized(const TimeSeries& result) {
+  const auto& y = result.GetYValues("ts_hospitalized");
+  return y.empty() ? 0 : *std::max_element(y.begin(), y.end());
+}
+
+// The aggregator of the repetitions of an experiment (see
+// SimParam::repetition_quantile and SimParam::keep_repetitions). If the number
+// of repetitions is adaptive, it also tracks SimParam::repetition_ci_metric,
+// where "mse" requires the observed data.
+inline RepetitionAggregator MakeRepetitionAggregator(
+    const SimParam* sparam, const TimeSeries* observed = nullptr) {
+  RepetitionAggregator aggregate(ResultSeriesNames(),
+                                 GetRepetitionQuantiles(sparam),
+                                 sparam->keep_repetitions);
+  if (sparam->repetition_ci_target <= 0) {
+    return aggregate;
+  }
+  const auto& metric = sparam->repetition_ci_metric;
+  if (metric == "peak_hospitalized") {
+    aggregate.SetMetric(metric, PeakHospitalized);
+  } else if (metric == "mse") {
+    if (observed != nullptr) {
+      auto data = *observed;
+      aggregate.SetMetric(metric, [data](const TimeSeries& result) {
+        return ComputeError(data, result);
+      });
+    }
+  } else {
+    Log::Fatal("MakeRepetitionAggregator", "Unknown repetition_ci_metric ",
+               metric, " (use mse or peak_hospitalized)");
+  }
+  return aggregate;
+}
+
+// Exports the aggregate of the repetitions and the parameters of one
+// experiment, and the analytical solution of its parameters if given (see
+// SolveAnalytical), to the ExperimentStore of the study. The analytical
+// series are stored with the prefix "analytical_", the kept repetitions with
+// "repetition_<r>_". The results are written in the background while the next
+// experiment is simulated (see ExportQueue and FlushResults).
+inline void ExportResults(const RepetitionAggregator& aggregate,
+                          const Param& param, real_t err,
+                          const std::string& experiments_output_dir,
+                          const TimeSeries* analytical = nullptr) {
+  const auto* sparam = param.Get<SimParam>();
+  const auto& metadata = aggregate.GetMetadata();
   // Create UUID for the experiment
   TUUID tu;
-  std::string uuid = std::string(tu.AsString());
+  auto exported = std::make_shared<ExperimentResults>();
+  exported->uuid = std::string(tu.AsString());
+  exported->output_dir = experiments_output_dir;
+  exported->param = param.ToJsonString();
+  exported->experiment_directories = sparam->experiment_directories;
+  exported->err = err;
+  exported->skipped = metadata.Contains("analytical_mse") ||
+                      metadata.Contains("surrogate_mse");
+  exported->aborted = !exported->skipped && aggregate.IsAborted();
+  exported->repetitions = aggregate.GetNumRepetitions();
+  exported->resolution = metadata.GetYValues("resolution")[0];
+  if (!aggregate.GetMetricName().empty()) {
+    const auto& metric = aggregate.GetMetric();
+    exported->metric = aggregate.GetMetricName();
+    exported->metric_mean = metric.mean;
+    exported->metric_half_width = metric.GetHalfWidth();
+  }
+  for (const auto& run : aggregate.GetMunicipalitySeries()) {
+    exported->municipality_series.push_back(MunicipalitySeriesFile(
+        sparam->municipality_series_dir, static_cast<int>(run.first),
+        static_cast<uint64_t>(run.second),
+        sparam->compress_municipality_series));
+  }
+  exported->mean = aggregate.GetSummary();
+  exported->series_names = aggregate.GetSeriesNames();
+  exported->kept_repetitions = aggregate.GetRepetitions();
+  if (analytical != nullptr) {
+    exported->analytical = std::make_shared<TimeSeries>(*analytical);
+  }
 
-  std::string experiment_output_dir = Concat(experiments_output_dir, "/", uuid);
-  if (system(Concat("mkdir -p ", experiment_output_dir).c_str())) {
-    Log::Fatal("Simulation::ExportResults", "Failed to make output directory ",
-               experiment_output_dir);
-  } else {
-    Log::Info("Simulation::ExportResults", "Created output directory ",
-              experiment_output_dir);
+  auto* queue = GetExportQueue();
+  queue->SetCapacity(sparam->export_queue_capacity);
+  auto error = queue->Push([exported]() { WriteResults(*exported); });
+  if (!error.empty()) {
+    Log::Fatal("Simulation::ExportResults", error);
   }
 
-  // Save all collectors to file
-  mean.SaveCsv(experiment_output_dir);
+  // Train the surrogate on the completed runs (see SimParam::surrogate_file).
+  // The surrogate is also used by the simulations, so not in the background.
+  auto* surrogate = IsCalibrationRun(sparam) ? GetSurrogate(&param) : nullptr;
+  if (surrogate != nullptr && !exported->aborted && !exported->skipped) {
+    auto j_param = json::parse(exported->param);
+    surrogate->AddSample(surrogate->Features(j_param), err, exported->uuid);
+  }
+}
 
-  // Add additional parameters of interests to parameter file
-  auto j_param = json::parse(param.ToJsonString());
-  j_param["mse"] = err;
-  j_param["repetitions"] = results[0].GetYValues("repetitions")[0];
-  j_param["resolution"] = results[0].GetYValues("resolution")[0];
-
-  std::ofstream param_file;
-  param_file.open(Concat(experiment_output_dir, "/param.json"));
-  param_file << j_param.dump(4);
-  param_file .close();
+// Exports the results of the Experiment of the MultiSimulation, which hands
+// over all repetitions at once. They are aggregated like those of a
+// StreamingExperiment, such that both store the same series.
+inline void ExportResults(const std::vector<TimeSeries>& results,
+                          const Param& param, real_t err,
+                          const std::string& experiments_output_dir) {
+  auto aggregate = MakeRepetitionAggregator(param.Get<SimParam>());
+  for (const auto& result : results) {
+    aggregate.Add(result);
+  }
+  ExportResults(aggregate, param, err, experiments_output_dir);
+}
+
+// Waits until the results of all experiments are written (see ExportResults)
+inline void FlushResults() {
+  auto error = GetExportQueue()->Flush();
+  if (!error.empty()) {
+    Log::Fatal("Simulation::ExportResults", error);
+  }
 }
+
+#endif  // DATA_PROCESSING_HELPERS_H_
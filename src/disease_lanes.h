@@ -0,0 +1,156 @@
+#ifndef DISEASE_LANES_H_
+#define DISEASE_LANES_H_
+
+#include <stdint.h>
+#include <cmath>
+#include <vector>
+
+#include "biodynamo.h"
+
+#include "model_facts.h"
+#include "person.h"
+#include "random_draws.h"
+#include "sim_param.h"
+
+namespace bdm {
+
+// The disease courses of the repetitions 1, ..., K - 1 of an ensemble (see
+// SimParam::ensemble_lanes); repetition 0 is the course of the Person and its
+// InfectionBehavior. The repetitions share the demography, the travel schedule
+// and the situations of the person, and only differ in the disease course.
+// The fields are stored one after the other in `Person::lanes_` (a structure
+// of arrays), such that the loops over the lanes of one field vectorize.
+class DiseaseLanes {
+ public:
+  enum Field : uint8_t {
+    kState,
+    kFlags,
+    kIncubationTime,
+    kIncubationThreshold,
+    kInfectionTime,
+    kInfectionThreshold,
+    kHospitalizationTime,
+    kHospitalizationThreshold,
+    kTimeInHospital,
+    kLengthOfStay,
+    kNumFields
+  };
+  enum Flag : uint32_t { kHospitalize = 1, kHospitalized = 2 };
+
+  explicit DiseaseLanes(Person* person)
+      : data_(person->lanes_.data()),
+        num_lanes_(person->lanes_.size() / kNumFields) {}
+
+  uint32_t GetNumLanes() const { return num_lanes_; }
+
+  uint32_t* operator[](Field field) { return data_ + field * num_lanes_; }
+
+  // Gives `person` `num_lanes` lanes with the thresholds and the
+  // hospitalization decisions drawn from the same distributions as in
+  // InfectionBehavior::DrawFromDistributions
+  static void Initialize(Person* person, uint32_t num_lanes,
+                         const SimParam* sparam, Random* random) {
+    person->lanes_.assign(kNumFields * num_lanes, 0);
+    DiseaseLanes lanes(person);
+    auto* flags = lanes[kFlags];
+    auto* incubation = lanes[kIncubationThreshold];
+    auto* infection = lanes[kInfectionThreshold];
+    auto* hospitalization = lanes[kHospitalizationThreshold];
+    auto* length_of_stay = lanes[kLengthOfStay];
+    auto hospitalize = kHospitalizationPerDemography[person->demography_];
+    for (uint32_t l = 0; l < num_lanes; l++) {
+      incubation[l] = DrawWeibull(sparam->incubation_shape_param,
+                                  sparam->incubation_scale_param, random);
+      infection[l] = DrawWeibull(sparam->infection_shape_param,
+                                 sparam->infection_scale_param, random);
+      hospitalization[l] =
+          DrawWeibull(sparam->hospitalization_shape_param,
+                      sparam->hospitalization_scale_param, random);
+      length_of_stay[l] =
+          kHoursPerDay * DrawLogNormal(sparam->hospital_average_mean,
+                                       sparam->hospital_average_sigma, random);
+      flags[l] = random->Uniform(0, 1) <= hospitalize ? kHospitalize : 0;
+    }
+  }
+
+  // Sets the susceptible lanes of `person` to `state`, with the time spent in
+  // that state drawn as in InfectionBehavior::DrawFromDistributions (see
+  // InitialInfectionOp)
+  static void Seed(Person* person, State state, Random* random) {
+    DiseaseLanes lanes(person);
+    auto* states = lanes[kState];
+    for (uint32_t l = 0; l < lanes.GetNumLanes(); l++) {
+      if (states[l] != kSusceptible) {
+        continue;
+      }
+      states[l] = state;
+      if (state == kExposed) {
+        lanes[kIncubationTime][l] =
+            random->Uniform(0, lanes[kIncubationThreshold][l]);
+      } else if (state == kInfectious) {
+        lanes[kInfectionTime][l] =
+            random->Uniform(0, lanes[kInfectionThreshold][l]);
+      }
+    }
+  }
+
+  // Advances all lanes that are not susceptible by one hour, with the same
+  // rules as InfectionBehavior::ProgressDisease, written without branches
+  void Progress() {
+    auto* states = (*this)[kState];
+    auto* flags = (*this)[kFlags];
+    auto* incubation = (*this)[kIncubationTime];
+    auto* incubation_threshold = (*this)[kIncubationThreshold];
+    auto* infection = (*this)[kInfectionTime];
+    auto* infection_threshold = (*this)[kInfectionThreshold];
+    auto* hospitalization = (*this)[kHospitalizationTime];
+    auto* hospitalization_threshold = (*this)[kHospitalizationThreshold];
+    auto* in_hospital = (*this)[kTimeInHospital];
+    auto* length_of_stay = (*this)[kLengthOfStay];
+    for (uint32_t l = 0; l < num_lanes_; l++) {
+      auto state = states[l];
+      uint32_t exposed = state == kExposed;
+      uint32_t infectious = state == kInfectious;
+      uint32_t recovered = state == kRecovered;
+      uint32_t incubated = exposed & (incubation[l] > incubation_threshold[l]);
+      uint32_t cured = infectious & (infection[l] > infection_threshold[l]);
+      incubation[l] += exposed & ~incubated;
+      infection[l] += infectious & ~cured;
+      // The hospitalization time lag continues after the recovery
+      uint32_t lag = (infectious & ~cured & 1) | recovered;
+      hospitalization[l] += lag;
+      uint32_t admitted =
+          lag & (hospitalization[l] > hospitalization_threshold[l]) &
+          flags[l] & kHospitalize;
+      uint32_t hospitalized = ((flags[l] >> 1) & 1) | admitted;
+      // Only recovered persons are discharged
+      uint32_t stay = recovered & hospitalized;
+      uint32_t discharged = stay & (in_hospital[l] > length_of_stay[l]);
+      in_hospital[l] += stay & ~discharged & 1;
+      hospitalized &= ~discharged & 1;
+      flags[l] = (flags[l] & kHospitalize) | (hospitalized << 1);
+      states[l] = incubated ? kInfectious : (cured ? kRecovered : state);
+    }
+  }
+
+ private:
+  uint32_t* data_;
+  uint32_t num_lanes_;
+};
+
+// Gives all persons `num_lanes` additional disease courses (see DiseaseLanes)
+inline void InitializeDiseaseLanes(uint32_t num_lanes) {
+  auto* sim = Simulation::GetActive();
+  const auto* sparam = sim->GetParam()->Get<SimParam>();
+  auto* rm = sim->GetResourceManager();
+  auto initialize = L2F([&](Agent* agent) {
+    auto* random = Simulation::GetActive()->GetRandom();
+    DiseaseLanes::Initialize(bdm_static_cast<Person*>(agent), num_lanes,
+                             sparam, random);
+  });
+  rm->ForEachAgentParallel(initialize);
+}
+
+}  // namespace bdm
+
+#endif  // DISEASE_LANES_H_
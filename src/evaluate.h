@@ -2,11 +2,15 @@
 #define EVALUATE_H_
 
 #include <cmath>
+#include <limits>
+#include <string>
+#include <utility>
 #include <vector>
 
 #include "biodynamo.h"
 #include "person.h"
 
+#include "calibration.h"
 #include "model_facts.h"
 #include "operations/update_statistics_op.h"
 #include "sim_param.h"
@@ -15,92 +19,166 @@ using namespace bdm::experimental;
 
 namespace bdm {
 
+// The collectors read the state counts of the "update statistics" operation
+// instead of iterating over all agents themselves. These are numbers of agents,
+// so we need to multiple by a scaling factor to get back the number of people
+// for our final results
+// The x-value of all collectors: the last hour of the current timestep
+inline real_t CollectHour(Simulation* sim) {
+  return GetSimulatedHours() + GetStepHours() - 1;
+}
+
+inline real_t CollectExposed(Simulation* sim) {
+  return GetStatistics(sim)->counts_.exposed * GetAgentToPersonRatio();
+}
+
+inline real_t CollectInfectious(Simulation* sim) {
+  return GetStatistics(sim)->counts_.infectious * GetAgentToPersonRatio();
+}
+
+inline real_t CollectHospitalized(Simulation* sim) {
+  return GetStatistics(sim)->counts_.hospitalized * GetAgentToPersonRatio();
+}
+
+// Hospitalized people with home location `kMunicipality`
+template <uint16_t kMunicipality>
+inline real_t CollectHospitalizedIn(Simulation* sim) {
+  return GetStatistics(sim)->counts_.hospitalized_home[kMunicipality] *
+         GetAgentToPersonRatio();
+}
+
+// The fraction of demography `kDemography` that is (or was) infected
+template <Demographic kDemography>
+inline real_t CollectAffected(Simulation* sim) {
+  auto* stats = GetStatistics(sim);
+  uint64_t population_per_demography = 0;
+  for (size_t m = 0; m < stats->total_.size(); m++) {
+    population_per_demography += stats->total_[m][kDemography];
+  }
+  return static_cast<real_t>(stats->counts_.affected[kDemography]) /
+         population_per_demography;
+}
+
 inline void SetupResultCollection(Simulation* sim) {
   auto* ts = sim->GetTimeSeries();
-  // auto susceptible = [](Agent* a) {
-  //   return bdm_static_cast<Person*>(a)->state_ == State::kSusceptible;
-  // };
-  auto exposed = [](Agent* a) {
-    return bdm_static_cast<Person*>(a)->state_ == State::kExposed;
-  };
-  auto infectious = [](Agent* a) {
-    return bdm_static_cast<Person*>(a)->state_ == State::kInfectious;
-  };
-  auto hospitalized = [](Agent* a) {
-    return bdm_static_cast<Person*>(a)->hospitalized_;
-  };
+  auto* sparam = sim->GetParam()->Get<SimParam>();
 
-  // Eindhoven = 93, Groningen = 118, Den Haag = 117
-  auto hospitalized_eindhoven = [](Agent* a) {
-    auto *p = bdm_static_cast<Person*>(a);
-    return p->hospitalized_ && p->home_location_ == 93;
-  };
-  auto hospitalized_groningen = [](Agent* a) {
-    auto *p = bdm_static_cast<Person*>(a);
-    return p->hospitalized_ && p->home_location_ == 118;
-  };
-  auto hospitalized_denhaag = [](Agent* a) {
-    auto *p = bdm_static_cast<Person*>(a);
-    return p->hospitalized_ && p->home_location_ == 117;
-  };
-
-  // We count the number of agents here, so we need to multiple by a scaling
-  // factor to get back the number of people for our final results
-  auto agent_to_person_scaling = [](real_t total_agent_count) {
-    auto scaling = GetAgentToPersonRatio();
-    return total_agent_count * scaling;
-  };
-
-  bool export_affected = sim->GetParam()->Get<SimParam>()->export_affected;
+  // Calibration runs only need the hospitalizations (see ComputeError)
+  if (GetRunHorizon(sparam) != std::numeric_limits<uint64_t>::max()) {
+    ts->AddCollector("ts_hospitalized", CollectHospitalized, CollectHour);
+    return;
+  }
+
+  bool export_affected = sparam->export_affected;
   if (export_affected) {
+    const std::array<real_t (*)(Simulation*), kNumDemographies>
+        affected_collectors = {
+            CollectAffected<kPreSchoolChildren>,
+            CollectAffected<kPrimarySchoolChildren>,
+            CollectAffected<kSecondarySchoolChildren>,
+            CollectAffected<kStudents>,
+            CollectAffected<kNonStudyingAdolescents>,
+            CollectAffected<kMiddleAgeWorking>,
+            CollectAffected<kMiddleAgeUnemployed>,
+            CollectAffected<kHigherAgeWorking>,
+            CollectAffected<kHigherAgeUnemployed>,
+            CollectAffected<kElderly>,
+            CollectAffected<kEldest>};
     for (int i = kPreSchoolChildren; i != kEldest + 1; i++) {
-      auto collector_demo = L2F([=](Agent* a) {
-        auto* person = bdm_static_cast<Person*>(a);
-        std::array<State, 3> affected = {kExposed, kInfectious, kRecovered};
-        auto* is_affected =
-            std::find(std::begin(affected), std::end(affected), person->state_);
-        return (person->demography_ == static_cast<Demographic>(i)) &&
-              (is_affected != affected.end());
-      });
-
-      auto post_process = L2F([=](real_t total_affected) {
-        auto stats = Simulation::GetActive()
-                        ->GetScheduler()
-                        ->GetOps("update statistics")[0]
-                        ->GetImplementation<UpdateStatisticsOp>();
-        uint64_t population_per_demography = 0;
-        for (size_t m = 0; m < stats->total_.size(); m++) {
-          population_per_demography += stats->total_[m][i];
-        }
-        return static_cast<real_t>(total_affected) / population_per_demography;
-      });
-
-      ts->AddCollector(
-          Concat("ts_affected_", DemographicToString[i]),
-          new CounterT<decltype(collector_demo), decltype(post_process), real_t>(
-              collector_demo, post_process));
+      ts->AddCollector(Concat("ts_affected_", DemographicToString[i]),
+                       affected_collectors[i], CollectHour);
     }
   }
 
-  // auto recovered = [](Agent* a) {
-  //   return bdm_static_cast<Person*>(a)->state_ == State::kRecovered;
-  // };
-  // ts->AddCollector("susceptible", new Counter<real_t>(susceptible));
-  ts->AddCollector("ts_exposed",
-                   new Counter<real_t>(exposed, agent_to_person_scaling));
-  ts->AddCollector("ts_infectious",
-                   new Counter<real_t>(infectious, agent_to_person_scaling));
-  ts->AddCollector("ts_hospitalized",
-                   new Counter<real_t>(hospitalized, agent_to_person_scaling));
-  ts->AddCollector("ts_hospitalized_eindhoven",
-                   new Counter<real_t>(hospitalized_eindhoven, agent_to_person_scaling));
-  ts->AddCollector("ts_hospitalized_groningen",
-                   new Counter<real_t>(hospitalized_groningen, agent_to_person_scaling));
-  ts->AddCollector("ts_hospitalized_denhaag",
-                   new Counter<real_t>(hospitalized_denhaag, agent_to_person_scaling));
-  // ts->AddCollector("recovered", new Counter<real_t>(recovered));
+  ts->AddCollector("ts_exposed", CollectExposed, CollectHour);
+  ts->AddCollector("ts_infectious", CollectInfectious, CollectHour);
+  ts->AddCollector("ts_hospitalized", CollectHospitalized, CollectHour);
+  // Eindhoven = 93, Groningen = 118, Den Haag = 117
+  ts->AddCollector("ts_hospitalized_eindhoven", CollectHospitalizedIn<93>,
+                   CollectHour);
+  ts->AddCollector("ts_hospitalized_groningen", CollectHospitalizedIn<118>,
+                   CollectHour);
+  ts->AddCollector("ts_hospitalized_denhaag", CollectHospitalizedIn<117>,
+                   CollectHour);
+}
+
+// The names of all time series of the results of Simulate that hold
+// simulated values (see SetupResultCollection), as opposed to metadata
+inline std::vector<std::string> ResultSeriesNames() {
+  std::vector<std::string> names = {"ts_exposed",
+                                    "ts_infectious",
+                                    "ts_hospitalized",
+                                    "ts_hospitalized_eindhoven",
+                                    "ts_hospitalized_groningen",
+                                    "ts_hospitalized_denhaag",
+                                    "ts_avg_person_interactions_over_time"};
+  for (const auto& demography : DemographicToString) {
+    names.push_back(Concat("ts_affected_", demography));
+  }
+  return names;
+}
+
+// The results of the additional repetitions of an ensemble (see
+// DiseaseLanes), in the format of the collectors. The metadata ("resolution"
+// and "repetitions") is copied from `result`, the result of the first
+// repetition.
+inline std::vector<TimeSeries> GetLaneResults(const UpdateStatisticsOp* stats,
+                                              const TimeSeries& result) {
+  auto ratio = GetAgentToPersonRatio();
+  std::vector<TimeSeries> results(stats->lane_counts_.size());
+  for (size_t l = 0; l < results.size(); l++) {
+    std::array<std::vector<real_t>, 3> y;
+    for (const auto& counts : stats->lane_counts_[l]) {
+      for (size_t i = 0; i < 3; i++) {
+        y[i].push_back(counts[i] * ratio);
+      }
+    }
+    results[l].Add("ts_exposed", stats->lane_hours_, y[0]);
+    results[l].Add("ts_infectious", stats->lane_hours_, y[1]);
+    results[l].Add("ts_hospitalized", stats->lane_hours_, y[2]);
+    for (const auto* metadata : {"resolution", "repetitions"}) {
+      results[l].Add(metadata, result.GetXValues(metadata),
+                     result.GetYValues(metadata));
+    }
+  }
+  return results;
 }
 
+// Keeps the results of the additional repetitions of the last ensemble, which
+// the next calls of Simulate with the same parameters return instead of
+// simulating again (see SimParam::ensemble_lanes)
+class EnsembleResults {
+ public:
+  static EnsembleResults* GetInstance() {
+    static EnsembleResults kResults;
+    return &kResults;
+  }
+
+  // Replaces the stored results by `results` of the parameters `key` (see
+  // Param::ToJsonString)
+  void Store(const std::string& key, std::vector<TimeSeries>&& results) {
+    key_ = key;
+    results_ = std::move(results);
+  }
+
+  // Moves one of the stored results of the parameters `key` to `result`.
+  // Returns false if there is none left.
+  bool Take(const std::string& key, TimeSeries* result) {
+    if (key != key_ || results_.empty()) {
+      return false;
+    }
+    *result = std::move(results_.back());
+    results_.pop_back();
+    return true;
+  }
+
+ private:
+  EnsembleResults() {}
+
+  std::string key_;
+  std::vector<TimeSeries> results_;
+};
+
 }  // namespace bdm
 
 #endif  // EVALUATE_H_
@@ -0,0 +1,286 @@
+#ifndef EXPERIMENT_STORE_H_
+#define EXPERIMENT_STORE_H_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cmath>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace bdm {
+
+// One time series of an experiment, as columns of equal length. The error
+// columns are empty if the series has no error bars.
+struct StoredSeries {
+  std::string name;
+  std::vector<double> x;
+  std::vector<double> y;
+  std::vector<double> y_error_low;
+  std::vector<double> y_error_high;
+};
+
+// An experiment as read back from an ExperimentStore
+struct StoredExperiment {
+  std::string uuid;
+  double time = 0;
+  double mse = 0;
+  // The parameters and metadata of the experiment, as JSON
+  std::string param;
+  std::vector<StoredSeries> series;
+};
+
+// The results of all experiments of a study in one append-only file, instead
+// of a directory per experiment. Each experiment is a block of its parameters
+// (as JSON) and its time series, stored column by column. A second file, the
+// index, has a fixed-width entry per block with its position, error and
+// UUID, such that readers can select experiments without parsing the blocks.
+// Appends are serialized with an fcntl lock on the store, also between
+// processes (e.g. the ranks of a calibration), and a block is only listed in
+// the index once it is complete. All numbers are stored in the byte order of
+// the machine that wrote them, and the blocks are aligned to 8 bytes.
+//
+// Block:  uint64 size, char param[size], padding,
+//         uint64 num_series, then per series:
+//           uint64 size, char name[size], padding,
+//           uint64 length, uint64 num_columns (2 or 4),
+//           double column[num_columns][length] (x, y, y_error_low,
+//           y_error_high)
+class ExperimentStore {
+ public:
+  static constexpr uint32_t kVersion = 1;
+
+  struct IndexEntry {
+    uint64_t offset;
+    uint64_t size;
+    double mse;
+    // Seconds since the epoch
+    double time;
+    char uuid[40];
+  };
+
+  struct FileHeader {
+    char magic[8];
+    uint32_t version = kVersion;
+    uint32_t entry_size = sizeof(IndexEntry);
+  };
+
+  explicit ExperimentStore(const std::string& path) : path_(path) {}
+
+  const std::string& GetPath() const { return path_; }
+  std::string GetIndexPath() const { return path_ + ".idx"; }
+
+  // Appends an experiment. Returns false if the store could not be written.
+  bool Append(const std::string& uuid, const std::string& param, double mse,
+              const std::vector<StoredSeries>& series) const {
+    std::vector<char> block;
+    AppendString(param, &block);
+    AppendValue<uint64_t>(series.size(), &block);
+    for (const auto& s : series) {
+      AppendString(s.name, &block);
+      bool errors = s.y_error_low.size() == s.x.size() &&
+                    s.y_error_high.size() == s.x.size();
+      AppendValue<uint64_t>(s.x.size(), &block);
+      AppendValue<uint64_t>(errors ? 4 : 2, &block);
+      AppendColumn(s.x, s.x.size(), &block);
+      AppendColumn(s.y, s.x.size(), &block);
+      if (errors) {
+        AppendColumn(s.y_error_low, s.x.size(), &block);
+        AppendColumn(s.y_error_high, s.x.size(), &block);
+      }
+    }
+
+    int fd = open(path_.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) {
+      return false;
+    }
+    struct flock lock = {};
+    lock.l_type = F_WRLCK;
+    lock.l_whence = SEEK_SET;
+    int locked;
+    while ((locked = fcntl(fd, F_SETLKW, &lock)) != 0 && errno == EINTR) {
+    }
+    bool written = locked == 0 && WriteHeader(fd, "CBSSTORE");
+    struct stat st = {};
+    written = written && fstat(fd, &st) == 0 &&
+              WriteAll(fd, block.data(), block.size());
+
+    IndexEntry entry = {};
+    entry.offset = st.st_size;
+    entry.size = block.size();
+    entry.mse = mse;
+    entry.time = static_cast<double>(std::time(nullptr));
+    std::strncpy(entry.uuid, uuid.c_str(), sizeof(entry.uuid) - 1);
+    if (written) {
+      int index_fd =
+          open(GetIndexPath().c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+      written = index_fd >= 0 && WriteHeader(index_fd, "CBSINDEX") &&
+                WriteAll(index_fd, &entry, sizeof(entry));
+      written = index_fd >= 0 && close(index_fd) == 0 && written;
+    }
+    // Also releases the lock
+    return close(fd) == 0 && written;
+  }
+
+  // Reads all experiments of the store that are listed in its index. Returns
+  // false if the store is missing or damaged.
+  bool Read(std::vector<StoredExperiment>* experiments) const {
+    std::vector<IndexEntry> entries;
+    if (!ReadIndex(&entries)) {
+      return false;
+    }
+    std::ifstream in(path_, std::ios::binary);
+    for (const auto& entry : entries) {
+      std::vector<char> block(entry.size);
+      in.seekg(entry.offset);
+      if (!in.read(block.data(), block.size())) {
+        return false;
+      }
+      StoredExperiment experiment;
+      experiment.uuid = entry.uuid;
+      experiment.time = entry.time;
+      experiment.mse = entry.mse;
+      size_t pos = 0;
+      uint64_t num_series = 0;
+      if (!ReadString(block, &pos, &experiment.param) ||
+          !ReadValue(block, &pos, &num_series)) {
+        return false;
+      }
+      for (uint64_t i = 0; i < num_series; i++) {
+        StoredSeries s;
+        uint64_t length = 0;
+        uint64_t num_columns = 0;
+        if (!ReadString(block, &pos, &s.name) ||
+            !ReadValue(block, &pos, &length) ||
+            !ReadValue(block, &pos, &num_columns) ||
+            !ReadColumn(block, length, &pos, &s.x) ||
+            !ReadColumn(block, length, &pos, &s.y) ||
+            (num_columns == 4 &&
+             (!ReadColumn(block, length, &pos, &s.y_error_low) ||
+              !ReadColumn(block, length, &pos, &s.y_error_high)))) {
+          return false;
+        }
+        experiment.series.push_back(std::move(s));
+      }
+      experiments->push_back(std::move(experiment));
+    }
+    return true;
+  }
+
+  // Reads the index entries of the complete blocks
+  bool ReadIndex(std::vector<IndexEntry>* entries) const {
+    std::ifstream in(GetIndexPath(), std::ios::binary);
+    FileHeader header;
+    if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        std::memcmp(header.magic, "CBSINDEX", 8) != 0 ||
+        header.version != kVersion ||
+        header.entry_size != sizeof(IndexEntry)) {
+      return false;
+    }
+    IndexEntry entry;
+    while (in.read(reinterpret_cast<char*>(&entry), sizeof(entry))) {
+      entry.uuid[sizeof(entry.uuid) - 1] = '\0';
+      entries->push_back(entry);
+    }
+    return true;
+  }
+
+ private:
+  static bool WriteAll(int fd, const void* data, size_t size) {
+    const char* bytes = static_cast<const char*>(data);
+    while (size != 0) {
+      auto written = write(fd, bytes, size);
+      if (written < 0 && errno == EINTR) {
+        continue;
+      }
+      if (written <= 0) {
+        return false;
+      }
+      bytes += written;
+      size -= written;
+    }
+    return true;
+  }
+
+  // Starts a new file with its header
+  static bool WriteHeader(int fd, const char* magic) {
+    struct stat st = {};
+    if (fstat(fd, &st) != 0) {
+      return false;
+    }
+    if (st.st_size != 0) {
+      return true;
+    }
+    FileHeader header;
+    std::memcpy(header.magic, magic, sizeof(header.magic));
+    return WriteAll(fd, &header, sizeof(header));
+  }
+
+  template <typename T>
+  static void AppendValue(T value, std::vector<char>* block) {
+    auto* bytes = reinterpret_cast<const char*>(&value);
+    block->insert(block->end(), bytes, bytes + sizeof(value));
+  }
+
+  static void AppendString(const std::string& s, std::vector<char>* block) {
+    AppendValue<uint64_t>(s.size(), block);
+    block->insert(block->end(), s.begin(), s.end());
+    block->resize((block->size() + 7) / 8 * 8, '\0');
+  }
+
+  // Appends `length` values of `column`, padded with NaN
+  static void AppendColumn(const std::vector<double>& column, size_t length,
+                           std::vector<char>* block) {
+    for (size_t i = 0; i < length; i++) {
+      AppendValue(i < column.size() ? column[i] : std::nan(""), block);
+    }
+  }
+
+  template <typename T>
+  static bool ReadValue(const std::vector<char>& block, size_t* pos,
+                        T* value) {
+    if (*pos + sizeof(T) > block.size()) {
+      return false;
+    }
+    std::memcpy(value, block.data() + *pos, sizeof(T));
+    *pos += sizeof(T);
+    return true;
+  }
+
+  static bool ReadString(const std::vector<char>& block, size_t* pos,
+                         std::string* s) {
+    uint64_t size = 0;
+    if (!ReadValue(block, pos, &size) || *pos + size > block.size()) {
+      return false;
+    }
+    s->assign(block.data() + *pos, size);
+    *pos = (*pos + size + 7) / 8 * 8;
+    return true;
+  }
+
+  static bool ReadColumn(const std::vector<char>& block, uint64_t length,
+                         size_t* pos, std::vector<double>* column) {
+    if (*pos + length * sizeof(double) > block.size()) {
+      return false;
+    }
+    column->resize(length);
+    std::memcpy(column->data(), block.data() + *pos, length * sizeof(double));
+    *pos += length * sizeof(double);
+    return true;
+  }
+
+  std::string path_;
+};
+
+// The store in the output directory `dir` of a study
+inline std::string ExperimentStoreFile(const std::string& dir) {
+  return dir + "/experiments.store";
+}
+
+}  // namespace bdm
+
+#endif  // EXPERIMENT_STORE_H_
@@ -0,0 +1,142 @@
+#ifndef EXPORT_QUEUE_H_
+#define EXPORT_QUEUE_H_
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace bdm {
+
+// Runs the export of the results of the experiments on a background thread,
+// such that the next simulation can start while the previous results are
+// written. At most `capacity` exports are pending at a time: beyond that,
+// Push waits for the oldest one to finish, which bounds the memory held by
+// the queue. A task reports failure by throwing; the first error is kept
+// until the next Flush, and tasks pushed after it are skipped.
+class ExportQueue {
+ public:
+  explicit ExportQueue(size_t capacity = 2) : capacity_(capacity) {}
+
+  ~ExportQueue() {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    changed_.notify_all();
+    if (thread_.joinable()) {
+      thread_.join();
+    }
+  }
+
+  ExportQueue(const ExportQueue&) = delete;
+  ExportQueue& operator=(const ExportQueue&) = delete;
+
+  // With capacity 0, the tasks run on the calling thread
+  void SetCapacity(size_t capacity) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    capacity_ = capacity;
+  }
+
+  // Queues `task`, or runs it right away with capacity 0. Returns the error
+  // of an earlier task, if any, without queueing `task`.
+  std::string Push(std::function<void()> task) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (capacity_ == 0) {
+      changed_.wait(lock, [&]() { return tasks_.empty() && !busy_; });
+      lock.unlock();
+      auto error = RunTask(task);
+      lock.lock();
+      if (error_.empty()) {
+        error_ = error;
+      }
+      return error_;
+    }
+    changed_.wait(lock, [&]() {
+      return !error_.empty() || tasks_.size() + busy_ < capacity_;
+    });
+    if (error_.empty()) {
+      tasks_.push_back(std::move(task));
+      if (!thread_.joinable()) {
+        thread_ = std::thread([this]() { Run(); });
+      }
+      changed_.notify_all();
+    }
+    return error_;
+  }
+
+  // Waits until all queued tasks have finished, e.g. before the process
+  // forks (see ForkBranches)
+  void Wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    changed_.wait(lock, [&]() { return tasks_.empty() && !busy_; });
+  }
+
+  // Waits until all queued tasks have finished. Returns the error of the
+  // first task that failed since the last call, or an empty string.
+  std::string Flush() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    changed_.wait(lock, [&]() { return tasks_.empty() && !busy_; });
+    std::string error;
+    error.swap(error_);
+    return error;
+  }
+
+ private:
+  static std::string RunTask(const std::function<void()>& task) {
+    try {
+      task();
+    } catch (const std::exception& e) {
+      return e.what();
+    } catch (...) {
+      return "Unknown error";
+    }
+    return "";
+  }
+
+  void Run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      changed_.wait(lock, [&]() { return stop_ || !tasks_.empty(); });
+      if (tasks_.empty()) {
+        return;
+      }
+      auto task = std::move(tasks_.front());
+      tasks_.pop_front();
+      busy_ = true;
+      lock.unlock();
+      auto error = RunTask(task);
+      lock.lock();
+      busy_ = false;
+      if (error_.empty()) {
+        error_ = error;
+      }
+      if (!error_.empty()) {
+        tasks_.clear();
+      }
+      changed_.notify_all();
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  std::deque<std::function<void()>> tasks_;
+  size_t capacity_;
+  bool busy_ = false;
+  bool stop_ = false;
+  std::string error_;
+  std::thread thread_;
+};
+
+// The queue of the exports of this process (see ExportResults)
+inline ExportQueue* GetExportQueue() {
+  static ExportQueue queue;
+  return &queue;
+}
+
+}  // namespace bdm
+
+#endif  // EXPORT_QUEUE_H_
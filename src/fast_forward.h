@@ -0,0 +1,125 @@
+#ifndef FAST_FORWARD_H_
+#define FAST_FORWARD_H_
+
+#include <vector>
+
+#include "core/simulation.h"
+#include "core/util/thread_info.h"
+
+#include "behaviors/infection_behavior.h"
+#include "behaviors/travel_behavior.h"
+#include "covid_environment.h"
+#include "model_facts.h"
+#include "operations/update_statistics_op.h"
+#include "person.h"
+#include "sim_param.h"
+
+namespace bdm {
+
+// Advances all persons by `hours` consecutive asleep hours (see HourRegime),
+// starting at the current timestep. Nobody gets infected during these hours,
+// so each person can be advanced over all of them at once, instead of one
+// sweep over all agents per hour. The counts that the statistics operation
+// reports for each of these hours are computed during the same sweep. The
+// scheduler then still runs the timesteps (such that the operations and the
+// time series see every hour), but without running the behaviors again.
+inline void FastForwardAsleepHours(Simulation* sim, uint32_t hours) {
+  if (hours == 0) {
+    return;
+  }
+  auto* scheduler = sim->GetScheduler();
+  auto* env = bdm_static_cast<CovidEnvironment*>(sim->GetEnvironment());
+  auto* sparam = sim->GetParam()->Get<SimParam>();
+  auto start = scheduler->GetSimulatedSteps();
+  const uint32_t hours_per_week = kHoursPerDay * kDaysPerWeek;
+  // Nobody stays at home before the first intervention
+  bool home_stay = env->GetPhase() > 0;
+  bool track_located = sparam->export_infected_per_timestep_frequency != 0;
+
+  // Per thread the counts of each hour. The last element holds the persons
+  // whose state does not change during these hours, which count for every hour
+  const auto max_threads = ThreadInfo::GetInstance()->GetMaxThreads();
+  std::vector<std::vector<StateCounts>> counts_tl(
+      max_threads, std::vector<StateCounts>(hours + 1));
+
+  auto fast_forward = L2F([&](Agent* agent) {
+    auto tid = ThreadInfo::GetInstance()->GetMyThreadId();
+    auto* person = bdm_static_cast<Person*>(agent);
+    auto& counts = counts_tl[tid];
+    person->GetInfectionBehavior()->FastForward(
+        person, hours, sim->GetRandom(),
+        [&](uint32_t h, Person* p) { counts[h].AddState(*p); },
+        [&](Person* p) { counts[hours].AddState(*p); });
+
+    auto* schedule = person->GetWeeklyTravelSchedule();
+    if (track_located) {
+      for (uint32_t h = 0; h < hours; h++) {
+        auto location = home_stay && person->home_stay_
+                            ? person->home_location_
+                            : (*schedule)[(start + h) % hours_per_week];
+        counts[h].located[location] += person->weight_;
+      }
+    }
+    // Only the location after the last hour is visible to the next hours
+    auto last_hour_of_week = (start + hours - 1) % hours_per_week;
+    if (home_stay) {
+      TravelBehavior::Update<true>(person, last_hour_of_week);
+    } else {
+      TravelBehavior::Update<false>(person, last_hour_of_week);
+    }
+  });
+  sim->GetResourceManager()->ForEachAgentParallel(fast_forward);
+
+  std::vector<StateCounts> counts(hours);
+  for (uint32_t h = 0; h < hours; h++) {
+    for (auto& tl_counts : counts_tl) {
+      counts[h].Merge(tl_counts[h]);
+      counts[h].Merge(tl_counts[hours]);
+    }
+  }
+  // The statistics of the last hour are computed by the regular sweep of the
+  // statistics operation, which also updates the infected fractions for the
+  // first hour after the night
+  counts.pop_back();
+  GetStatistics(sim)->SetPrecomputedCounts(std::move(counts));
+
+  env->SetFastForwardUntil(start + hours);
+  scheduler->Simulate(hours);
+}
+
+// Simulates `hours` hours. If `fast_forward` is set, each stretch of asleep
+// hours is advanced with FastForwardAsleepHours, and the remaining hours are
+// simulated one timestep at a time. Fast-forwarding requires hourly timesteps.
+inline void SimulateHours(Simulation* sim, uint64_t hours, bool fast_forward) {
+  auto* scheduler = sim->GetScheduler();
+  auto step_hours = sim->GetParam()->Get<SimParam>()->step_hours;
+  if (step_hours > 1) {
+    scheduler->Simulate(hours / step_hours);
+    return;
+  }
+  if (!fast_forward) {
+    scheduler->Simulate(hours);
+    return;
+  }
+  auto is_asleep = [&](uint64_t timestep) {
+    return HourToRegime(timestep % kHoursPerDay) == HourRegime::kAsleep;
+  };
+  auto end = scheduler->GetSimulatedSteps() + hours;
+  while (scheduler->GetSimulatedSteps() < end) {
+    auto start = scheduler->GetSimulatedSteps();
+    auto stop = start;
+    bool asleep = is_asleep(start);
+    while (stop < end && is_asleep(stop) == asleep) {
+      stop++;
+    }
+    if (asleep) {
+      FastForwardAsleepHours(sim, stop - start);
+    } else {
+      scheduler->Simulate(stop - start);
+    }
+  }
+}
+
+}  // namespace bdm
+
+#endif  // FAST_FORWARD_H_
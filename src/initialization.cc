@@ -1,30 +1,34 @@
 #include "initialization.h"
 
+#include <cmath>
+#include <unordered_map>
+
 namespace bdm {
 
 void InitializeMobilityData() {
-  auto mobility_data = MobilityData::GetInstance();
-  std::string data_dir = GetDataDir();
-
-  // Read in M_freq.csv
-  std::string full_path = data_dir + "/M_freq.csv";
-  CsvTo2DMatrix(full_path, &(mobility_data->m_freq_));
-
-  // Read in M_inc.csv
-  full_path = data_dir + "/M_inc.csv";
-  CsvTo2DMatrix(full_path, &(mobility_data->m_inc_));
-
-  // Read in municipality population
-  full_path = data_dir + "/inwoners_gemeente_2018.csv";
-  CsvToVector(full_path, &(mobility_data->municipality_population_), 1, 0);
-
-  // Read in municipality names
-  full_path = data_dir + "/Gemeenten2018.csv";
-  CsvToVector(full_path, &(mobility_data->municipality_codes_), 0, 0);
+  auto* sim = Simulation::GetActive();
+  auto* env = bdm_static_cast<CovidEnvironment*>(sim->GetEnvironment());
+  // The Dirichlet draws follow the random numbers of the simulation
+  uint64_t seed = sim->GetRandom()->Uniform(0, 4294967296.0);
+  env->SetMobilityData(std::unique_ptr<MobilityData>(new MobilityData(seed)));
+  auto* mobility_data = env->GetMobilityData();
+  const auto& inputs = InputBundle::Get();
+
+  mobility_data->m_freq_ = inputs.GetMatrix<float>("M_freq.csv");
+  mobility_data->m_inc_ = inputs.GetMatrix<float>("M_inc.csv");
+
+  // Municipality population
+  auto population = inputs.GetArray<uint32_t>("inwoners_gemeente_2018.csv");
+  mobility_data->municipality_population_.assign(population.begin(),
+                                                 population.end());
+
+  // Municipality codes
+  auto codes = inputs.GetArray<uint32_t>("Gemeenten2018.csv");
+  mobility_data->municipality_codes_.assign(codes.begin(), codes.end());
 }
 
 void InitializeWeeklyTravelSchedule(Person* person) {
-  auto mobility_data = MobilityData::GetInstance();
+  auto* mobility_data = GetMobilityData();
   auto* schedule = person->GetWeeklyTravelSchedule();
 
   auto* simulation = Simulation::GetActive();
@@ -109,33 +113,306 @@ uint32_t MunicipalityToLocation(
 }
 
 Person* CreatePerson(Gender gender, uint8_t age, Demographic d,
-                     uint16_t municipality) {
+                     uint16_t municipality, bool draw_schedule) {
   Person* person = new Person(d, age, gender, municipality, municipality,
                               State::kSusceptible);
 
-  person->AddBehavior(new ChangeSituationBehavior());
-  person->AddBehavior(new TravelBehavior());
-  person->AddBehavior(new InfectionBehavior());
+  person->AddModelBehaviors();
+
+  if (draw_schedule) {
+    InitializeWeeklyTravelSchedule(person);
+  }
+  return person;
+}
+
+Person* CreatePersonFromRegister(const RegisterPerson& p) {
+  return CreatePerson(static_cast<Gender>(p.gender), p.age,
+                      static_cast<Demographic>(p.demography), p.location);
+}
+
+std::vector<RegisterPerson> ReadRegister(
+    const std::string& pop_dir_file,
+    const std::vector<uint32_t>& municipality_codes) {
+  // The municipality, work status, gender and age of each person. Cells that
+  // are not a number are read as 0.
+  CsvOptions options;
+  options.header_row = 0;
+  options.columns = {2, 4, 8, 9};
+  CsvTable<int> table;
+  auto error = ParseCsv(pop_dir_file, options, &table);
+  if (!error.empty()) {
+    Log::Fatal("ReadRegister", error);
+  }
+  std::unordered_map<uint32_t, uint16_t> locations;
+  for (size_t i = 0; i < municipality_codes.size(); i++) {
+    locations[municipality_codes[i]] = i;
+  }
+
+  std::vector<RegisterPerson> persons;
+  persons.reserve(table.rows);
+  for (size_t r = 0; r < table.rows; r++) {
+    auto municipality = table[r][0];
+    auto workstatus = table[r][1];
+    auto gender = table[r][2];
+    auto age = table[r][3];
+    auto it = locations.find(municipality);
+    if (it == locations.end()) {
+      Log::Fatal("Could not find municipality '", municipality,
+                 "' in list of valid municipalities");
+    }
+    auto demography = WorkstatusToDemographic(workstatus, age);
+    persons.push_back({it->second, static_cast<uint8_t>(age),
+                       static_cast<uint8_t>(demography),
+                       static_cast<uint8_t>(gender - 1)});
+  }
+  return persons;
+}
+
+std::vector<size_t> RegisterOrder(const std::vector<RegisterPerson>& persons,
+                                  size_t n, uint64_t seed) {
+  auto* sparam = Simulation::GetActive()->GetParam()->Get<SimParam>();
+  if (sparam->stratified_sampling) {
+    return StratifiedOrder(persons, n, seed);
+  }
+  return ShuffledOrder(persons, n);
+}
+
+uint32_t GetSuperAgentWeight() {
+  return Simulation::GetActive()->GetParam()->Get<SimParam>()->super_agent_weight;
+}
+
+std::vector<bool> ReadSeededMunicipalities() {
+  std::vector<bool> seeded(kNumMunicipalities, false);
+  auto initial_infected = InputBundle::Get().GetArray<int>(
+      "initial_infected_per_municipality_per_day.csv");
+  for (size_t i = 0; i < initial_infected.size(); i++) {
+    if (initial_infected[i] > 0) {
+      seeded[i % kNumMunicipalities] = true;
+    }
+  }
+  return seeded;
+}
+
+std::vector<bool> GetHotMunicipalities() {
+  if (GetSuperAgentWeight() <= 1) {
+    return std::vector<bool>(kNumMunicipalities, false);
+  }
+  return ReadSeededMunicipalities();
+}
+
+void SetTotalWeight(uint64_t total_weight) {
+  auto* env = dynamic_cast<CovidEnvironment*>(
+      Simulation::GetActive()->GetEnvironment());
+  if (env != nullptr) {
+    env->SetTotalWeight(total_weight);
+  }
+}
+
+uint64_t FillPopulationCache(const std::string& pop_dir_file,
+                             uint64_t population_size, uint64_t seed) {
+  auto* cache = PopulationCache::GetInstance();
+  const auto& municipality_codes =
+      GetMobilityData()->municipality_codes_;
+  auto* sparam = Simulation::GetActive()->GetParam()->Get<SimParam>();
+  cache->SetSource(pop_dir_file, sparam->stratified_sampling, seed);
+
+  uint64_t num_agents = population_size;
+  if (num_agents == 0) {
+    num_agents = cache->GetRegisterSize();
+  }
+  auto num_cached = std::min<uint64_t>(cache->GetNumPersons(), num_agents);
+
+  // Only read the register data if the cache does not cover the population yet
+  if (num_agents == 0 || num_cached < num_agents) {
+    std::cout << "Reading in register data..." << std::endl;
+    auto persons = ReadRegister(pop_dir_file, municipality_codes);
+    cache->SetRegisterSize(persons.size());
+    if (num_agents == 0) {
+      num_agents = persons.size();
+    }
+    auto order = RegisterOrder(persons, num_agents, seed);
+
+    std::cout << "Adding " << num_agents - num_cached
+              << " persons to the population cache..." << std::endl;
+    cache->Resize(num_agents);
+#pragma omp parallel for
+    for (size_t r = num_cached; r < num_agents; r++) {
+      auto* new_person = CreatePersonFromRegister(persons[order[r]]);
+      cache->Store(r, *new_person);
+      delete new_person;
+    }
+  }
+  std::cout << "Initializing population of " << num_agents << " persons ("
+            << num_cached << " from the population cache)..." << std::endl;
+  return num_agents;
+}
 
-  InitializeWeeklyTravelSchedule(person);
+Person* CreateCachedPerson(size_t r, bool restore_schedule) {
+  auto* cache = PopulationCache::GetInstance();
+  auto* person = CreatePerson(cache->GetGender(r), cache->GetAge(r),
+                              cache->GetDemography(r),
+                              cache->GetMunicipality(r), !restore_schedule);
+  if (restore_schedule) {
+    cache->RestoreSchedule(r, person);
+  }
   return person;
 }
 
-void InitializePopulation(std::string pop_dir_file, bool randinit) {
+void InitializeCachedPopulation(const std::string& pop_dir_file,
+                                uint64_t population_size, uint64_t seed) {
+  auto* sim = Simulation::GetActive();
+  auto* cache = PopulationCache::GetInstance();
+  auto num_agents = FillPopulationCache(pop_dir_file, population_size, seed);
+
+  auto agents = GroupIntoAgents(
+      num_agents, [&](size_t r) { return cache->GetMunicipality(r); },
+      [&](size_t r) { return cache->GetDemography(r); },
+      GetHotMunicipalities(), GetSuperAgentWeight());
+#pragma omp parallel
+  {
+    auto* ctxt = sim->GetExecutionContext();
+#pragma omp for
+    for (size_t a = 0; a < agents.size(); a++) {
+      auto* new_person = CreateCachedPerson(agents[a].first);
+      new_person->weight_ = agents[a].second;
+      ctxt->AddAgent(new_person);
+    }
+  }
+
+  // Adds agents to ResourceManager
+  sim->GetScheduler()->FinalizeInitialization();
+  SetTotalWeight(num_agents);
+}
+
+TransitionRates GetTransitionRates(const SimParam* sparam) {
+  // The means of the Weibull and lognormal distributions of InfectionBehavior
+  auto weibull_mean = [](real_t shape, real_t scale) {
+    return scale * std::tgamma(1 + 1 / shape);
+  };
+  TransitionRates rates;
+  rates.incubation = 1 / weibull_mean(sparam->incubation_shape_param,
+                                      sparam->incubation_scale_param);
+  rates.recovery = 1 / weibull_mean(sparam->infection_shape_param,
+                                    sparam->infection_scale_param);
+  rates.admission = 1 / weibull_mean(sparam->hospitalization_shape_param,
+                                     sparam->hospitalization_scale_param);
+  rates.discharge =
+      1 / (kHoursPerDay * std::exp(sparam->hospital_average_mean +
+                                   sparam->hospital_average_sigma *
+                                       sparam->hospital_average_sigma / 2));
+  return rates;
+}
+
+void InitializeHybridPopulation(const std::string& pop_dir_file,
+                                uint64_t population_size, uint64_t seed) {
+  auto* sim = Simulation::GetActive();
+  auto* sparam = sim->GetParam()->Get<SimParam>();
+  auto* env = bdm_static_cast<CovidEnvironment*>(sim->GetEnvironment());
+  auto* cache = PopulationCache::GetInstance();
+  auto* mobility_data = GetMobilityData();
+  auto num_agents = FillPopulationCache(pop_dir_file, population_size, seed);
+
+  auto meta = std::unique_ptr<Metapopulation>(new Metapopulation());
+  meta->SetMobility(mobility_data->m_freq_, mobility_data->m_inc_,
+                    sparam->metapopulation_mobility_cutoff);
+  meta->SetRates(GetTransitionRates(sparam));
+
+  // The municipalities with initial infections start with agents
+  auto active = ReadSeededMunicipalities();
+  std::vector<size_t> agents;
+  for (size_t r = 0; r < num_agents; r++) {
+    auto m = cache->GetMunicipality(r);
+    if (active[m]) {
+      agents.push_back(r);
+    } else {
+      meta->AddMember(m, cache->GetDemography(r), r);
+    }
+  }
+  for (uint16_t m = 0; m < kNumMunicipalities; m++) {
+    if (active[m]) {
+      meta->SetActive(m);
+    }
+  }
+  std::cout << "Hybrid population: " << agents.size() << " of " << num_agents
+            << " persons start as agents" << std::endl;
+
+#pragma omp parallel
+  {
+    auto* ctxt = sim->GetExecutionContext();
+#pragma omp for
+    for (size_t a = 0; a < agents.size(); a++) {
+      ctxt->AddAgent(
+          CreateCachedPerson(agents[a], sparam->cache_population));
+    }
+  }
+
+  // Adds agents to ResourceManager
+  sim->GetScheduler()->FinalizeInitialization();
+  env->SetMetapopulation(std::move(meta));
+  SetTotalWeight(num_agents);
+}
+
+void ActivateMunicipality(
+    uint16_t m, const std::array<real_t, kNumDemographies>& home_stay) {
+  auto* sim = Simulation::GetActive();
+  auto* sparam = sim->GetParam()->Get<SimParam>();
+  auto* rm = sim->GetResourceManager();
+  auto* random = sim->GetRandom();
+  auto* env = bdm_static_cast<CovidEnvironment*>(sim->GetEnvironment());
+  auto* meta = env->GetMetapopulation();
+  auto* cache = PopulationCache::GetInstance();
+
+  // The persons per state that are left to assign, per demography. The
+  // members of a municipality are in a random order, so the states are
+  // assigned in a fixed order.
+  std::array<Compartments, kNumDemographies> left;
+  for (uint8_t d = 0; d < kNumDemographies; d++) {
+    left[d] = meta->GetCompartments(m, d);
+  }
+  auto take = [](real_t* count) {
+    if (*count < 0.5) {
+      return false;
+    }
+    (*count)--;
+    return true;
+  };
+  for (auto r : meta->GetMembers(m)) {
+    auto d = cache->GetDemography(r);
+    auto& c = left[d];
+    auto* person = CreateCachedPerson(r, sparam->cache_population);
+    auto state = State::kSusceptible;
+    if (take(&c.exposed)) {
+      state = State::kExposed;
+    } else if (take(&c.infectious)) {
+      state = State::kInfectious;
+    } else if (take(&c.recovered)) {
+      state = State::kRecovered;
+    }
+    person->state_ = state;
+    if (state == State::kExposed) {
+      person->RandomlyInitializeStateThreshold();
+    } else if (state != State::kSusceptible) {
+      bool hospitalized = take(&c.hospitalized);
+      bool hospitalize = hospitalized || take(&c.hospital_pending);
+      person->GetInfectionBehavior()->InitializeCourse(person, hospitalize,
+                                                       hospitalized);
+    }
+    person->home_stay_ = random->Uniform(0, 1) < home_stay[d];
+    rm->AddAgent(person);
+  }
+  std::cout << "Municipality " << m << " switches to the agent model after "
+            << GetSimulatedHours() << " hours" << std::endl;
+  meta->SetActive(m);
+}
+
+void InitializePopulation(std::string pop_dir_file, bool randinit,
+                          uint64_t seed) {
   auto* sim = Simulation::GetActive();
   auto* rm = bdm_static_cast<RandomizedRm<ResourceManager>*>(
       sim->GetResourceManager());
   auto* param = sim->GetParam();
   const auto* sparam = param->Get<SimParam>();
 
-  if (sparam->no_fixed_seed) {
-    rand.SetSeed(0);
-    for (auto& r : MobilityData::GetInstance()->r_RNG) {
-      gsl_rng_set(r, time(NULL));
-    }
-    generator.seed(time(NULL));
-  }
-
   InitializeMobilityData();
 
   // A random population initialization (for local testing)
@@ -154,12 +431,14 @@ void InitializePopulation(std::string pop_dir_file, bool randinit) {
 #pragma omp parallel
       {
         auto* ctxt = sim->GetExecutionContext();
+        auto* random = sim->GetRandom();
 #pragma omp for
         for (size_t p = 0; p < pop_per_demo; p++) {
           auto age_limit = kAgeLimitsPerDemography[d];
-          int age = rand.Uniform(age_limit.first, age_limit.second);
-          Gender gender = static_cast<Gender>(std::round(rand.Uniform(0, 1)));
-          uint16_t location = rand.Uniform(0, kNumMunicipalities);
+          int age = random->Uniform(age_limit.first, age_limit.second);
+          Gender gender =
+              static_cast<Gender>(std::round(random->Uniform(0, 1)));
+          uint16_t location = random->Uniform(0, kNumMunicipalities);
           location = location > kNumMunicipalities - 1 ? kNumMunicipalities - 1
                                                        : location;
           auto* new_person =
@@ -173,8 +452,7 @@ void InitializePopulation(std::string pop_dir_file, bool randinit) {
     std::cout << "agent count = " << pop_count << std::endl;
     std::cout << "rm->GetNumAgents = " << rm->GetNumAgents() << std::endl;
 
-    auto pop_per_municipality =
-        MobilityData::GetInstance()->municipality_population_;
+    auto pop_per_municipality = GetMobilityData()->municipality_population_;
     std::vector<uint32_t> agents_per_municipality;
     auto scaling = GetAgentToPersonRatio();
     std::for_each(
@@ -210,60 +488,48 @@ void InitializePopulation(std::string pop_dir_file, bool randinit) {
     }
   }
 
-  auto mobility_data = MobilityData::GetInstance();
-  const auto& municipality_codes = mobility_data->municipality_codes_;
-
-  if (!randinit) {
-    if (!fs::exists(pop_dir_file)) {
-      Log::Fatal("CsvTo2DMatrix", "File not found: ", pop_dir_file);
-    }
-    rapidcsv::ConverterParams converter(true);
-    rapidcsv::SeparatorParams separator;
-    rapidcsv::LabelParams labels(0);  // no header
+  const auto& municipality_codes = GetMobilityData()->municipality_codes_;
 
+  if (!randinit && sparam->hybrid_metapopulation) {
+    InitializeHybridPopulation(pop_dir_file, sparam->population_size, seed);
+  } else if (!randinit && sparam->cache_population) {
+    InitializeCachedPopulation(pop_dir_file, sparam->population_size, seed);
+  } else if (!randinit) {
     std::cout << "Reading in register data..." << std::endl;
+    auto persons = ReadRegister(pop_dir_file, municipality_codes);
 
-    auto doc = rapidcsv::Document(pop_dir_file, labels, separator, converter);
-
-    uint32_t num_agents = 0;
+    uint64_t num_agents = 0;
     if (sparam->population_size != 0) {
       num_agents = sparam->population_size;
     } else {
-      num_agents = doc.GetRowCount();
+      num_agents = persons.size();
     }
 
     std::cout << "Initializing population of " << num_agents
               << " agents with register data..." << std::endl;
 
-    std::vector<size_t> random_indices(doc.GetRowCount());
-    // Generate values in range 0, 1, 2, .., (doc.GetRowCount() - 1)
-    std::iota(std::begin(random_indices), std::end(random_indices), 0);
-    // Shuffle to create random indices order
-    auto rng = std::default_random_engine{};
-    std::shuffle(random_indices.begin(), random_indices.end(), rng);
+    auto order = RegisterOrder(persons, num_agents, seed);
+    num_agents = order.size();
+    auto agents = GroupIntoAgents(
+        num_agents, [&](size_t r) { return persons[order[r]].location; },
+        [&](size_t r) { return persons[order[r]].demography; },
+        GetHotMunicipalities(), GetSuperAgentWeight());
 
 #pragma omp parallel
     {
       auto* ctxt = sim->GetExecutionContext();
 #pragma omp for
-      for (size_t r = 0; r < num_agents; r++) {
-        auto idx = random_indices[r];
-        std::vector<int> row = doc.GetRow<int>(idx);
-        auto municipality = row[2];
-        auto workstatus = row[4];
-        auto age = row[9];
-        auto gender = row[8];
-        Demographic d = WorkstatusToDemographic(workstatus, age);
-        uint32_t location =
-            MunicipalityToLocation(municipality, municipality_codes);
-        Gender g = Gender(gender - 1);
-        auto* new_person = CreatePerson(g, age, d, location);
+      for (size_t a = 0; a < agents.size(); a++) {
+        auto* new_person =
+            CreatePersonFromRegister(persons[order[agents[a].first]]);
+        new_person->weight_ = agents[a].second;
         ctxt->AddAgent(new_person);
       }
     }
 
     // Adds agents to ResourceManager
     sim->GetScheduler()->FinalizeInitialization();
+    SetTotalWeight(num_agents);
   }
 
   std::cout << "num agents = " << rm->GetNumAgents() << std::endl;
@@ -3,6 +3,7 @@
 
 #include <algorithm>
 #include <array>
+#include <memory>
 #include <numeric>
 #include <utility>
 #include <vector>
@@ -10,10 +11,16 @@
 #include "behaviors/change_situation_behavior.h"
 #include "behaviors/infection_behavior.h"
 #include "behaviors/travel_behavior.h"
+#include "covid_environment.h"
+#include "csv_helper.h"
+#include "input_bundle.h"
+#include "metapopulation.h"
 #include "mobility_data.h"
 #include "model_facts.h"
 #include "operations/update_statistics_op.h"
 #include "person.h"
+#include "population_cache.h"
+#include "register_sampling.h"
 #include "sim_param.h"
 
 #include "biodynamo.h"
@@ -22,8 +29,7 @@
 
 namespace bdm {
 
-static Random rand;
-
+// Reads the mobility data into the CovidEnvironment of the active simulation
 void InitializeMobilityData();
 
 void InitializeWeeklyTravelSchedule(Person* person);
@@ -34,10 +40,74 @@ Demographic WorkstatusToDemographic(int workstatus, uint8_t age);
 uint32_t MunicipalityToLocation(
     uint32_t municipality, const std::vector<uint32_t>& municipality_codes);
 
+// Creates a person with the behaviors of this model. Without
+// `draw_schedule`, the caller has to set the weekly travel schedule.
 Person* CreatePerson(Gender gender, uint8_t age, Demographic d,
-                            uint16_t municipality);
+                     uint16_t municipality, bool draw_schedule = true);
+
+Person* CreatePersonFromRegister(const RegisterPerson& p);
+
+// The weight of the super agents (see SimParam::super_agent_weight)
+uint32_t GetSuperAgentWeight();
+
+// The municipalities that get initial infections (see InitialInfectionOp)
+std::vector<bool> ReadSeededMunicipalities();
+
+// The municipalities whose persons are never merged into super agents: the
+// seeded ones if super agents are enabled
+std::vector<bool> GetHotMunicipalities();
+
+// Sets the summed weight of all agents (see GetAgentToPersonRatio)
+void SetTotalWeight(uint64_t total_weight);
+
+// Reads the fields that the model uses from the register data, in one pass
+// over the file
+std::vector<RegisterPerson> ReadRegister(
+    const std::string& pop_dir_file,
+    const std::vector<uint32_t>& municipality_codes);
+
+// Selects the `n` persons that make up the population, stratified or not
+// (see SimParam::stratified_sampling). The selection for `n` persons is a
+// prefix of the one for more persons. The stratified selection depends on
+// `seed`; the random subset keeps its fixed order.
+std::vector<size_t> RegisterOrder(const std::vector<RegisterPerson>& persons,
+                                  size_t n, uint64_t seed);
+
+// Makes sure that the PopulationCache holds the first `population_size`
+// persons of the register data (all if 0), in the order for `seed`. Returns
+// the number of persons.
+uint64_t FillPopulationCache(const std::string& pop_dir_file,
+                             uint64_t population_size, uint64_t seed);
+
+// Creates the person at index `r` of the PopulationCache, with its cached
+// travel schedule or, if `restore_schedule` is false, a new one
+Person* CreateCachedPerson(size_t r, bool restore_schedule = true);
+
+// Initializes the population from the register data through the
+// PopulationCache (see SimParam::cache_population)
+void InitializeCachedPopulation(const std::string& pop_dir_file,
+                                uint64_t population_size, uint64_t seed);
+
+// The transition rates of the Metapopulation that match the distributions of
+// the InfectionBehavior
+TransitionRates GetTransitionRates(const SimParam* sparam);
+
+// Initializes the population for SimParam::hybrid_metapopulation: only the
+// seeded municipalities get agents, all others start in the Metapopulation
+void InitializeHybridPopulation(const std::string& pop_dir_file,
+                                uint64_t population_size, uint64_t seed);
+
+// Hands municipality `m` over from the Metapopulation to the agent model. Its
+// persons are created from the PopulationCache and get their disease states
+// from the compartments. `home_stay` is the fraction per demography that
+// stays at home due to the interventions.
+void ActivateMunicipality(
+    uint16_t m, const std::array<real_t, kNumDemographies>& home_stay);
 
-void InitializePopulation(std::string pop_dir_file, bool randinit = 0);
+// Initializes the population from the register data, or a random one if
+// `randinit` is set. `seed` is the seed of the run.
+void InitializePopulation(std::string pop_dir_file, bool randinit = 0,
+                          uint64_t seed = 0);
 
 }  // namespace bdm
 
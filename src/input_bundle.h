@@ -0,0 +1,543 @@
+#ifndef INPUT_BUNDLE_H_
+#define INPUT_BUNDLE_H_
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "biodynamo.h"
+#include "core/util/log.h"
+
+#include "csv_parser.h"
+#include "model_facts.h"
+
+namespace bdm {
+
+// A read-only array of the InputBundle
+template <typename T>
+class ArrayView {
+ public:
+  ArrayView() {}
+  ArrayView(const T* data, size_t size) : data_(data), size_(size) {}
+
+  const T& operator[](size_t i) const { return data_[i]; }
+  const T* begin() const { return data_; }
+  const T* end() const { return data_ + size_; }
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+ private:
+  const T* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+// A read-only row-major matrix of the InputBundle, indexed as [row][column]
+template <typename T>
+class MatrixView {
+ public:
+  MatrixView() {}
+  MatrixView(const T* data, size_t rows, size_t cols)
+      : data_(data), rows_(rows), cols_(cols) {}
+
+  ArrayView<T> operator[](size_t row) const {
+    return ArrayView<T>(data_ + row * cols_, cols_);
+  }
+  size_t size() const { return rows_; }
+  size_t GetNumCols() const { return cols_; }
+
+ private:
+  const T* data_ = nullptr;
+  size_t rows_ = 0;
+  size_t cols_ = 0;
+};
+
+// Changes with every change of the layout of the InputBundle
+constexpr uint32_t kInputBundleVersion = 2;
+
+// The bundle file that the build converts the inputs into (see
+// make_input_bundle); empty if the build did not define one
+inline std::string GetInputBundleFile() {
+#ifdef INPUT_BUNDLE_FILE
+  std::string file = INPUT_BUNDLE_FILE;
+  RemoveQuotes(&file);
+  return file;
+#else
+  return "";
+#endif
+}
+
+// The static inputs of the model in src/data, parsed once and stored in one
+// immutable, checksummed block of memory. The bundle is taken from the first
+// of:
+//  - the bundle file of the build (see GetInputBundleFile), mapped read-only,
+//    if it was built from the current input files;
+//  - POSIX shared memory, such that all processes on a node (MPI ranks,
+//    repetition workers, later runs) map the same pages read-only instead of
+//    parsing the CSV files again. The first process creates the segment, the
+//    others wait until it is complete. A segment that is still incomplete
+//    after a minute (e.g. its creator died) or corrupt is replaced;
+//  - a private copy of the process.
+// The inputs are identified by the version of the layout and a hash of the
+// size and modification time of the input files, so a changed input is never
+// served from an old bundle. The segments stay in /dev/shm after the
+// processes exit, such that later runs do not parse the inputs again. The
+// segments of other layout versions are removed whenever a segment is
+// created; those of changed inputs can be removed with Unlink, or from
+// /dev/shm.
+class InputBundle {
+ public:
+  // The bundle of the files in GetDataDir(), created at the first call
+  static const InputBundle& Get() {
+    static const InputBundle kBundle(GetDataDir(), GetInputBundleFile());
+    return kBundle;
+  }
+
+  explicit InputBundle(const std::string& data_dir,
+                       const std::string& file = "")
+      : data_dir_(data_dir), inputs_hash_(HashInputs(data_dir)) {
+    name_ = Concat("/cbs_covid_inputs_v", kInputBundleVersion, "_",
+                   inputs_hash_);
+    if (!file.empty() && MapFile(file)) {
+      return;
+    }
+    bool stale = false;
+    if (Attach(&stale)) {
+      return;
+    }
+    if (stale) {
+      // If several processes replace it at once, each may create a segment
+      // of its own; all of them stay valid for the processes that map them
+      Log::Warning("InputBundle", "Replacing the incomplete or corrupt ",
+                   "shared inputs ", name_);
+      shm_unlink(name_.c_str());
+    }
+    if (!Create()) {
+      buffer_ = Build(data_dir);
+      data_ = buffer_.data();
+      size_ = buffer_.size();
+    }
+  }
+
+  ~InputBundle() {
+    if (mapped_) {
+      munmap(const_cast<char*>(data_), size_);
+    }
+  }
+
+  // Converts the input files in `data_dir` into the bundle file `file`.
+  // Returns false if it could not be written.
+  static bool WriteFile(const std::string& data_dir, const std::string& file) {
+    auto data = Build(data_dir);
+    auto tmp = file + ".tmp";
+    {
+      std::ofstream out(tmp, std::ios::binary);
+      out.write(data.data(), data.size());
+      if (!out) {
+        return false;
+      }
+    }
+    return std::rename(tmp.c_str(), file.c_str()) == 0;
+  }
+
+  InputBundle(const InputBundle&) = delete;
+  InputBundle& operator=(const InputBundle&) = delete;
+
+  // True if the bundle is mapped from shared memory or the bundle file
+  bool IsShared() const { return mapped_; }
+  // True if the bundle is mapped from the bundle file of the build
+  bool IsFromFile() const { return from_file_; }
+  const std::string& GetName() const { return name_; }
+
+  // Finds the contents of the input file `path` if it is part of the bundle
+  // and was read the same way: as a matrix, or as `column` of a table, with
+  // the header row `skip_header` (see CsvTo2DMatrix and CsvToVector)
+  template <typename T>
+  bool Lookup(const std::string& path, bool matrix, size_t column,
+              int skip_header, MatrixView<T>* values) const {
+    if (path.compare(0, data_dir_.size() + 1, data_dir_ + "/") != 0) {
+      return false;
+    }
+    auto file = path.substr(data_dir_.size() + 1);
+    const auto* header = reinterpret_cast<const Header*>(data_);
+    const auto* entries =
+        reinterpret_cast<const Entry*>(data_ + sizeof(Header));
+    for (uint32_t i = 0; i < header->num_entries; i++) {
+      const auto& entry = entries[i];
+      if (file == entry.file && entry.type == ElementType<T>() &&
+          entry.matrix == matrix && entry.skip_header == skip_header &&
+          (matrix || entry.column == column)) {
+        *values = MatrixView<T>(reinterpret_cast<const T*>(data_ + entry.offset),
+                                entry.rows, entry.cols);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // The contents of the input file `file` (see GetInputFiles)
+  template <typename T>
+  ArrayView<T> GetArray(const std::string& file) const {
+    const auto* entry = Find<T>(file);
+    return ArrayView<T>(reinterpret_cast<const T*>(data_ + entry->offset),
+                        entry->rows * entry->cols);
+  }
+
+  template <typename T>
+  MatrixView<T> GetMatrix(const std::string& file) const {
+    const auto* entry = Find<T>(file);
+    return MatrixView<T>(reinterpret_cast<const T*>(data_ + entry->offset),
+                         entry->rows, entry->cols);
+  }
+
+  // Removes the shared memory segment of the current inputs, e.g. to free the
+  // memory after a study. Processes that mapped it keep their mapping.
+  static void Unlink(const std::string& data_dir) {
+    shm_unlink(Concat("/cbs_covid_inputs_v", kInputBundleVersion, "_",
+                      HashInputs(data_dir))
+                   .c_str());
+  }
+
+  // Removes the shared memory segments of other versions of the layout,
+  // which no process of this build can use. Processes that mapped them keep
+  // their mapping.
+  static void UnlinkOtherVersions() {
+    const std::string prefix = "cbs_covid_inputs_v";
+    const std::string current = Concat(prefix, kInputBundleVersion, "_");
+    DIR* dir = opendir("/dev/shm");
+    if (dir == nullptr) {
+      return;
+    }
+    while (auto* entry = readdir(dir)) {
+      std::string name = entry->d_name;
+      if (name.compare(0, prefix.size(), prefix) == 0 &&
+          name.compare(0, current.size(), current) != 0) {
+        shm_unlink(("/" + name).c_str());
+      }
+    }
+    closedir(dir);
+  }
+
+ private:
+  static constexpr uint64_t kMagic = 0x4c444e55424e4943;  // "CINBUNDL"
+
+  struct Header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t num_entries;
+    uint64_t size;
+    // See HashInputs
+    uint64_t inputs_hash;
+    // FNV-1a of everything after the header
+    uint64_t checksum;
+    // Set last, once the creator filled the bundle
+    uint32_t ready;
+    uint32_t padding;
+  };
+
+  struct Entry {
+    char file[56];
+    // See ElementType
+    uint32_t type;
+    uint32_t matrix;
+    uint32_t column;
+    int32_t skip_header;
+    uint64_t rows;
+    uint64_t cols;
+    uint64_t offset;
+  };
+
+  // How an input file is read (see CsvTo2DMatrix and CsvToVector)
+  struct InputFile {
+    const char* file;
+    uint32_t type;
+    bool matrix;
+    size_t column;
+    int skip_header;
+  };
+
+  template <typename T>
+  static constexpr uint32_t ElementType() {
+    return (std::is_floating_point<T>::value
+                ? 0x100
+                : (std::is_signed<T>::value ? 0x200 : 0x300)) |
+           sizeof(T);
+  }
+
+  static std::vector<InputFile> GetInputFiles() {
+    return {{"M_freq.csv", ElementType<float>(), true, 0, -1},
+            {"M_inc.csv", ElementType<float>(), true, 0, -1},
+            {"Mix_h.csv", ElementType<real_t>(), true, 0, -1},
+            {"Mix_o.csv", ElementType<real_t>(), true, 0, -1},
+            {"Mix_s.csv", ElementType<real_t>(), true, 0, -1},
+            {"Mix_w.csv", ElementType<real_t>(), true, 0, -1},
+            {"Mix_ws.csv", ElementType<real_t>(), true, 0, -1},
+            {"mixmat_phase2.csv", ElementType<real_t>(), true, 0, -1},
+            {"mixmat_phase4.csv", ElementType<real_t>(), true, 0, -1},
+            {"inwoners_gemeente_2018.csv", ElementType<uint32_t>(), false, 1,
+             0},
+            {"Gemeenten2018.csv", ElementType<uint32_t>(), false, 0, 0},
+            {"initial_infected_per_municipality_per_day.csv",
+             ElementType<int>(), false, 0, 0},
+            {"initial_infected_per_municipality.csv", ElementType<int>(),
+             false, 1, 0},
+            {"observed_hospital_doubling.csv", ElementType<real_t>(), false,
+             0, -1}};
+  }
+
+  static uint64_t Fnv1a(const char* data, size_t size,
+                        uint64_t hash = 0xcbf29ce484222325) {
+    for (size_t i = 0; i < size; i++) {
+      hash = (hash ^ static_cast<uint8_t>(data[i])) * 0x100000001b3;
+    }
+    return hash;
+  }
+
+  static uint64_t HashInputs(const std::string& data_dir) {
+    uint64_t hash = Fnv1a(data_dir.data(), data_dir.size());
+    for (const auto& input : GetInputFiles()) {
+      struct stat st = {};
+      stat((data_dir + "/" + input.file).c_str(), &st);
+      uint64_t stamp[2] = {static_cast<uint64_t>(st.st_size),
+                           static_cast<uint64_t>(st.st_mtime)};
+      hash = Fnv1a(input.file, std::strlen(input.file), hash);
+      hash = Fnv1a(reinterpret_cast<const char*>(stamp), sizeof(stamp), hash);
+    }
+    return hash;
+  }
+
+  template <typename T>
+  static void Append(const std::vector<T>& values, std::vector<char>* data) {
+    auto* begin = reinterpret_cast<const char*>(values.data());
+    data->insert(data->end(), begin, begin + values.size() * sizeof(T));
+  }
+
+  // Parses `input` and appends its values to `data`, as CsvTo2DMatrix and
+  // CsvToVector do. The inputs must be complete: ragged rows and cells that
+  // are not numbers are fatal.
+  template <typename T>
+  static void Read(const std::string& path, const InputFile& input,
+                   Entry* entry, std::vector<char>* data) {
+    CsvOptions options;
+    options.header_row = input.skip_header;
+    options.column = input.matrix ? -1 : static_cast<int>(input.column);
+    options.validate = true;
+    CsvTable<T> table;
+    auto error = ParseCsv(path, options, &table);
+    if (!error.empty()) {
+      Log::Fatal("InputBundle", error);
+    }
+    entry->rows = input.matrix ? table.rows : 1;
+    entry->cols = input.matrix ? table.cols : table.rows;
+    Append(table.values, data);
+  }
+
+  // Parses all input files into the layout of the bundle
+  static std::vector<char> Build(const std::string& data_dir) {
+    auto inputs = GetInputFiles();
+    std::vector<Entry> entries(inputs.size());
+    std::vector<char> payload;
+    for (size_t i = 0; i < inputs.size(); i++) {
+      const auto& input = inputs[i];
+      auto& entry = entries[i];
+      std::memset(&entry, 0, sizeof(entry));
+      std::strncpy(entry.file, input.file, sizeof(entry.file) - 1);
+      entry.type = input.type;
+      entry.matrix = input.matrix;
+      entry.column = input.column;
+      entry.skip_header = input.skip_header;
+      // All values are aligned to 8 bytes
+      payload.resize((payload.size() + 7) / 8 * 8);
+      entry.offset = payload.size();
+      auto path = data_dir + "/" + input.file;
+      if (input.type == ElementType<float>()) {
+        Read<float>(path, input, &entry, &payload);
+      } else if (input.type == ElementType<double>()) {
+        Read<double>(path, input, &entry, &payload);
+      } else if (input.type == ElementType<int>()) {
+        Read<int>(path, input, &entry, &payload);
+      } else {
+        Read<uint32_t>(path, input, &entry, &payload);
+      }
+    }
+
+    size_t offset = sizeof(Header) + entries.size() * sizeof(Entry);
+    for (auto& entry : entries) {
+      entry.offset += offset;
+    }
+    std::vector<char> data(offset);
+    std::memcpy(data.data() + sizeof(Header), entries.data(),
+                entries.size() * sizeof(Entry));
+    data.insert(data.end(), payload.begin(), payload.end());
+    Header header = {};
+    header.magic = kMagic;
+    header.version = kInputBundleVersion;
+    header.num_entries = entries.size();
+    header.size = data.size();
+    header.inputs_hash = HashInputs(data_dir);
+    header.checksum =
+        Fnv1a(data.data() + sizeof(Header), data.size() - sizeof(Header));
+    header.ready = 1;
+    std::memcpy(data.data(), &header, sizeof(header));
+    return data;
+  }
+
+  // True if `data` is a complete bundle of the current inputs
+  bool IsValid(const char* data, size_t size) const {
+    const auto* header = reinterpret_cast<const Header*>(data);
+    return size >= sizeof(Header) && header->ready != 0 &&
+           header->magic == kMagic && header->version == kInputBundleVersion &&
+           header->size == size && header->inputs_hash == inputs_hash_ &&
+           header->checksum ==
+               Fnv1a(data + sizeof(Header), size - sizeof(Header));
+  }
+
+  // Maps the bundle file of the build. Returns false if it is missing or
+  // outdated.
+  bool MapFile(const std::string& file) {
+    int fd = open(file.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat st = {};
+    void* mapped = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+      mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (mapped == MAP_FAILED) {
+      return false;
+    }
+    if (!IsValid(static_cast<const char*>(mapped), st.st_size)) {
+      Log::Warning("InputBundle", file, " does not match the input files in ",
+                   data_dir_, "; rebuild it to avoid parsing them");
+      munmap(mapped, st.st_size);
+      return false;
+    }
+    data_ = static_cast<const char*>(mapped);
+    size_ = st.st_size;
+    mapped_ = true;
+    from_file_ = true;
+    return true;
+  }
+
+  // Maps the segment of another process, once it is complete. Returns false
+  // if there is none, or if it is still incomplete after a minute or corrupt;
+  // then `stale` is set.
+  bool Attach(bool* stale = nullptr) {
+    int fd = shm_open(name_.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+      return false;
+    }
+    // The creator may still be filling the segment
+    auto deadline =
+        std::chrono::steady_clock::now() + std::chrono::seconds(60);
+    struct stat st = {};
+    while (fstat(fd, &st) == 0 &&
+           static_cast<size_t>(st.st_size) < sizeof(Header) &&
+           std::chrono::steady_clock::now() < deadline) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    void* mapped = MAP_FAILED;
+    if (static_cast<size_t>(st.st_size) >= sizeof(Header)) {
+      mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (mapped == MAP_FAILED) {
+      if (stale != nullptr) {
+        *stale = static_cast<size_t>(st.st_size) < sizeof(Header);
+      }
+      return false;
+    }
+    const auto* header = static_cast<const Header*>(mapped);
+    while (__atomic_load_n(&header->ready, __ATOMIC_ACQUIRE) == 0 &&
+           std::chrono::steady_clock::now() < deadline) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    const auto* data = static_cast<const char*>(mapped);
+    if (!IsValid(data, st.st_size)) {
+      munmap(mapped, st.st_size);
+      if (stale != nullptr) {
+        *stale = true;
+      }
+      return false;
+    }
+    data_ = data;
+    size_ = st.st_size;
+    mapped_ = true;
+    return true;
+  }
+
+  // Creates the segment and fills it. Returns false if shared memory is not
+  // available, or another process created the segment in between and did not
+  // complete it.
+  bool Create() {
+    int fd = shm_open(name_.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) {
+      return errno == EEXIST && Attach();
+    }
+    auto data = Build(data_dir_);
+    // Other processes only see the bundle once it is complete
+    reinterpret_cast<Header*>(data.data())->ready = 0;
+    void* mapped = MAP_FAILED;
+    if (ftruncate(fd, data.size()) == 0) {
+      mapped = mmap(nullptr, data.size(), PROT_READ | PROT_WRITE, MAP_SHARED,
+                    fd, 0);
+    }
+    close(fd);
+    if (mapped == MAP_FAILED) {
+      shm_unlink(name_.c_str());
+      return false;
+    }
+    std::memcpy(mapped, data.data(), data.size());
+    auto* header = static_cast<Header*>(mapped);
+    __atomic_store_n(&header->ready, 1, __ATOMIC_RELEASE);
+    mprotect(mapped, data.size(), PROT_READ);
+    UnlinkOtherVersions();
+    data_ = static_cast<const char*>(mapped);
+    size_ = data.size();
+    mapped_ = true;
+    return true;
+  }
+
+  template <typename T>
+  const Entry* Find(const std::string& file) const {
+    const auto* header = reinterpret_cast<const Header*>(data_);
+    const auto* entries =
+        reinterpret_cast<const Entry*>(data_ + sizeof(Header));
+    for (uint32_t i = 0; i < header->num_entries; i++) {
+      if (file == entries[i].file) {
+        if (entries[i].type != ElementType<T>()) {
+          Log::Fatal("InputBundle", file, " is stored with another type");
+        }
+        return &entries[i];
+      }
+    }
+    Log::Fatal("InputBundle", file, " is not part of the input bundle");
+    return nullptr;
+  }
+
+  std::string data_dir_;
+  uint64_t inputs_hash_;
+  std::string name_;
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+  bool mapped_ = false;
+  bool from_file_ = false;
+  // The bundle if it is not mapped
+  std::vector<char> buffer_;
+};
+
+}  // namespace bdm
+
+#endif  // INPUT_BUNDLE_H_
@@ -1,7 +1,12 @@
 #ifndef INTERVENTIONS_H_
 #define INTERVENTIONS_H_
 
+#include <algorithm>
+#include <array>
+
 #include "core/randomized_rm.h"
+#include "covid_environment.h"
+#include "model_facts.h"
 #include "sim_param.h"
 
 namespace bdm {
@@ -12,10 +17,10 @@ inline void MobilityReductionPhase2() {
       sim->GetResourceManager());
   auto* sparam = sim->GetParam()->Get<SimParam>();
   auto num_homeworkers =
-      sparam->phase_2_mobility_reduction * rm->GetNumAgents();
+      sparam->phase_2_mobility_reduction * GetTotalAgentWeight();
   std::cout << "Intervention: " << sparam->phase_2_mobility_reduction
             << "\% of working class start working from home" << std::endl;
-  uint32_t counter = 0;
+  uint64_t counter = 0;
   std::array<Demographic, 2> working_class = {kHigherAgeWorking,
                                               kMiddleAgeWorking};
   auto put_at_home = [&](Agent* agent) {
@@ -25,7 +30,7 @@ inline void MobilityReductionPhase2() {
                                  std::end(working_class), person->demography_);
       if (is_found != working_class.end()) {
         person->home_stay_ = true;
-        counter++;
+        counter += person->weight_;
       }
     }
   };
@@ -40,11 +45,11 @@ inline void MobilityReductionPhase3() {
   auto* sparam = sim->GetParam()->Get<SimParam>();
   // only add the difference between phase 1 and 2 to homeworking state
   auto num_homeworkers =
-      sparam->phase_3_mobility_reduction * rm->GetNumAgents() -
-      sparam->phase_2_mobility_reduction * rm->GetNumAgents();
+      sparam->phase_3_mobility_reduction * GetTotalAgentWeight() -
+      sparam->phase_2_mobility_reduction * GetTotalAgentWeight();
   std::cout << "Intervention: " << sparam->phase_3_mobility_reduction
             << "\% of working class start working from home" << std::endl;
-  uint32_t counter = 0;
+  uint64_t counter = 0;
   std::array<Demographic, 2> working_class = {kHigherAgeWorking,
                                               kMiddleAgeWorking};
   auto put_at_home = [&](Agent* agent) {
@@ -55,7 +60,7 @@ inline void MobilityReductionPhase3() {
       // don't put people that are already homestaying at home
       if (is_found != working_class.end() && !person->home_stay_) {
         person->home_stay_ = true;
-        counter++;
+        counter += person->weight_;
       }
     }
   };
@@ -85,15 +90,15 @@ inline void SchoolClosure() {
   rm->ForEachAgentParallel(put_at_home);
 
   auto homeschooling_parents =
-      sparam->phase_2_homeschooling_parents * rm->GetNumAgents();
-  uint32_t counter = 0;
+      sparam->phase_2_homeschooling_parents * GetTotalAgentWeight();
+  uint64_t counter = 0;
   auto put_at_home2 = [&](Agent* agent) {
     if (counter < homeschooling_parents) {
       auto* person = bdm_static_cast<Person*>(agent);
       // Check if person is not already homestaying (avoid double-counting
       // homestayers)
       if (person->demography_ == kMiddleAgeWorking && !person->home_stay_) {
-        counter++;
+        counter += person->weight_;
         person->home_stay_ = true;
       }
     }
@@ -102,22 +107,63 @@ inline void SchoolClosure() {
   rm->ForEachAgent(put_at_home2);
 }
 
+// The expected share of each demography that the interventions up to `phase`
+// (see MobilityReductionPhase2, SchoolClosure and MobilityReductionPhase3) put
+// at home, for a population with `population[d]` persons per demography. Used
+// by the models that do not have individual persons (see SolveAnalytical).
+inline std::array<real_t, kNumDemographies> HomeStayShares(
+    const SimParam* sparam, uint8_t phase,
+    const std::array<real_t, kNumDemographies>& population) {
+  std::array<real_t, kNumDemographies> shares{};
+  if (phase == 0) {
+    return shares;
+  }
+  real_t total = 0;
+  for (auto n : population) {
+    total += n;
+  }
+  // The persons at home per demography
+  std::array<real_t, kNumDemographies> home{};
+  for (auto d : {kPreSchoolChildren, kPrimarySchoolChildren,
+                 kSecondarySchoolChildren}) {
+    home[d] = population[d];
+  }
+  // Spreads `count` persons over the working demographies, in proportion to
+  // the persons of each that are not at home yet
+  auto put_workers_at_home = [&](real_t count) {
+    real_t left = 0;
+    for (auto d : {kHigherAgeWorking, kMiddleAgeWorking}) {
+      left += population[d] - home[d];
+    }
+    if (left <= 0) {
+      return;
+    }
+    count = std::min(count, left);
+    for (auto d : {kHigherAgeWorking, kMiddleAgeWorking}) {
+      home[d] += count * (population[d] - home[d]) / left;
+    }
+  };
+  put_workers_at_home(sparam->phase_2_mobility_reduction * total);
+  home[kMiddleAgeWorking] +=
+      std::min<real_t>(sparam->phase_2_homeschooling_parents * total,
+                       population[kMiddleAgeWorking] - home[kMiddleAgeWorking]);
+  if (phase >= 2) {
+    put_workers_at_home((sparam->phase_3_mobility_reduction -
+                         sparam->phase_2_mobility_reduction) *
+                        total);
+  }
+  for (size_t d = 0; d < kNumDemographies; d++) {
+    shares[d] = population[d] > 0 ? home[d] / population[d] : 0;
+  }
+  return shares;
+}
+
+// The mixing matrices of all phases are precomputed by the CovidEnvironment, so
+// adjusting them for a new phase only switches to the matching tensor
 inline void AdjustMixingMatrices(uint8_t phase) {
   auto* sim = Simulation::GetActive();
   auto* env = bdm_static_cast<CovidEnvironment*>(sim->GetEnvironment());
-  
-  std::string data_dir = GetDataDir();
-  std::string full_path;
-  if (phase < 2) {
-    full_path = Concat(data_dir, "/", "mixmat_phase2.csv");
-  } else {
-    full_path = Concat(data_dir, "/", "mixmat_phase4.csv");
-  }
-
-  std::array<std::array<real_t, kNumDemographies>, kNumDemographies> reduction_matrix;
-  CsvTo2DMatrix<real_t, kNumDemographies>(full_path, &reduction_matrix);
-
-  env->ApplyReduction(reduction_matrix);
+  env->SetPhase(phase);
 }
 
 }  // namespace bdm
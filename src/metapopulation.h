@@ -0,0 +1,254 @@
+#ifndef METAPOPULATION_H_
+#define METAPOPULATION_H_
+
+#include <stdint.h>
+#include <array>
+#include <cmath>
+#include <vector>
+
+#include "model_facts.h"
+
+namespace bdm {
+
+// A value per (municipality, demography)
+using MunicipalityGrid =
+    std::array<std::array<real_t, kNumDemographies>, kNumMunicipalities>;
+
+// Per situation and demography, the sum of the row of the mixing matrix
+// (see DemographicMixing)
+using ContactRates =
+    std::array<std::array<real_t, kNumDemographies>, kNumSituations>;
+
+// The persons of one (municipality, demography) that are not simulated as
+// agents, per disease state. Like the agent counts, these are in units of
+// agents (see GetAgentToPersonRatio).
+struct Compartments {
+  real_t susceptible = 0;
+  real_t exposed = 0;
+  real_t infectious = 0;
+  real_t recovered = 0;
+  // Persons that will be admitted to the hospital, but are not yet
+  real_t hospital_pending = 0;
+  real_t hospitalized = 0;
+
+  real_t Total() const {
+    return susceptible + exposed + infectious + recovered;
+  }
+};
+
+// The hourly transition rates of the compartmental model: the inverse of the
+// mean durations that the agent model draws from its distributions
+struct TransitionRates {
+  // Exposed -> infectious
+  real_t incubation = 0;
+  // Infectious -> recovered
+  real_t recovery = 0;
+  // Start of the infectious period -> admission to the hospital
+  real_t admission = 0;
+  // Admission -> discharge
+  real_t discharge = 0;
+};
+
+// Runs the municipalities that are not (yet) simulated with agents as a
+// deterministic SEIR model per demography (see SimParam::hybrid_metapopulation).
+// Both representations see each other through the infected fractions per
+// (location, demography): the compartments add their expected presence to
+// them (see AddPresence), and are infected by them according to where their
+// residents spend the day. Once a municipality has enough infectious persons,
+// it is handed over to the agent model (see ActivateMunicipality).
+class Metapopulation {
+ public:
+  // A municipality where residents spend their away hours, and the share of
+  // the away hours spent there
+  struct Destination {
+    uint16_t location;
+    real_t share;
+  };
+
+  Metapopulation()
+      : cells_(kNumMunicipalities),
+        members_(kNumMunicipalities),
+        active_(kNumMunicipalities, false),
+        mobility_(kNumMunicipalities * kNumDemographies) {
+    home_stay_.fill(0);
+  }
+
+  // Builds where the residents of each (municipality, demography) spend their
+  // away hours: the mean of the Dirichlet distribution that the travel
+  // schedules of the agents are drawn from (see MobilityData::DrawDirichlet).
+  // Destinations with a share below `cutoff` are dropped and the others are
+  // scaled up accordingly, which keeps the coupling between the municipalities
+  // sparse.
+  template <typename Matrix>
+  void SetMobility(const Matrix& m_freq, const Matrix& m_inc, real_t cutoff) {
+    for (uint16_t m = 0; m < kNumMunicipalities; m++) {
+      for (uint8_t d = 0; d < kNumDemographies; d++) {
+        const auto& row = kDemographyToTravelType[d] == TravelerType::kFrequent
+                              ? m_freq[m]
+                              : m_inc[m];
+        std::vector<real_t> alphas(row.begin(), row.end());
+        alphas[m] *= kDemographyHomeStayScaling[d];
+        real_t sum = 0;
+        for (auto a : alphas) {
+          sum += a;
+        }
+        auto& destinations = mobility_[m * kNumDemographies + d];
+        destinations.clear();
+        real_t kept = 0;
+        for (uint16_t j = 0; j < alphas.size(); j++) {
+          if (sum > 0 && alphas[j] / sum >= cutoff) {
+            destinations.push_back({j, alphas[j] / sum});
+            kept += alphas[j] / sum;
+          }
+        }
+        if (destinations.empty()) {
+          destinations.push_back({m, 1});
+          kept = 1;
+        }
+        for (auto& dest : destinations) {
+          dest.share /= kept;
+        }
+      }
+    }
+  }
+
+  const std::vector<Destination>& GetDestinations(uint16_t m, uint8_t d) const {
+    return mobility_[m * kNumDemographies + d];
+  }
+
+  void SetRates(const TransitionRates& rates) { rates_ = rates; }
+
+  // The fraction of each demography that stays at home during the day (see
+  // the interventions)
+  void SetHomeStay(const std::array<real_t, kNumDemographies>& home_stay) {
+    home_stay_ = home_stay;
+  }
+
+  // Adds the susceptible person `index` of demography `d` to municipality `m`
+  void AddMember(uint16_t m, uint8_t d, size_t index) {
+    cells_[m][d].susceptible++;
+    members_[m].push_back(index);
+  }
+
+  // The persons of municipality `m` that were added with AddMember
+  const std::vector<size_t>& GetMembers(uint16_t m) const {
+    return members_[m];
+  }
+
+  Compartments& GetCompartments(uint16_t m, uint8_t d) { return cells_[m][d]; }
+  const Compartments& GetCompartments(uint16_t m, uint8_t d) const {
+    return cells_[m][d];
+  }
+
+  bool IsActive(uint16_t m) const { return active_[m]; }
+
+  // Marks municipality `m` as simulated by the agent model, and removes its
+  // compartments and members
+  void SetActive(uint16_t m) {
+    active_[m] = true;
+    cells_[m].fill(Compartments());
+    members_[m].clear();
+    members_[m].shrink_to_fit();
+  }
+
+  real_t GetInfectious(uint16_t m) const {
+    real_t infectious = 0;
+    for (const auto& cell : cells_[m]) {
+      infectious += cell.infectious;
+    }
+    return infectious;
+  }
+
+  // Advances all municipalities that are not active by the hour
+  // `hour_of_day`. `fractions` are the infected fractions per (location,
+  // demography) and `contacts` the contact rates of the active phase.
+  void Step(uint8_t hour_of_day, real_t beta, const ContactRates& contacts,
+            const MunicipalityGrid& fractions) {
+    auto sleep_weight = kDailySleepPattern[hour_of_day];
+    bool daytime = HourToRegime(hour_of_day) == HourRegime::kDaytime;
+    auto to_infectious = -std::expm1(-rates_.incubation);
+    auto to_recovered = -std::expm1(-rates_.recovery);
+    auto admitted = -std::expm1(-rates_.admission);
+    auto discharged = -std::expm1(-rates_.discharge);
+
+#pragma omp parallel for
+    for (uint16_t m = 0; m < kNumMunicipalities; m++) {
+      if (active_[m]) {
+        continue;
+      }
+      for (uint8_t d = 0; d < kNumDemographies; d++) {
+        auto& c = cells_[m][d];
+        // The same force of infection as in DemographicMixing, averaged over
+        // the locations and situations of the residents
+        real_t mix = contacts[kHome][d] * fractions[m][d];
+        if (daytime) {
+          real_t away = 0;
+          for (const auto& dest : GetDestinations(m, d)) {
+            auto situation = dest.location == m ? kDayTimeMixingHome[d]
+                                                : kDayTimeMixingOther[d];
+            away += dest.share * contacts[situation][d] *
+                    fractions[dest.location][d];
+          }
+          mix = home_stay_[d] * mix + (1 - home_stay_[d]) * away;
+        }
+        auto lambda = kSusceptibility[d] * beta * sleep_weight * mix;
+
+        auto new_exposed = c.susceptible * -std::expm1(-lambda);
+        auto new_infectious = c.exposed * to_infectious;
+        auto new_recovered = c.infectious * to_recovered;
+        auto new_admitted = c.hospital_pending * admitted;
+        auto new_discharged = c.hospitalized * discharged;
+        c.susceptible -= new_exposed;
+        c.exposed += new_exposed - new_infectious;
+        c.infectious += new_infectious - new_recovered;
+        c.recovered += new_recovered;
+        c.hospital_pending +=
+            kHospitalizationPerDemography[d] * new_infectious - new_admitted;
+        c.hospitalized += new_admitted - new_discharged;
+      }
+    }
+  }
+
+  // Adds the persons of the inactive municipalities, at their location during
+  // an hour of `regime`, to `total` and `infectious` per (location,
+  // demography)
+  void AddPresence(HourRegime regime, MunicipalityGrid* total,
+                   MunicipalityGrid* infectious) const {
+    for (uint16_t m = 0; m < kNumMunicipalities; m++) {
+      if (active_[m]) {
+        continue;
+      }
+      for (uint8_t d = 0; d < kNumDemographies; d++) {
+        const auto& c = cells_[m][d];
+        auto n = c.Total();
+        if (n == 0) {
+          continue;
+        }
+        if (regime != HourRegime::kDaytime) {
+          (*total)[m][d] += n;
+          (*infectious)[m][d] += c.infectious;
+          continue;
+        }
+        (*total)[m][d] += home_stay_[d] * n;
+        (*infectious)[m][d] += home_stay_[d] * c.infectious;
+        for (const auto& dest : GetDestinations(m, d)) {
+          auto away = (1 - home_stay_[d]) * dest.share;
+          (*total)[dest.location][d] += away * n;
+          (*infectious)[dest.location][d] += away * c.infectious;
+        }
+      }
+    }
+  }
+
+ private:
+  std::vector<std::array<Compartments, kNumDemographies>> cells_;
+  std::vector<std::vector<size_t>> members_;
+  std::vector<bool> active_;
+  std::vector<std::vector<Destination>> mobility_;
+  std::array<real_t, kNumDemographies> home_stay_;
+  TransitionRates rates_;
+};
+
+}  // namespace bdm
+
+#endif  // METAPOPULATION_H_
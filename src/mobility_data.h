@@ -9,15 +9,19 @@
 
 #include "omp.h"
 
+#include "input_bundle.h"
 #include "person.h"
 
 namespace bdm {
 
+// The mobility data of one simulation (see CovidEnvironment::GetMobilityData),
+// and a random number generator per thread for the Dirichlet draws
 class MobilityData {
  public:
   std::vector<uint32_t> municipality_population_;
-  std::vector<std::vector<float>> m_freq_;
-  std::vector<std::vector<float>> m_inc_;
+  // Mapped from the InputBundle
+  MatrixView<float> m_freq_;
+  MatrixView<float> m_inc_;
   std::vector<uint32_t> municipality_codes_;
 
   void DrawDirichlet(Person* person, std::vector<uint16_t>* other_locations);
@@ -25,29 +29,28 @@ class MobilityData {
   // Allocate random number generator
   std::vector<gsl_rng*> r_RNG;
 
-  static MobilityData* GetInstance() {
-    static MobilityData kMobility;
-    return &kMobility;
-  }
-
- private:
-  MobilityData() {
+  // The generator of thread `i` is seeded with `seed + i`
+  explicit MobilityData(uint64_t seed = 0) {
     r_RNG.resize(omp_get_max_threads());
-    for (auto& r : r_RNG) {
-      r = gsl_rng_alloc(gsl_rng_mt19937);
+    for (size_t i = 0; i < r_RNG.size(); i++) {
+      r_RNG[i] = gsl_rng_alloc(gsl_rng_mt19937);
+      gsl_rng_set(r_RNG[i], seed + i);
     }
-  };
+  }
 
   ~MobilityData() {
     for (auto& r : r_RNG) {
-      delete(r);
+      gsl_rng_free(r);
     }
   }
+
+  MobilityData(const MobilityData&) = delete;
+  MobilityData& operator=(const MobilityData&) = delete;
 };
 
 inline void MobilityData::DrawDirichlet(
     Person* person, std::vector<uint16_t>* other_locations) {
-  auto mobility_data = MobilityData::GetInstance();
+  auto* mobility_data = this;
   auto hours_not_home = other_locations->size();
   std::vector<double> alphas;
   // Based on the traveling type a person is, we assign different mobility data
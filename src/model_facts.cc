@@ -1,4 +1,5 @@
 #include "model_facts.h"
+#include "covid_environment.h"
 #include "person.h"
 #include "sim_param.h"
 
@@ -9,7 +10,7 @@ real_t bdm::GetAgentToPersonRatio() {
   if (sim->GetParam()->Get<SimParam>()->custom_agent_to_person_ratio != 0) {
     return sim->GetParam()->Get<SimParam>()->custom_agent_to_person_ratio;
   }
-  auto num_agents = sim->GetResourceManager()->GetNumAgents();
+  auto num_agents = GetTotalAgentWeight();
   auto num_persons = kTotalPopulationSize;
   if (num_agents == num_persons) {
     return 1;
@@ -17,6 +18,25 @@ real_t bdm::GetAgentToPersonRatio() {
   return static_cast<real_t>(num_persons) / num_agents;
 }
 
+uint64_t bdm::GetTotalAgentWeight() {
+  auto* sim = Simulation::GetActive();
+  auto* env = dynamic_cast<CovidEnvironment*>(sim->GetEnvironment());
+  if (env != nullptr && env->GetTotalWeight() != 0) {
+    return env->GetTotalWeight();
+  }
+  return sim->GetResourceManager()->GetNumAgents();
+}
+
+uint32_t bdm::GetStepHours() {
+  auto* sim = Simulation::GetActive();
+  return sim->GetParam()->Get<SimParam>()->step_hours;
+}
+
+uint64_t bdm::GetSimulatedHours() {
+  auto* sim = Simulation::GetActive();
+  return sim->GetScheduler()->GetSimulatedSteps() * GetStepHours();
+}
+
 void PrintStateDistribution() {
   std::array<int, 4> states{};
   Simulation::GetActive()->GetResourceManager()->ForEachAgent([&](Agent* a) {
@@ -27,11 +27,22 @@ static const uint16_t kNumDemographies = 11u;
 static const uint16_t kNumMunicipalities = 380u;
 static const uint16_t kHoursPerDay = 24u;
 static const uint16_t kDaysPerWeek = 7u;
+static const uint16_t kNumSituations = 5u;
+static const uint8_t kNumPhases = 4u;
 static const uint64_t kTotalPopulationSize = 17181084;
 
-// Returns how many persons one agent represents
+// Returns how many persons one agent (of weight one) represents
 real_t GetAgentToPersonRatio();
 
+// Returns the summed weight of all agents (see Person::weight_)
+uint64_t GetTotalAgentWeight();
+
+// Returns how many hours one timestep represents (see SimParam::step_hours)
+uint32_t GetStepHours();
+
+// Returns the number of hours simulated so far
+uint64_t GetSimulatedHours();
+
 void PrintStatesDistribution();
 
 enum Demographic {
@@ -69,8 +80,6 @@ enum State { kSusceptible, kExposed, kInfectious, kRecovered };
 static std::array<std::string, kNumDemographies> StateToString = {
     "susceptible", "exposed", "infectious", "recovered"};
 
-static uint8_t kActivePhase = 0;
-
 const static std::array<TravelerType, kNumDemographies>
     kDemographyToTravelType = {kIncidental, kFrequent,   kFrequent,   kFrequent,
                                kIncidental, kFrequent,   kIncidental, kFrequent,
@@ -106,20 +115,61 @@ static const std::array<std::pair<uint8_t, uint8_t>, kNumDemographies>
         make_pair(25, 54), make_pair(55, 67), make_pair(55, 67),
         make_pair(68, 80), make_pair(80, 110)};
 
-// Weights indicating at which hours a person is likely to be awake during a day
-static MathArray<real_t, kHoursPerDay> kAwake = {
-    0, 0, 0, 0, 0, 0, 0.25, 0.5, 0.75, 1,   1,   1,
-    1, 1, 1, 1, 1, 1, 1,    0.8, 0.6,  0.4, 0.2, 0};
+// Returns the sum of all elements of `a`
+template <typename T, size_t N>
+constexpr T ArraySum(const std::array<T, N>& a) {
+  T sum = 0;
+  for (size_t i = 0; i < N; i++) {
+    sum += a[i];
+  }
+  return sum;
+}
 
-static const MathArray<real_t, kHoursPerDay> kDailySleepPattern =
-    kAwake / kAwake.Sum();
+template <typename T, size_t N, size_t... I>
+constexpr std::array<T, N> NormalizeArray(const std::array<T, N>& a, T total,
+                                          std::index_sequence<I...>) {
+  return {{(a[I] / ArraySum(a) * total)...}};
+}
+
+// Returns `a` scaled such that its elements sum up to `total`
+template <typename T, size_t N>
+constexpr std::array<T, N> NormalizeArray(const std::array<T, N>& a,
+                                          T total = 1) {
+  return NormalizeArray(a, total, std::make_index_sequence<N>());
+}
 
-static MathArray<float, kNumDemographies> kAbsoluteSusceptibility = {
-    1.0, 2.0, 3.051, 5.751, 5.751, 3.6, 3.6, 5.0, 5.0, 5.3, 7.2};
+// Weights indicating at which hours a person is likely to be awake during a day
+constexpr std::array<real_t, kHoursPerDay> kAwake = {
+    {0, 0, 0, 0, 0, 0, 0.25, 0.5, 0.75, 1,   1,   1,
+     1, 1, 1, 1, 1, 1, 1,    0.8, 0.6,  0.4, 0.2, 0}};
+
+constexpr std::array<real_t, kHoursPerDay> kDailySleepPattern =
+    NormalizeArray(kAwake);
+
+constexpr std::array<float, kNumDemographies> kAbsoluteSusceptibility = {
+    {1.0, 2.0, 3.051, 5.751, 5.751, 3.6, 3.6, 5.0, 5.0, 5.3, 7.2}};
+
+constexpr std::array<float, kNumDemographies> kSusceptibility =
+    NormalizeArray(kAbsoluteSusceptibility,
+                   static_cast<float>(kNumDemographies));
+
+// The parts of the model that are active during an hour of the day
+enum class HourRegime : uint8_t {
+  // Nobody is awake, so there is no transmission. Night-time situations.
+  kAsleep,
+  // Awake outside of office hours (before 09:00 or after 17:00). Night-time
+  // situations.
+  kOffHours,
+  // Office hours (09:00 - 17:00). Day-time situations.
+  kDaytime
+};
 
-static const MathArray<float, kNumDemographies> kSusceptibility =
-    (kAbsoluteSusceptibility / kAbsoluteSusceptibility.Sum()) *
-    kNumDemographies;
+constexpr HourRegime HourToRegime(uint8_t hour_of_day) {
+  return kAwake[hour_of_day] == 0
+             ? HourRegime::kAsleep
+             : (hour_of_day < 9 || hour_of_day > 17 ? HourRegime::kOffHours
+                                                    : HourRegime::kDaytime);
+}
 
 }  // namespace bdm
 
@@ -0,0 +1,214 @@
+#ifndef MULTI_FIDELITY_H_
+#define MULTI_FIDELITY_H_
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#include "biodynamo.h"
+#include "core/multi_simulation/optimization_param.h"
+
+#include <json.hpp>
+
+#include "calibration.h"
+#include "cbs-covid.h"
+#include "data_processing_helpers.h"
+#include "repetition_aggregator.h"
+#include "model_facts.h"
+#include "sim_param.h"
+#include "surrogate.h"
+
+namespace bdm {
+
+// One candidate parameter set of the multi-fidelity calibration
+struct FidelityCandidate {
+  // JSON patch that applies the values of this candidate to the parameters
+  nlohmann::json patch;
+  // The error at the last rung this candidate was evaluated at
+  real_t mse = std::numeric_limits<real_t>::infinity();
+  // The error at the rung before, for the resolution bias
+  real_t previous_mse = std::numeric_limits<real_t>::infinity();
+};
+
+// Enumerates all combinations of the values of the optimization parameters,
+// except `population_size`, which defines the fidelity instead
+inline std::vector<FidelityCandidate> EnumerateCandidates(
+    const OptimizationParam* opt_param) {
+  std::vector<FidelityCandidate> candidates(1);
+  for (auto* opt : opt_param->params) {
+    if (opt->GetParamName() == "population_size") {
+      continue;
+    }
+    std::vector<FidelityCandidate> combined;
+    for (auto& candidate : candidates) {
+      for (uint32_t n = 0; n < opt->GetNumElements(); n++) {
+        auto next = candidate;
+        next.patch[opt->GetGroupName()][opt->GetParamName()] = opt->GetValue(n);
+        combined.push_back(next);
+      }
+    }
+    candidates = std::move(combined);
+  }
+  return candidates;
+}
+
+// The population size of the final rung: the largest value of the
+// `population_size` optimization parameter if there is one, otherwise
+// SimParam::population_size
+inline uint64_t GetFullPopulationSize(const Param* param) {
+  uint64_t full = param->Get<SimParam>()->population_size;
+  for (auto* opt : param->Get<OptimizationParam>()->params) {
+    if (opt->GetParamName() == "population_size") {
+      full = 0;
+      for (uint32_t n = 0; n < opt->GetNumElements(); n++) {
+        full = std::max(full, static_cast<uint64_t>(opt->GetValue(n)));
+      }
+    }
+  }
+  return full;
+}
+
+// Calibrates with successive halving over the population resolution. All
+// candidates (see EnumerateCandidates) are evaluated at the lowest population
+// size; only the best 1 / `fidelity_eta` of them are promoted to the next
+// rung, whose population size is `fidelity_eta` times larger, up to the full
+// population size at the last rung. Returns the error of the best candidate at
+// full fidelity.
+inline real_t MultiFidelityCalibration(int argc, const char** argv,
+                                       const Param* param,
+                                       const std::string& output_dir) {
+  auto* sparam = param->Get<SimParam>();
+  auto* opt_param = param->Get<OptimizationParam>();
+  auto eta = std::max(sparam->fidelity_eta, real_t(1));
+  auto rungs = std::max(sparam->fidelity_rungs, 1u);
+  auto full_population = GetFullPopulationSize(param);
+  auto candidates = EnumerateCandidates(opt_param);
+
+  // Start with the candidates that the surrogate predicts to be best, and drop
+  // those that it is confident about to be bad (see Surrogate::ShouldSkip)
+  auto* surrogate = GetSurrogate(param);
+  if (surrogate != nullptr && surrogate->GetNumSamples() != 0) {
+    for (auto& candidate : candidates) {
+      Param candidate_param(*param);
+      candidate_param.MergeJsonPatch(candidate.patch.dump());
+      auto x = surrogate->Features(
+          nlohmann::json::parse(candidate_param.ToJsonString()));
+      real_t lower_bound = 0;
+      surrogate->Predict(x, sparam->surrogate_confidence, &candidate.mse,
+                         &lower_bound);
+      if (surrogate->ShouldSkip(x, sparam)) {
+        candidate.mse = std::numeric_limits<real_t>::infinity();
+      }
+    }
+    std::sort(candidates.begin(), candidates.end(),
+              [](const FidelityCandidate& a, const FidelityCandidate& b) {
+                return a.mse < b.mse;
+              });
+    auto proposed = std::find_if(
+        candidates.begin() + 1, candidates.end(),
+        [](const FidelityCandidate& c) { return !std::isfinite(c.mse); });
+    std::cout << "The surrogate skips " << candidates.end() - proposed << " of "
+              << candidates.size() << " candidates" << std::endl;
+    candidates.erase(proposed, candidates.end());
+    for (auto& candidate : candidates) {
+      candidate.mse = std::numeric_limits<real_t>::infinity();
+    }
+  }
+
+  TimeSeries observed;
+  ImportObservedData(&observed);
+
+  auto simulate = [&](Param* param, TimeSeries* result) {
+    Simulate(argc, argv, result, param);
+  };
+  auto compute_error = [&](const TimeSeries& observed,
+                           const TimeSeries& simulated) {
+    auto err = ComputeError(observed, simulated);
+    ReportCalibrationError(err);
+    return err;
+  };
+  // The agent to person ratio of the last run (see GetAgentToPersonRatio)
+  real_t resolution = 0;
+  auto export_results = [&](const RepetitionAggregator& aggregate,
+                            const Param& param, real_t err) {
+    resolution = aggregate.GetMetadata().GetYValues("resolution")[0];
+    ExportResults(aggregate, param, err, output_dir);
+  };
+
+  // The candidates are only ranked by their error, so their runs stop at the
+  // calibration horizon and are aborted once they are worse than the best one
+  nlohmann::json calibration;
+  calibration["bdm::SimParam"]["calibration_horizon"] = true;
+  calibration["bdm::SimParam"]["abort_best_mse_factor"] =
+      sparam->abort_best_mse_factor > 0 ? sparam->abort_best_mse_factor : 1;
+  Param calibration_param(*param);
+  calibration_param.MergeJsonPatch(calibration.dump());
+
+  uint64_t runs = 0;
+  for (uint32_t rung = 0; rung < rungs; rung++) {
+    auto population_size = static_cast<uint64_t>(
+        full_population / std::pow(eta, rungs - 1 - rung));
+    population_size = std::max(population_size, uint64_t(1));
+    // The errors of different resolutions are not comparable, so runs must not
+    // be aborted against the best error of a lower rung
+    *GetBestCalibrationError() = std::numeric_limits<real_t>::infinity();
+
+    for (auto& candidate : candidates) {
+      Param candidate_param(calibration_param);
+      auto patch = candidate.patch;
+      patch["bdm::SimParam"]["population_size"] = population_size;
+      candidate_param.MergeJsonPatch(patch.dump());
+      candidate.previous_mse = candidate.mse;
+      auto aggregate = MakeRepetitionAggregator(sparam, &observed);
+      candidate.mse = StreamingExperiment(
+          simulate, opt_param->repetition, candidate_param, &aggregate,
+          observed, compute_error, export_results);
+      runs++;
+    }
+    std::sort(candidates.begin(), candidates.end(),
+              [](const FidelityCandidate& a, const FidelityCandidate& b) {
+                return a.mse < b.mse;
+              });
+
+    std::cout << "Rung " << rung << ": population size " << population_size
+              << ", agent to person ratio " << resolution << ", "
+              << candidates.size() << " candidates, best MSE "
+              << candidates[0].mse << std::endl;
+    // The resolution bias: how much the error of the same candidates changed
+    // compared to the previous (lower) resolution
+    if (rung > 0) {
+      real_t bias = 0;
+      size_t n = 0;
+      for (auto& candidate : candidates) {
+        if (std::isfinite(candidate.mse) &&
+            std::isfinite(candidate.previous_mse)) {
+          bias += candidate.mse - candidate.previous_mse;
+          n++;
+        }
+      }
+      if (n != 0) {
+        Log::Info("MultiFidelityCalibration", "Mean change of the MSE at "
+                  "agent to person ratio ", resolution, ": ", bias / n,
+                  " (over ", n, " candidates)");
+      }
+    }
+
+    if (rung + 1 < rungs) {
+      auto promoted = static_cast<size_t>(std::ceil(candidates.size() / eta));
+      candidates.resize(std::max(promoted, size_t(1)));
+    }
+  }
+
+  std::cout << "Best candidate: " << candidates[0].patch.dump() << std::endl;
+  std::cout << "Full fidelity MSE " << candidates[0].mse << " after " << runs
+            << " evaluations" << std::endl;
+  return candidates[0].mse;
+}
+
+}  // namespace bdm
+
+#endif  // MULTI_FIDELITY_H_
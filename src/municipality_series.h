@@ -0,0 +1,162 @@
+#ifndef MUNICIPALITY_SERIES_H_
+#define MUNICIPALITY_SERIES_H_
+
+#include <unistd.h>
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef CBS_COVID_HAS_ZLIB
+#include <zlib.h>
+#endif  // CBS_COVID_HAS_ZLIB
+
+#include "core/util/log.h"
+#include "core/util/string.h"
+
+#include "model_facts.h"
+
+namespace bdm {
+
+// The start of a file of MunicipalitySeriesWriter. All numbers are stored in
+// the byte order of the machine that wrote them.
+struct MunicipalitySeriesHeader {
+  char magic[4] = {'C', 'B', 'S', 'M'};
+  uint32_t version = 1;
+  uint32_t num_municipalities = kNumMunicipalities;
+  // The hours between two records (see
+  // SimParam::export_infected_per_timestep_frequency)
+  uint32_t frequency = 0;
+};
+
+// One record per exported hour: the infectious persons per home municipality
+// and the persons per (current) location
+struct MunicipalitySeriesRecord {
+  uint32_t hour;
+  std::array<float, kNumMunicipalities> infected;
+  std::array<float, kNumMunicipalities> located;
+};
+
+// The file of the run `run` of the process `pid` below `dir`
+inline std::string MunicipalitySeriesFile(const std::string& dir, int pid,
+                                          uint64_t run, bool compress) {
+  return Concat(dir, "/", pid, "_run", run, compress ? ".bin.gz" : ".bin");
+}
+
+// Streams the per-municipality statistics of a run to a file of fixed-width
+// records (see MunicipalitySeriesRecord), such that the memory does not grow
+// with the number of simulated hours. The records are appended in batches,
+// and the file is only open while a batch is written. Compressed files are
+// written as consecutive gzip members, which gzip readers concatenate.
+class MunicipalitySeriesWriter {
+ public:
+  // The number of records that are kept in memory before they are written
+  static constexpr size_t kBatchSize = 64;
+
+  MunicipalitySeriesWriter(const std::string& path, uint32_t frequency,
+                           bool compress)
+      : path_(path), compress_(compress) {
+#ifndef CBS_COVID_HAS_ZLIB
+    if (compress_) {
+      Log::Warning("MunicipalitySeriesWriter",
+                   "Built without zlib, writing ", path_, " uncompressed");
+      compress_ = false;
+    }
+#endif  // CBS_COVID_HAS_ZLIB
+    MunicipalitySeriesHeader header;
+    header.frequency = frequency;
+    pending_.resize(sizeof(header));
+    std::memcpy(pending_.data(), &header, sizeof(header));
+    Write("wb");
+  }
+
+  const std::string& GetPath() const { return path_; }
+
+  template <typename Counts>
+  void Append(uint32_t hour, const Counts& infected, const Counts& located) {
+    MunicipalitySeriesRecord record;
+    record.hour = hour;
+    for (size_t m = 0; m < kNumMunicipalities; m++) {
+      record.infected[m] = static_cast<float>(infected[m]);
+      record.located[m] = static_cast<float>(located[m]);
+    }
+    auto* bytes = reinterpret_cast<const char*>(&record);
+    pending_.insert(pending_.end(), bytes, bytes + sizeof(record));
+    if (pending_.size() >= kBatchSize * sizeof(record)) {
+      Flush();
+    }
+  }
+
+  // Writes the pending records
+  void Flush() {
+    if (!pending_.empty()) {
+      Write("ab");
+    }
+  }
+
+  // Continues the series in a copy of the records so far at `path`, e.g. in a
+  // branch forked from this run (see ForkBranches)
+  void Branch(const std::string& path) {
+    if (path == path_) {
+      return;
+    }
+    std::FILE* in = std::fopen(path_.c_str(), "rb");
+    std::FILE* out = std::fopen(path.c_str(), "wb");
+    bool copied = in != nullptr && out != nullptr;
+    char buffer[1 << 16];
+    size_t read = 0;
+    while (copied && (read = std::fread(buffer, 1, sizeof(buffer), in)) > 0) {
+      copied = std::fwrite(buffer, 1, read, out) == read;
+    }
+    if (in != nullptr) {
+      std::fclose(in);
+    }
+    if (out == nullptr || std::fclose(out) != 0 || !copied) {
+      Log::Fatal("MunicipalitySeriesWriter", "Could not copy ", path_,
+                 " to ", path);
+    }
+    path_ = path;
+  }
+
+  // Removes the file, e.g. of a run that only forked branches
+  void Discard() {
+    pending_.clear();
+    std::remove(path_.c_str());
+  }
+
+ private:
+  void Write(const char* mode) {
+    bool written = false;
+#ifdef CBS_COVID_HAS_ZLIB
+    if (compress_) {
+      gzFile file = gzopen(path_.c_str(), mode);
+      if (file != nullptr) {
+        written = gzwrite(file, pending_.data(), pending_.size()) ==
+                  static_cast<int>(pending_.size());
+        written = gzclose(file) == Z_OK && written;
+      }
+    }
+#endif  // CBS_COVID_HAS_ZLIB
+    if (!compress_) {
+      std::FILE* file = std::fopen(path_.c_str(), mode);
+      if (file != nullptr) {
+        written = std::fwrite(pending_.data(), 1, pending_.size(), file) ==
+                  pending_.size();
+        written = std::fclose(file) == 0 && written;
+      }
+    }
+    if (!written) {
+      Log::Fatal("MunicipalitySeriesWriter", "Could not write ", path_);
+    }
+    pending_.clear();
+  }
+
+  std::string path_;
+  bool compress_;
+  std::vector<char> pending_;
+};
+
+}  // namespace bdm
+
+#endif  // MUNICIPALITY_SERIES_H_
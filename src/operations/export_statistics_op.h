@@ -20,7 +20,7 @@ inline real_t CountInteractions(Person* person) {
   auto* env = bdm_static_cast<CovidEnvironment*>(sim->GetEnvironment());
 
   auto demography = person->demography_;
-  const auto mix_mat = env->GetMixingMatrix(person->situation_);
+  const auto& mix_mat = env->GetMixingMatrix(person->situation_);
 
   // fetch contact matrix
   for (auto other_demo = 0; other_demo < kNumDemographies; other_demo++) {
@@ -0,0 +1,9 @@
+#include "core/operation/operation.h"
+
+#include "operations/hourly_kernel_op.h"
+
+namespace bdm {
+
+BDM_REGISTER_OP(HourlyKernelOp, "hourly kernel", kCpu);
+
+}  // namespace bdm
@@ -0,0 +1,153 @@
+#ifndef HOURLY_KERNEL_OP_H_
+#define HOURLY_KERNEL_OP_H_
+
+#include <array>
+
+#include "core/operation/operation.h"
+#include "core/operation/operation_registry.h"
+#include "core/simulation.h"
+
+#include "behaviors/change_situation_behavior.h"
+#include "behaviors/infection_behavior.h"
+#include "behaviors/travel_behavior.h"
+#include "covid_environment.h"
+#include "model_facts.h"
+#include "person.h"
+#include "step_context.h"
+
+namespace bdm {
+
+// Runs the behaviors of a person for one hour, in the order in which
+// `CreatePerson` adds them. Every combination of phase and hour regime is a
+// separate instantiation, from which the branches that cannot be taken in that
+// combination are removed at compile time.
+template <uint8_t kPhase, HourRegime kRegime>
+inline void HourlyKernel(Person* person, const StepContext& ctx) {
+  // Nobody stays at home before the first intervention
+  constexpr bool kHomeStay = kPhase > 0;
+  constexpr bool kTransmission = kRegime != HourRegime::kAsleep;
+  ChangeSituationBehavior::Update<kRegime, kHomeStay>(person);
+  TravelBehavior::Update<kHomeStay>(person, ctx.hour_of_week);
+  person->GetInfectionBehavior()->Update<kTransmission>(person, ctx);
+  if (!person->lanes_.empty()) {
+    InfectionBehavior::UpdateLanes<kTransmission>(person, ctx);
+  }
+}
+
+// Runs the behaviors of a person for one timestep of `ctx.step_hours` hours
+// (see SimParam::step_hours). Situation and location follow the hourly
+// schedules; the demographic mixing is only recomputed when one of them
+// changes.
+template <uint8_t kPhase>
+inline void CoarseKernel(Person* person, const StepContext& ctx) {
+  constexpr bool kHomeStay = kPhase > 0;
+  const uint16_t hours_per_week = kHoursPerDay * kDaysPerWeek;
+  bool susceptible = person->state_ == State::kSusceptible;
+  std::array<real_t, kHoursPerDay> exposure;
+  bool has_mix = false;
+  float mix = 0;
+  for (uint32_t h = 0; h < ctx.step_hours; h++) {
+    auto hour_of_day = (ctx.hour_of_day + h) % kHoursPerDay;
+    auto situation = person->situation_;
+    auto location = person->location_;
+    ChangeSituationBehavior::UpdateInRegime<kHomeStay>(
+        person, HourToRegime(hour_of_day));
+    TravelBehavior::Update<kHomeStay>(person,
+                                      (ctx.hour_of_week + h) % hours_per_week);
+    if (!susceptible) {
+      continue;
+    }
+    if (situation != person->situation_ || location != person->location_) {
+      has_mix = false;
+    }
+    auto sleep_weight = kDailySleepPattern[hour_of_day];
+    if (sleep_weight == 0) {
+      exposure[h] = 0;
+      continue;
+    }
+    if (!has_mix) {
+      mix = DemographicMixing(person, ctx);
+      has_mix = true;
+    }
+    exposure[h] = sleep_weight * mix;
+  }
+  person->GetInfectionBehavior()->UpdateStep(person, ctx, exposure.data());
+}
+
+// Used for the timesteps that were already fast-forwarded
+inline void SkipHourlyKernel(Person* person, const StepContext& ctx) {}
+
+using HourlyKernelFn = void (*)(Person*, const StepContext&);
+
+inline HourlyKernelFn SelectHourlyKernel(uint8_t phase, HourRegime regime) {
+  static const HourlyKernelFn kKernels[kNumPhases][3] = {
+      {HourlyKernel<0, HourRegime::kAsleep>,
+       HourlyKernel<0, HourRegime::kOffHours>,
+       HourlyKernel<0, HourRegime::kDaytime>},
+      {HourlyKernel<1, HourRegime::kAsleep>,
+       HourlyKernel<1, HourRegime::kOffHours>,
+       HourlyKernel<1, HourRegime::kDaytime>},
+      {HourlyKernel<2, HourRegime::kAsleep>,
+       HourlyKernel<2, HourRegime::kOffHours>,
+       HourlyKernel<2, HourRegime::kDaytime>},
+      {HourlyKernel<3, HourRegime::kAsleep>,
+       HourlyKernel<3, HourRegime::kOffHours>,
+       HourlyKernel<3, HourRegime::kDaytime>}};
+  return kKernels[phase][static_cast<uint8_t>(regime)];
+}
+
+inline HourlyKernelFn SelectCoarseKernel(uint8_t phase) {
+  static const HourlyKernelFn kKernels[kNumPhases] = {
+      CoarseKernel<0>, CoarseKernel<1>, CoarseKernel<2>, CoarseKernel<3>};
+  return kKernels[phase];
+}
+
+// Replaces the generic "behavior" operation for persons. The kernel for the
+// current phase and hour regime is selected once per timestep, instead of
+// branching on them per agent.
+class HourlyKernelOp : public AgentOperationImpl {
+ public:
+  BDM_OP_HEADER(HourlyKernelOp);
+
+  void SetUp() override {
+    auto* sim = Simulation::GetActive();
+    auto* env = bdm_static_cast<CovidEnvironment*>(sim->GetEnvironment());
+    ctx_ = &env->GetStepContext();
+    if (ctx_->fast_forward) {
+      kernel_ = SkipHourlyKernel;
+      skipped_hours_ += ctx_->step_hours;
+      return;
+    } else if (ctx_->step_hours > 1) {
+      kernel_ = SelectCoarseKernel(ctx_->phase);
+    } else {
+      kernel_ = SelectHourlyKernel(ctx_->phase, ctx_->regime);
+    }
+    // The agents of this sweep, which changes with hybrid activations and
+    // super-agent splits
+    agent_hours_ += static_cast<double>(
+                        sim->GetResourceManager()->GetNumAgents()) *
+                    ctx_->step_hours;
+  }
+
+  void operator()(Agent* agent) override {
+    kernel_(bdm_static_cast<Person*>(agent), *ctx_);
+  }
+
+  // The number of hours that the kernel advanced, summed over the agents of
+  // each sweep. The lanes of an ensemble are not included.
+  double GetAgentHours() const { return agent_hours_; }
+
+  // The number of hours that were fast-forwarded instead (see
+  // FastForwardAsleepHours)
+  uint64_t GetSkippedHours() const { return skipped_hours_; }
+
+ private:
+  const StepContext* ctx_ = nullptr;
+  HourlyKernelFn kernel_ = nullptr;
+  double agent_hours_ = 0;
+  uint64_t skipped_hours_ = 0;
+};
+
+}  // namespace bdm
+
+#endif  // HOURLY_KERNEL_OP_H_
@@ -9,6 +9,8 @@
 #include "core/simulation.h"
 
 #include "csv_helper.h"
+#include "disease_lanes.h"
+#include "input_bundle.h"
 #include "model_facts.h"
 #include "operations/update_statistics_op.h"
 #include "person.h"
@@ -26,11 +28,9 @@ class InitialInfectionOp : public StandaloneOperationImpl {
 
   void Initialize() {
     real_t agent_to_person_ratio = GetAgentToPersonRatio();
-    std::string data_dir = GetDataDir();
-    std::string init_infected_file =
-        data_dir + "/initial_infected_per_municipality_per_day.csv";
-
-    CsvToVector<int>(init_infected_file, &initial_infected_, 0, 0);
+    auto initial_infected = InputBundle::Get().GetArray<int>(
+        "initial_infected_per_municipality_per_day.csv");
+    initial_infected_.assign(initial_infected.begin(), initial_infected.end());
     infection_fraction_list_.resize(kNumMunicipalities);
     initialized_ = true;
   }
@@ -46,7 +46,7 @@ class InitialInfectionOp : public StandaloneOperationImpl {
       rm->RandomizeAgentsOrder();
     }
     real_t agent_to_person_ratio = GetAgentToPersonRatio();
-    auto timestep = sim->GetScheduler()->GetSimulatedSteps();
+    auto timestep = GetSimulatedHours();
     // Only add new infections per day as given by the RIVM
     if ((timestep % kHoursPerDay != 0)) {
       return;
@@ -80,6 +80,11 @@ class InitialInfectionOp : public StandaloneOperationImpl {
                   (person->state_ == State::kSusceptible)) {
                 person->state_ = State::kInfectious;
                 person->RandomlyInitializeStateThreshold();
+                // The other repetitions of an ensemble get the same seeds
+                if (!person->lanes_.empty()) {
+                  DiseaseLanes::Seed(person, State::kInfectious,
+                                     sim->GetRandom());
+                }
                 infection_count++;
               }
             },
@@ -113,6 +118,9 @@ class InitialInfectionOp : public StandaloneOperationImpl {
                 (person->state_ == State::kSusceptible)) {
               person->state_ = State::kExposed;
               person->RandomlyInitializeStateThreshold();
+              if (!person->lanes_.empty()) {
+                DiseaseLanes::Seed(person, State::kExposed, sim->GetRandom());
+              }
               exposed_count++;
             }
           },
@@ -0,0 +1,9 @@
+#include "core/operation/operation.h"
+
+#include "operations/metapopulation_op.h"
+
+namespace bdm {
+
+BDM_REGISTER_OP(MetapopulationOp, "metapopulation", kCpu);
+
+}  // namespace bdm
@@ -0,0 +1,83 @@
+#ifndef METAPOPULATION_OP_H_
+#define METAPOPULATION_OP_H_
+
+#include <array>
+
+#include "core/operation/operation.h"
+#include "core/operation/operation_registry.h"
+#include "core/simulation.h"
+
+#include "covid_environment.h"
+#include "initialization.h"
+#include "metapopulation.h"
+#include "model_facts.h"
+#include "operations/update_statistics_op.h"
+#include "person.h"
+#include "sim_param.h"
+
+namespace bdm {
+
+// Advances the municipalities of the Metapopulation by one timestep, with the
+// infected fractions of the previous timestep (like the agents), and hands
+// the municipalities that reached SimParam::metapopulation_threshold over to
+// the agent model. Must be scheduled before the statistics operation, such
+// that the statistics include the new agents.
+class MetapopulationOp : public StandaloneOperationImpl {
+ public:
+  BDM_OP_HEADER(MetapopulationOp);
+
+  void operator()() override {
+    auto* sim = Simulation::GetActive();
+    auto* env = bdm_static_cast<CovidEnvironment*>(sim->GetEnvironment());
+    auto* meta = env->GetMetapopulation();
+    const auto& ctx = env->GetStepContext();
+    if (meta == nullptr || ctx.stats == nullptr) {
+      return;
+    }
+    if (ctx.phase != phase_) {
+      phase_ = ctx.phase;
+      UpdateHomeStay(sim);
+      meta->SetHomeStay(home_stay_);
+    }
+
+    auto contacts = env->GetContactRates(ctx.phase);
+    for (uint32_t h = 0; h < ctx.step_hours; h++) {
+      meta->Step((ctx.hour + h) % kHoursPerDay, ctx.beta, contacts,
+                 ctx.stats->fractions_);
+    }
+
+    auto threshold = ctx.sparam->metapopulation_threshold;
+    for (uint16_t m = 0; m < kNumMunicipalities; m++) {
+      if (!meta->IsActive(m) && meta->GetInfectious(m) >= threshold) {
+        ActivateMunicipality(m, home_stay_);
+      }
+    }
+  }
+
+ private:
+  // The interventions of a phase put a share of the agents of some
+  // demographies at home; the compartments and the agents of municipalities
+  // that are activated later get the same shares
+  void UpdateHomeStay(Simulation* sim) {
+    std::array<uint64_t, kNumDemographies> total{};
+    std::array<uint64_t, kNumDemographies> at_home{};
+    sim->GetResourceManager()->ForEachAgent([&](Agent* agent) {
+      auto* person = bdm_static_cast<Person*>(agent);
+      total[person->demography_] += person->weight_;
+      if (person->home_stay_) {
+        at_home[person->demography_] += person->weight_;
+      }
+    });
+    for (uint8_t d = 0; d < kNumDemographies; d++) {
+      home_stay_[d] =
+          total[d] == 0 ? 0 : static_cast<real_t>(at_home[d]) / total[d];
+    }
+  }
+
+  uint8_t phase_ = kNumPhases;
+  std::array<real_t, kNumDemographies> home_stay_{};
+};
+
+}  // namespace bdm
+
+#endif  // METAPOPULATION_OP_H_
@@ -1,6 +1,8 @@
 #ifndef UPDATE_STATISTICS_OP_H_
 #define UPDATE_STATISTICS_OP_H_
 
+#include <cmath>
+#include <memory>
 #include <numeric>
 
 #include "core/operation/operation.h"
@@ -8,12 +10,65 @@
 #include "core/simulation.h"
 #include "core/util/thread_info.h"
 
+#include "covid_environment.h"
+#include "disease_lanes.h"
+#include "metapopulation.h"
 #include "model_facts.h"
+#include "municipality_series.h"
 #include "person.h"
 #include "sim_param.h"
 
 namespace bdm {
 
+// The number of agents per disease state at one timestep. These are the
+// quantities reported by the collectors (see SetupResultCollection).
+struct StateCounts {
+  uint64_t exposed = 0;
+  uint64_t infectious = 0;
+  uint64_t hospitalized = 0;
+  // Exposed, infectious or recovered agents per demography
+  std::array<uint64_t, kNumDemographies> affected{};
+  // Infectious agents per home municipality
+  std::array<uint64_t, kNumMunicipalities> infected_home{};
+  // Hospitalized agents per home municipality
+  std::array<uint64_t, kNumMunicipalities> hospitalized_home{};
+  // Agents per (current) location
+  std::array<uint64_t, kNumMunicipalities> located{};
+
+  // Adds the disease state of `person` (i.e. everything except `located`)
+  void AddState(const Person& person) {
+    auto state = person.state_;
+    auto weight = person.weight_;
+    if (state == State::kExposed) {
+      exposed += weight;
+    } else if (state == State::kInfectious) {
+      infectious += weight;
+      infected_home[person.home_location_] += weight;
+    }
+    if (state != State::kSusceptible) {
+      affected[person.demography_] += weight;
+    }
+    if (person.hospitalized_) {
+      hospitalized += weight;
+      hospitalized_home[person.home_location_] += weight;
+    }
+  }
+
+  void Merge(const StateCounts& other) {
+    exposed += other.exposed;
+    infectious += other.infectious;
+    hospitalized += other.hospitalized;
+    for (size_t d = 0; d < kNumDemographies; d++) {
+      affected[d] += other.affected[d];
+    }
+    for (size_t m = 0; m < kNumMunicipalities; m++) {
+      infected_home[m] += other.infected_home[m];
+      hospitalized_home[m] += other.hospitalized_home[m];
+      located[m] += other.located[m];
+    }
+  }
+};
+
 class UpdateStatisticsOp : public StandaloneOperationImpl {
  public:
   BDM_OP_HEADER(UpdateStatisticsOp);
@@ -23,12 +78,27 @@ class UpdateStatisticsOp : public StandaloneOperationImpl {
 
 #pragma omp parallel for
     for (auto m = 0; m < kNumMunicipalities; m++) {
-      infected_home_tl_[m] = SharedData<uint64_t>(max_threads, 0);
       for (auto d = 0; d < kNumDemographies; d++) {
         infected_tl_[m][d] = SharedData<uint64_t>(max_threads, 0);
         total_tl_[m][d] = SharedData<uint64_t>(max_threads, 0);
       }
     }
+    counts_tl_.assign(max_threads, StateCounts());
+    if (num_lanes_ != 0) {
+      lane_infected_.assign(num_lanes_ * kNumMunicipalities * kNumDemographies,
+                            0);
+      lane_counts_tl_.assign(max_threads,
+                             std::vector<uint64_t>(num_lanes_ * 3, 0));
+    }
+  }
+
+  // Keeps the statistics of `num_lanes` additional repetitions (see
+  // DiseaseLanes)
+  void SetNumLanes(uint32_t num_lanes) {
+    num_lanes_ = num_lanes;
+    lane_fractions_.assign(num_lanes, MunicipalityGrid{});
+    lane_counts_.assign(num_lanes, {});
+    lane_hours_.clear();
   }
 
   // Calculates the fractions: infected persons divided by total numer of
@@ -38,12 +108,15 @@ class UpdateStatisticsOp : public StandaloneOperationImpl {
       auto tid = ThreadInfo::GetInstance()->GetMyThreadId();
       auto* person = bdm_static_cast<Person*>(agent);
       auto municipality = person->location_;
-      auto home = person->home_location_;
       auto demography = person->demography_;
-      total_tl_[municipality][demography][tid]++;
+      total_tl_[municipality][demography][tid] += person->weight_;
       if (person->state_ == State::kInfectious) {
-        infected_tl_[municipality][demography][tid]++;
-        infected_home_tl_[home][tid]++;
+        infected_tl_[municipality][demography][tid] += person->weight_;
+      }
+      counts_tl_[tid].AddState(*person);
+      counts_tl_[tid].located[municipality] += person->weight_;
+      if (!person->lanes_.empty()) {
+        AddLanes(person, tid);
       }
     });
 
@@ -58,37 +131,73 @@ class UpdateStatisticsOp : public StandaloneOperationImpl {
       return result;
     };
 
+    // The persons that are not simulated with agents, at their location in
+    // the last hour of this timestep
+    auto* sim = Simulation::GetActive();
+    auto* env = dynamic_cast<CovidEnvironment*>(sim->GetEnvironment());
+    const Metapopulation* meta =
+        env != nullptr ? env->GetMetapopulation() : nullptr;
+    if (meta != nullptr) {
+      const auto& ctx = env->GetStepContext();
+      auto regime = HourToRegime((ctx.hour + ctx.step_hours - 1) % kHoursPerDay);
+      for (auto& row : meta_total_) {
+        row.fill(0);
+      }
+      for (auto& row : meta_infected_) {
+        row.fill(0);
+      }
+      meta->AddPresence(regime, &meta_total_, &meta_infected_);
+    }
+
 #pragma omp parallel for
     for (auto m = 0; m < kNumMunicipalities; m++) {
-      auto infected_home = combine_tl_results(infected_home_tl_[m]);
-      infected_home_[m] = infected_home;
       for (auto d = 0; d < kNumDemographies; d++) {
         auto total = combine_tl_results(total_tl_[m][d]);
         auto infected = combine_tl_results(infected_tl_[m][d]);
-        total_[m][d] = total;
-        infected_[m][d] = infected;
-        if (total != 0) {
-          fractions_[m][d] = static_cast<real_t>(infected) / total;
+        real_t all = total;
+        real_t all_infected = infected;
+        if (meta != nullptr) {
+          all += meta_total_[m][d];
+          all_infected += meta_infected_[m][d];
+        }
+        total_[m][d] = std::llround(all);
+        infected_[m][d] = std::llround(all_infected);
+        if (all != 0) {
+          fractions_[m][d] = all_infected / all;
         }
       }
     }
-  
-    auto* sparam = Simulation::GetActive()->GetParam()->Get<SimParam>();
-    auto f = sparam->export_infected_per_timestep_frequency;
-    auto timestep = Simulation::GetActive()->GetScheduler()->GetSimulatedSteps();
-    std::vector<real_t> total_inf_at_timestep(infected_home_.begin(), infected_home_.end());
-    total_infected_per_municipality_.push_back(total_inf_at_timestep);
-    if (f != 0 && (timestep % f == 0)) {
-      std::vector<real_t> total_at_timestep(kNumMunicipalities);
-#pragma omp parallel for
-      for (auto m = 0; m < kNumMunicipalities; m++) {
-        total_at_timestep[m] = std::accumulate(total_[m].begin(), total_[m].end(), 0);
-      }
-      total_per_municipality_.push_back(total_at_timestep);
+
+    counts_ = StateCounts();
+    for (const auto& tl_counts : counts_tl_) {
+      counts_.Merge(tl_counts);
     }
+    if (num_lanes_ != 0) {
+      MergeLanes();
+    }
+    if (meta != nullptr) {
+      AddMetapopulationCounts(*meta);
+    }
+
+    RecordPerMunicipality();
+  }
+
+  // Sets the counts of the upcoming timesteps, which were computed ahead of
+  // time (see FastForwardAsleepHours). As long as there are precomputed counts
+  // left, the operation publishes those instead of iterating over all agents.
+  // Note that `fractions_` is not updated for these timesteps, which is fine
+  // as long as there is no transmission during these timesteps.
+  void SetPrecomputedCounts(std::vector<StateCounts>&& counts) {
+    precomputed_counts_ = std::move(counts);
+    next_precomputed_ = 0;
   }
 
   void operator()() override {
+    if (next_precomputed_ < precomputed_counts_.size()) {
+      counts_ = precomputed_counts_[next_precomputed_++];
+      RecordPerMunicipality();
+      return;
+    }
     Reset();
     CalculateFractions();
   }
@@ -99,25 +208,134 @@ class UpdateStatisticsOp : public StandaloneOperationImpl {
   // The total number of infected people per demography, per municipality at given timestep
   std::array<std::array<uint64_t, kNumDemographies>, kNumMunicipalities>
       infected_;
-  // The total number of infected people per home municipality at given timestep
-  std::array<uint64_t, kNumMunicipalities> infected_home_;
   // The total number of people per demography, per municipality at given timestep
   std::array<std::array<uint64_t, kNumDemographies>, kNumMunicipalities> total_;
-  // The total number of infected people per home municipality (summed over all demographic groups) at each timestep
-  std::vector<std::vector<real_t>> total_infected_per_municipality_;
-  // The total number of people per municipality (summed over all demographic groups) at each timestep
-  std::vector<std::vector<real_t>> total_per_municipality_;
+  // The number of people per disease state at given timestep
+  StateCounts counts_;
+  // The infected fractions of each additional repetition of an ensemble at
+  // this timestep (see DiseaseLanes)
+  std::vector<MunicipalityGrid> lane_fractions_;
+  // The exposed, infectious and hospitalized agents of each additional
+  // repetition at each timestep, and the hours of these timesteps (see
+  // CollectHour)
+  std::vector<std::vector<std::array<uint64_t, 3>>> lane_counts_;
+  std::vector<real_t> lane_hours_;
+  // Receives the infected persons per home municipality and the persons per
+  // municipality every `export_infected_per_timestep_frequency` hours, if set
+  std::shared_ptr<MunicipalitySeriesWriter> municipality_series_;
 
  private:
+  // Adds the disease states of the lanes of `person`
+  void AddLanes(Person* person, int tid) {
+    DiseaseLanes lanes(person);
+    const auto* states = lanes[DiseaseLanes::kState];
+    const auto* flags = lanes[DiseaseLanes::kFlags];
+    auto cell = person->location_ * kNumDemographies + person->demography_;
+    auto* counts = lane_counts_tl_[tid].data();
+    for (uint32_t l = 0; l < num_lanes_; l++) {
+      if (states[l] == State::kInfectious) {
+#pragma omp atomic
+        lane_infected_[l * kNumMunicipalities * kNumDemographies + cell]++;
+      }
+      counts[3 * l] += states[l] == State::kExposed;
+      counts[3 * l + 1] += states[l] == State::kInfectious;
+      counts[3 * l + 2] += (flags[l] & DiseaseLanes::kHospitalized) != 0;
+    }
+  }
+
+  // Computes the fractions of the lanes and records their counts. The lanes
+  // share the agents and their locations, so `total_` is the same for all.
+  void MergeLanes() {
+    for (uint32_t l = 0; l < num_lanes_; l++) {
+      const auto* infected =
+          &lane_infected_[l * kNumMunicipalities * kNumDemographies];
+      for (uint16_t m = 0; m < kNumMunicipalities; m++) {
+        for (uint8_t d = 0; d < kNumDemographies; d++) {
+          if (total_[m][d] != 0) {
+            lane_fractions_[l][m][d] =
+                static_cast<real_t>(infected[m * kNumDemographies + d]) /
+                total_[m][d];
+          }
+        }
+      }
+      std::array<uint64_t, 3> counts{};
+      for (const auto& tl_counts : lane_counts_tl_) {
+        for (size_t i = 0; i < 3; i++) {
+          counts[i] += tl_counts[3 * l + i];
+        }
+      }
+      lane_counts_[l].push_back(counts);
+    }
+    lane_hours_.push_back(GetSimulatedHours() + GetStepHours() - 1);
+  }
+
+  // Adds the (rounded) compartments of `meta` to `counts_`
+  void AddMetapopulationCounts(const Metapopulation& meta) {
+    for (uint16_t m = 0; m < kNumMunicipalities; m++) {
+      if (meta.IsActive(m)) {
+        continue;
+      }
+      real_t infectious = 0;
+      real_t hospitalized = 0;
+      for (uint8_t d = 0; d < kNumDemographies; d++) {
+        const auto& c = meta.GetCompartments(m, d);
+        counts_.exposed += std::llround(c.exposed);
+        counts_.affected[d] +=
+            std::llround(c.exposed + c.infectious + c.recovered);
+        infectious += c.infectious;
+        hospitalized += c.hospitalized;
+      }
+      counts_.infectious += std::llround(infectious);
+      counts_.infected_home[m] += std::llround(infectious);
+      counts_.hospitalized += std::llround(hospitalized);
+      counts_.hospitalized_home[m] += std::llround(hospitalized);
+    }
+    for (uint16_t m = 0; m < kNumMunicipalities; m++) {
+      real_t located = 0;
+      for (uint8_t d = 0; d < kNumDemographies; d++) {
+        located += meta_total_[m][d];
+      }
+      counts_.located[m] += std::llround(located);
+    }
+  }
+
+  void RecordPerMunicipality() {
+    if (municipality_series_ == nullptr) {
+      return;
+    }
+    auto* sim = Simulation::GetActive();
+    auto f = sim->GetParam()->Get<SimParam>()->export_infected_per_timestep_frequency;
+    auto hour = GetSimulatedHours();
+    if (f != 0 && (hour % f == 0)) {
+      municipality_series_->Append(hour, counts_.infected_home,
+                                   counts_.located);
+    }
+  }
+
   std::array<std::array<SharedData<uint64_t>, kNumDemographies>,
              kNumMunicipalities>
       infected_tl_;
-  std::array<SharedData<uint64_t>, kNumMunicipalities> infected_home_tl_;
   std::array<std::array<SharedData<uint64_t>, kNumDemographies>,
              kNumMunicipalities>
       total_tl_;
+  std::vector<StateCounts> counts_tl_;
+  // The presence of the persons that are not simulated with agents
+  MunicipalityGrid meta_total_;
+  MunicipalityGrid meta_infected_;
+  std::vector<StateCounts> precomputed_counts_;
+  size_t next_precomputed_ = 0;
+  uint32_t num_lanes_ = 0;
+  // Infectious agents per (lane, location, demography)
+  std::vector<uint64_t> lane_infected_;
+  std::vector<std::vector<uint64_t>> lane_counts_tl_;
 };
 
+inline UpdateStatisticsOp* GetStatistics(Simulation* sim) {
+  return sim->GetScheduler()
+      ->GetOps("update statistics")[0]
+      ->GetImplementation<UpdateStatisticsOp>();
+}
+
 }  // namespace bdm
 
 #endif  // UPDATE_STATISTICS_OP_H_
@@ -0,0 +1,9 @@
+#include "core/operation/operation.h"
+
+#include "operations/update_step_context_op.h"
+
+namespace bdm {
+
+BDM_REGISTER_OP(UpdateStepContextOp, "update step context", kCpu);
+
+}  // namespace bdm
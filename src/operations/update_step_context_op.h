@@ -0,0 +1,69 @@
+#ifndef UPDATE_STEP_CONTEXT_OP_H_
+#define UPDATE_STEP_CONTEXT_OP_H_
+
+#include "core/operation/operation.h"
+#include "core/operation/operation_registry.h"
+#include "core/simulation.h"
+
+#include "covid_environment.h"
+#include "model_facts.h"
+#include "operations/update_statistics_op.h"
+#include "sim_param.h"
+#include "step_context.h"
+
+namespace bdm {
+
+// The transmission rate of the mixing phase `phase` (see
+// AdjustMixingMatrices). Phase 2 uses beta4 like phase 3, which is the mapping
+// the default betas were calibrated with; beta3 has no effect.
+inline real_t PhaseToBeta(const SimParam* sparam, uint8_t phase) {
+  if (phase == 0) {
+    return sparam->beta1;
+  } else if (phase == 1) {
+    return sparam->beta2;
+  } else {
+    return sparam->beta4;
+  }
+}
+
+// Builds the context of the current timestep of `sim`
+inline StepContext MakeStepContext(Simulation* sim) {
+  auto* env = bdm_static_cast<CovidEnvironment*>(sim->GetEnvironment());
+  auto* scheduler = sim->GetScheduler();
+  StepContext ctx;
+  ctx.sparam = sim->GetParam()->Get<SimParam>();
+  ctx.timestep = scheduler->GetSimulatedSteps();
+  ctx.step_hours = ctx.sparam->step_hours;
+  ctx.hour = ctx.timestep * ctx.step_hours;
+  ctx.hour_of_day = ctx.hour % kHoursPerDay;
+  ctx.hour_of_week = ctx.hour % (kHoursPerDay * kDaysPerWeek);
+  ctx.regime = HourToRegime(ctx.hour_of_day);
+  ctx.fast_forward = ctx.timestep < env->GetFastForwardUntil();
+  ctx.phase = env->GetPhase();
+  ctx.beta = PhaseToBeta(ctx.sparam, ctx.phase);
+  ctx.sleep_weight = kDailySleepPattern[ctx.hour_of_day];
+  ctx.env = env;
+  auto stat_ops = scheduler->GetOps("update statistics");
+  if (!stat_ops.empty()) {
+    ctx.stats = stat_ops[0]->GetImplementation<UpdateStatisticsOp>();
+  }
+  return ctx;
+}
+
+// Refreshes the step context of the CovidEnvironment. Must be scheduled as a
+// pre-scheduled operation, such that the context is up to date before any
+// agent runs its behaviors
+class UpdateStepContextOp : public StandaloneOperationImpl {
+ public:
+  BDM_OP_HEADER(UpdateStepContextOp);
+
+  void operator()() override {
+    auto* sim = Simulation::GetActive();
+    auto* env = bdm_static_cast<CovidEnvironment*>(sim->GetEnvironment());
+    env->SetStepContext(MakeStepContext(sim));
+  }
+};
+
+}  // namespace bdm
+
+#endif  // UPDATE_STEP_CONTEXT_OP_H_
@@ -1,5 +1,7 @@
 #include "person.h"
+#include "behaviors/change_situation_behavior.h"
 #include "behaviors/infection_behavior.h"
+#include "behaviors/travel_behavior.h"
 
 using namespace bdm;
 
@@ -11,3 +13,29 @@ void Person::RandomlyInitializeStateThreshold() {
     }
   }
 }
+
+void Person::AddModelBehaviors() {
+  // The order matters: the HourlyKernelOp runs the behaviors in this order and
+  // expects the InfectionBehavior to be the last one
+  AddBehavior(new ChangeSituationBehavior());
+  AddBehavior(new TravelBehavior());
+  AddBehavior(new InfectionBehavior());
+}
+
+Person* Person::Split(uint32_t weight) {
+  auto* split = new Person(demography_, age_, gender_, location_,
+                           home_location_, state_);
+  split->traveler_type_ = traveler_type_;
+  split->situation_ = situation_;
+  split->home_stay_ = home_stay_;
+  split->weekly_travel_schedule_ = weekly_travel_schedule_;
+  split->weight_ = weight;
+  split->AddModelBehaviors();
+  weight_ -= weight;
+  return split;
+}
+
+InfectionBehavior* Person::GetInfectionBehavior() {
+  // `CreatePerson` adds the InfectionBehavior as the last behavior
+  return bdm_static_cast<InfectionBehavior*>(GetAllBehaviors().back());
+}
@@ -5,10 +5,10 @@
 
 #include "model_facts.h"
 
-class InfectionBehavior;
-
 namespace bdm {
 
+struct InfectionBehavior;
+
 class Person : public Agent {
   BDM_AGENT_HEADER(Person, Agent, 1);
 
@@ -51,6 +51,17 @@ class Person : public Agent {
 
   void RandomlyInitializeStateThreshold();
 
+  // Adds the behaviors of this model, in the order that the HourlyKernelOp
+  // expects
+  void AddModelBehaviors();
+
+  // Moves `weight` of the weight of this agent to a new agent with the same
+  // attributes, schedule and location, but its own disease progression
+  Person* Split(uint32_t weight);
+
+  // Returns the InfectionBehavior of a person created by `CreatePerson`
+  InfectionBehavior* GetInfectionBehavior();
+
   //  private:
   friend class MobilityData;
   friend struct InfectionBehavior;
@@ -66,6 +77,13 @@ class Person : public Agent {
   Situation situation_;
   bool hospitalized_ = false;
   bool home_stay_ = false;
+  // The number of persons of the population this agent stands for, in units
+  // of GetAgentToPersonRatio(). Only susceptible agents can have a weight
+  // above one (see SimParam::super_agent_weight).
+  uint32_t weight_ = 1;
+  // The disease courses of the other repetitions of an ensemble (see
+  // DiseaseLanes); empty without ensembles
+  std::vector<uint32_t> lanes_;
   std::vector<uint16_t> weekly_travel_schedule_;
 };
 
@@ -0,0 +1,97 @@
+#ifndef POPULATION_CACHE_H_
+#define POPULATION_CACHE_H_
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "model_facts.h"
+#include "person.h"
+
+namespace bdm {
+
+// Keeps the persons that were initialized from the register data, including
+// their weekly travel schedules, for the lifetime of the process (see
+// SimParam::cache_population). The persons are kept in the order in which
+// InitializePopulation takes the register rows, so a smaller population is a
+// prefix of a larger one. Only the persons beyond the cached ones have to be
+// read and get a new schedule. The order depends on the register file, the
+// sampling mode and the seed (see RegisterOrder), which together are the key
+// of the cache.
+class PopulationCache {
+ public:
+  static PopulationCache* GetInstance() {
+    static PopulationCache kCache;
+    return &kCache;
+  }
+
+  // Drops all persons if they were not read from `source` in the order of
+  // `stratified` sampling with `seed` (see RegisterOrder)
+  void SetSource(const std::string& source, bool stratified, uint64_t seed) {
+    if (source != source_) {
+      register_size_ = 0;
+    }
+    if (source != source_ || stratified != stratified_ || seed != seed_) {
+      Resize(0);
+      source_ = source;
+      stratified_ = stratified;
+      seed_ = seed;
+    }
+  }
+
+  // The number of rows of the register data (0 if not known yet)
+  size_t GetRegisterSize() const { return register_size_; }
+  void SetRegisterSize(size_t rows) { register_size_ = rows; }
+
+  size_t GetNumPersons() const { return ages_.size(); }
+
+  void Resize(size_t num_persons) {
+    genders_.resize(num_persons);
+    ages_.resize(num_persons);
+    demographies_.resize(num_persons);
+    municipalities_.resize(num_persons);
+    schedules_.resize(num_persons * kHoursPerWeek);
+  }
+
+  // Stores `person` at index `i`. Different indices can be stored in parallel.
+  void Store(size_t i, const Person& person) {
+    genders_[i] = person.gender_;
+    ages_[i] = person.age_;
+    demographies_[i] = person.demography_;
+    municipalities_[i] = person.home_location_;
+    std::copy(person.weekly_travel_schedule_.begin(),
+              person.weekly_travel_schedule_.end(),
+              schedules_.begin() + i * kHoursPerWeek);
+  }
+
+  Gender GetGender(size_t i) const { return genders_[i]; }
+  uint8_t GetAge(size_t i) const { return ages_[i]; }
+  Demographic GetDemography(size_t i) const { return demographies_[i]; }
+  uint16_t GetMunicipality(size_t i) const { return municipalities_[i]; }
+
+  // Copies the weekly travel schedule of person `i` to `person`
+  void RestoreSchedule(size_t i, Person* person) const {
+    auto begin = schedules_.begin() + i * kHoursPerWeek;
+    std::copy(begin, begin + kHoursPerWeek,
+              person->weekly_travel_schedule_.begin());
+  }
+
+ private:
+  static constexpr size_t kHoursPerWeek = kHoursPerDay * kDaysPerWeek;
+
+  PopulationCache() {}
+
+  std::string source_;
+  bool stratified_ = false;
+  uint64_t seed_ = 0;
+  size_t register_size_ = 0;
+  std::vector<Gender> genders_;
+  std::vector<uint8_t> ages_;
+  std::vector<Demographic> demographies_;
+  std::vector<uint16_t> municipalities_;
+  std::vector<uint16_t> schedules_;
+};
+
+}  // namespace bdm
+
+#endif  // POPULATION_CACHE_H_
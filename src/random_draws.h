@@ -0,0 +1,25 @@
+#ifndef RANDOM_DRAWS_H_
+#define RANDOM_DRAWS_H_
+
+#include <cmath>
+
+#include "biodynamo.h"
+
+namespace bdm {
+
+// Draws from the distributions of the disease course with the random number
+// generator of the calling thread (see Simulation::GetRandom), by inverting
+// the cumulative distribution function. Same distributions as
+// std::weibull_distribution(shape, scale) and std::lognormal_distribution(mu,
+// sigma).
+inline real_t DrawWeibull(real_t shape, real_t scale, Random* random) {
+  return scale * std::pow(-std::log1p(-random->Uniform(0, 1)), 1 / shape);
+}
+
+inline real_t DrawLogNormal(real_t mu, real_t sigma, Random* random) {
+  return std::exp(mu + sigma * random->Gaus(0, 1));
+}
+
+}  // namespace bdm
+
+#endif  // RANDOM_DRAWS_H_
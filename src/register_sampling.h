@@ -0,0 +1,130 @@
+#ifndef REGISTER_SAMPLING_H_
+#define REGISTER_SAMPLING_H_
+
+#include <stdint.h>
+#include <algorithm>
+#include <numeric>
+#include <queue>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "model_facts.h"
+
+namespace bdm {
+
+// The fields of one row of the register data that the model uses
+struct RegisterPerson {
+  uint16_t location;
+  uint8_t age;
+  uint8_t demography;
+  uint8_t gender;
+};
+
+// Returns the indices of `n` persons of `persons`, stratified over the
+// (home municipality, demography) cells: the agents are assigned to the cells
+// one by one with the Sainte-Laguë (Webster) divisor method, i.e. the next
+// agent goes to the cell with the highest `size / (2 * taken + 1)`. This gives
+// every cell its proportional share rounded to the nearest integer (with a
+// common divisor, such that the shares add up to exactly `n`), instead of the
+// sampling noise of a random subset, which at small agent counts leaves small
+// municipalities without agents. As the method is house monotone, the order
+// for `n` persons is a prefix of the order for any larger `n` (see
+// PopulationCache). Within a cell, the persons are taken in a shuffled order
+// that only depends on `seed`.
+inline std::vector<size_t> StratifiedOrder(
+    const std::vector<RegisterPerson>& persons, size_t n, uint64_t seed = 0) {
+  const size_t num_cells = kNumMunicipalities * kNumDemographies;
+  std::vector<std::vector<size_t>> members(num_cells);
+  for (size_t i = 0; i < persons.size(); i++) {
+    const auto& p = persons[i];
+    members[p.location * kNumDemographies + p.demography].push_back(i);
+  }
+  std::mt19937_64 rng(seed);
+  for (auto& cell : members) {
+    std::shuffle(cell.begin(), cell.end(), rng);
+  }
+
+  // Highest priority first; equal priorities go to the lowest cell index
+  using Entry = std::pair<double, size_t>;
+  auto lower_priority = [](const Entry& a, const Entry& b) {
+    return a.first < b.first || (a.first == b.first && a.second > b.second);
+  };
+  std::priority_queue<Entry, std::vector<Entry>, decltype(lower_priority)>
+      queue(lower_priority);
+  std::vector<size_t> taken(num_cells, 0);
+  for (size_t c = 0; c < num_cells; c++) {
+    if (!members[c].empty()) {
+      queue.push({static_cast<double>(members[c].size()), c});
+    }
+  }
+
+  std::vector<size_t> order;
+  order.reserve(std::min(n, persons.size()));
+  while (order.size() < n && !queue.empty()) {
+    auto c = queue.top().second;
+    queue.pop();
+    order.push_back(members[c][taken[c]++]);
+    if (taken[c] < members[c].size()) {
+      queue.push({static_cast<double>(members[c].size()) / (2 * taken[c] + 1),
+                  c});
+    }
+  }
+  return order;
+}
+
+// Returns the indices of `n` persons of `persons` in a random order (that is
+// the same for each call), without stratification
+inline std::vector<size_t> ShuffledOrder(
+    const std::vector<RegisterPerson>& persons, size_t n) {
+  std::vector<size_t> random_indices(persons.size());
+  // Generate values in range 0, 1, 2, .., (persons.size() - 1)
+  std::iota(std::begin(random_indices), std::end(random_indices), 0);
+  // Shuffle to create random indices order
+  auto rng = std::default_random_engine{};
+  std::shuffle(random_indices.begin(), random_indices.end(), rng);
+  random_indices.resize(std::min(n, persons.size()));
+  return random_indices;
+}
+
+// Groups the selected persons `0, ..., n - 1` into agents (see
+// SimParam::super_agent_weight). The persons whose home municipality is not
+// `hot` are merged per (municipality, demography) into super agents of up to
+// `weight` persons, in the order of selection; all other persons get an agent
+// of their own. `location(i)` and `demography(i)` return the home municipality
+// and the demography of person `i`. Returns per agent the person that
+// represents it and its weight.
+template <typename L, typename D>
+inline std::vector<std::pair<size_t, uint32_t>> GroupIntoAgents(
+    size_t n, L location, D demography, const std::vector<bool>& hot,
+    uint32_t weight) {
+  std::vector<std::pair<size_t, uint32_t>> agents;
+  // The super agent that is being filled per (municipality, demography)
+  std::vector<std::pair<size_t, uint32_t>> pending(
+      kNumMunicipalities * kNumDemographies, {0, 0});
+  for (size_t i = 0; i < n; i++) {
+    auto m = location(i);
+    if (weight <= 1 || hot[m]) {
+      agents.push_back({i, 1});
+      continue;
+    }
+    auto& super_agent = pending[m * kNumDemographies + demography(i)];
+    if (super_agent.second == 0) {
+      super_agent.first = i;
+    }
+    if (++super_agent.second == weight) {
+      agents.push_back(super_agent);
+      super_agent.second = 0;
+    }
+  }
+  for (auto& super_agent : pending) {
+    if (super_agent.second != 0) {
+      agents.push_back(super_agent);
+    }
+  }
+  return agents;
+}
+
+}  // namespace bdm
+
+#endif  // REGISTER_SAMPLING_H_
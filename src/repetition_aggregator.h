@@ -0,0 +1,388 @@
+#ifndef REPETITION_AGGREGATOR_H_
+#define REPETITION_AGGREGATOR_H_
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "biodynamo.h"
+
+#include "sim_param.h"
+
+namespace bdm {
+
+using experimental::TimeSeries;
+
+// A streaming estimate of a quantile of a sequence in constant memory: the P²
+// algorithm of Jain and Chlamtac (1985), which keeps five markers at the
+// minimum, the quantile p/2, p, (1+p)/2 and the maximum, and adjusts their
+// heights with a piecewise parabolic fit as the values arrive. The quantile is
+// passed to each call, such that it is not stored per estimator.
+class P2Quantile {
+ public:
+  void Add(double x, double p) {
+    if (count_ < 5) {
+      heights_[count_++] = x;
+      if (count_ == 5) {
+        std::sort(heights_, heights_ + 5);
+        for (int i = 0; i < 5; i++) {
+          positions_[i] = i;
+        }
+      }
+      return;
+    }
+    // The cell of x, whose markers above it move up by one
+    int k = 0;
+    if (x < heights_[0]) {
+      heights_[0] = x;
+    } else if (x >= heights_[4]) {
+      heights_[4] = x;
+      k = 3;
+    } else {
+      while (x >= heights_[k + 1]) {
+        k++;
+      }
+    }
+    for (int i = k + 1; i < 5; i++) {
+      positions_[i]++;
+    }
+    count_++;
+
+    const double increments[5] = {0, p / 2, p, (1 + p) / 2, 1};
+    for (int i = 1; i < 4; i++) {
+      double d = increments[i] * (count_ - 1) - positions_[i];
+      if ((d >= 1 && positions_[i + 1] - positions_[i] > 1) ||
+          (d <= -1 && positions_[i - 1] - positions_[i] < -1)) {
+        int s = d > 0 ? 1 : -1;
+        double height = Parabolic(i, s);
+        if (heights_[i - 1] < height && height < heights_[i + 1]) {
+          heights_[i] = height;
+        } else {
+          heights_[i] += s * (heights_[i + s] - heights_[i]) /
+                         (positions_[i + s] - positions_[i]);
+        }
+        positions_[i] += s;
+      }
+    }
+  }
+
+  // The estimate of the quantile p; exact (interpolated) for up to five
+  // values
+  double Get(double p) const {
+    if (count_ == 0) {
+      return std::numeric_limits<double>::quiet_NaN();
+    }
+    if (count_ > 5) {
+      return heights_[2];
+    }
+    double sorted[5];
+    std::copy(heights_, heights_ + count_, sorted);
+    std::sort(sorted, sorted + count_);
+    double rank = p * (count_ - 1);
+    auto below = static_cast<uint32_t>(rank);
+    if (below + 1 >= count_) {
+      return sorted[count_ - 1];
+    }
+    return sorted[below] + (rank - below) * (sorted[below + 1] - sorted[below]);
+  }
+
+ private:
+  double Parabolic(int i, int s) const {
+    const auto* n = positions_;
+    const auto* q = heights_;
+    return q[i] + static_cast<double>(s) / (n[i + 1] - n[i - 1]) *
+                      ((n[i] - n[i - 1] + s) * (q[i + 1] - q[i]) /
+                           (n[i + 1] - n[i]) +
+                       (n[i + 1] - n[i] - s) * (q[i] - q[i - 1]) /
+                           (n[i] - n[i - 1]));
+  }
+
+  double heights_[5];
+  int32_t positions_[5];
+  uint32_t count_ = 0;
+};
+
+// The 97.5% quantile of Student's t distribution with `dof` degrees of
+// freedom, for two-sided 95% confidence intervals
+inline double StudentT975(uint64_t dof) {
+  static const double kTable[] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447,
+                                  2.365,  2.306, 2.262, 2.228, 2.201, 2.179,
+                                  2.160,  2.145, 2.131, 2.120, 2.110, 2.101,
+                                  2.093,  2.086, 2.080, 2.074, 2.069, 2.064,
+                                  2.060,  2.056, 2.052, 2.048, 2.045, 2.042};
+  if (dof == 0) {
+    return std::numeric_limits<double>::infinity();
+  }
+  if (dof <= 30) {
+    return kTable[dof - 1];
+  }
+  // The Cornish-Fisher expansion around the normal quantile, accurate to
+  // 1e-4 beyond the table
+  const double z = 1.959964;
+  const double z3 = z * z * z;
+  const double z5 = z3 * z * z;
+  return z + (z3 + z) / (4.0 * dof) +
+         (5 * z5 + 16 * z3 + 3 * z) / (96.0 * dof * dof);
+}
+
+// The running mean and variance of a sequence (Welford's algorithm)
+struct RunningMoments {
+  uint32_t count = 0;
+  double mean = 0;
+  double m2 = 0;
+
+  void Add(double x) {
+    count++;
+    double delta = x - mean;
+    mean += delta / count;
+    m2 += delta * (x - mean);
+  }
+
+  // The sample standard deviation, as the error bars of the Experiment of the
+  // MultiSimulation
+  double GetStdDev() const {
+    return count > 1 ? std::sqrt(m2 / (count - 1)) : 0;
+  }
+
+  // The half-width of the 95% confidence interval of the mean; infinite for
+  // less than two values
+  double GetHalfWidth() const {
+    if (count < 2) {
+      return std::numeric_limits<double>::infinity();
+    }
+    return StudentT975(count - 1) * GetStdDev() / std::sqrt(count);
+  }
+};
+
+// Aggregates the results of the repetitions of an experiment as they
+// complete, instead of keeping all of them: per point of each series, the
+// mean and the standard deviation, and optionally quantiles. The memory does
+// not grow with the number of repetitions, unless their full results are kept
+// on request. Results of different lengths (e.g. aborted runs) are aggregated
+// over the repetitions that reached each point.
+class RepetitionAggregator {
+ public:
+  // Aggregates the series `names`, with the quantiles `quantiles` per point
+  RepetitionAggregator(const std::vector<std::string>& names,
+                       const std::vector<real_t>& quantiles,
+                       bool keep_repetitions)
+      : names_(names),
+        quantiles_(quantiles),
+        keep_repetitions_(keep_repetitions),
+        series_(names.size()) {}
+
+  // Also tracks `metric` of each repetition, e.g. its error, for the
+  // confidence interval of its mean (see NeedsMoreRepetitions)
+  void SetMetric(const std::string& name,
+                 const std::function<real_t(const TimeSeries&)>& metric) {
+    metric_name_ = name;
+    metric_ = metric;
+  }
+
+  void Add(const TimeSeries& result) {
+    if (repetitions_ == 0) {
+      for (const auto* name : {"resolution", "repetitions", "aborted_mse",
+                               "analytical_mse", "surrogate_mse"}) {
+        if (result.Contains(name)) {
+          metadata_.Add(name, result.GetXValues(name),
+                        result.GetYValues(name));
+        }
+      }
+    }
+    if (result.Contains("municipality_series")) {
+      municipality_series_.emplace_back(
+          result.GetXValues("municipality_series")[0],
+          result.GetYValues("municipality_series")[0]);
+    }
+    auto num_quantiles = quantiles_.size();
+    for (size_t s = 0; s < names_.size(); s++) {
+      if (!result.Contains(names_[s])) {
+        continue;
+      }
+      auto& series = series_[s];
+      const auto& x = result.GetXValues(names_[s]);
+      const auto& y = result.GetYValues(names_[s]);
+      if (y.size() > series.moments.size()) {
+        series.x = x;
+        series.moments.resize(y.size());
+        series.quantiles.resize(y.size() * num_quantiles);
+      }
+      for (size_t i = 0; i < y.size(); i++) {
+        series.moments[i].Add(y[i]);
+        for (size_t q = 0; q < num_quantiles; q++) {
+          series.quantiles[i * num_quantiles + q].Add(y[i], quantiles_[q]);
+        }
+      }
+    }
+    if (keep_repetitions_) {
+      repetitions_data_.push_back(result);
+    }
+    if (result.Contains("aborted_mse")) {
+      aborted_ = true;
+    } else if (metric_) {
+      metric_moments_.Add(metric_(result));
+    }
+    repetitions_++;
+  }
+
+  size_t GetNumRepetitions() const { return repetitions_; }
+
+  // Whether a repetition was aborted (see SimParam::abort_best_mse_factor)
+  bool IsAborted() const { return aborted_; }
+
+  // The name of the metric (see SetMetric), or an empty string
+  const std::string& GetMetricName() const { return metric_name_; }
+
+  // The moments of the metric over the repetitions that were not aborted
+  const RunningMoments& GetMetric() const { return metric_moments_; }
+
+  // The mean of the repetitions, with the standard deviation as error bars,
+  // the quantiles as series of their own (see GetQuantileName) and the
+  // metadata of the first repetition
+  TimeSeries GetSummary() const {
+    TimeSeries summary = metadata_;
+    auto num_quantiles = quantiles_.size();
+    for (size_t s = 0; s < names_.size(); s++) {
+      const auto& series = series_[s];
+      if (series.moments.empty()) {
+        continue;
+      }
+      auto points = series.moments.size();
+      std::vector<real_t> mean(points);
+      std::vector<real_t> stddev(points);
+      for (size_t i = 0; i < points; i++) {
+        mean[i] = series.moments[i].mean;
+        stddev[i] = series.moments[i].GetStdDev();
+      }
+      summary.Add(names_[s], series.x, mean, stddev, stddev);
+      for (size_t q = 0; q < num_quantiles; q++) {
+        std::vector<real_t> values(points);
+        for (size_t i = 0; i < points; i++) {
+          values[i] =
+              series.quantiles[i * num_quantiles + q].Get(quantiles_[q]);
+        }
+        summary.Add(GetQuantileName(names_[s], quantiles_[q]), series.x,
+                    values);
+      }
+    }
+    return summary;
+  }
+
+  // The names of the series of GetSummary
+  std::vector<std::string> GetSeriesNames() const {
+    std::vector<std::string> names;
+    for (const auto& name : names_) {
+      names.push_back(name);
+      for (auto q : quantiles_) {
+        names.push_back(GetQuantileName(name, q));
+      }
+    }
+    return names;
+  }
+
+  static std::string GetQuantileName(const std::string& name, real_t q) {
+    return Concat(name, "_q", q * 100);
+  }
+
+  // The metadata of the first repetition, e.g. "resolution"
+  const TimeSeries& GetMetadata() const { return metadata_; }
+
+  // The full results, if they are kept
+  const std::vector<TimeSeries>& GetRepetitions() const {
+    return repetitions_data_;
+  }
+
+  // The process and run of the municipality series of each repetition (see
+  // MunicipalitySeriesFile)
+  const std::vector<std::pair<real_t, real_t>>& GetMunicipalitySeries() const {
+    return municipality_series_;
+  }
+
+ private:
+  struct Series {
+    std::vector<real_t> x;
+    std::vector<RunningMoments> moments;
+    // Per point, the estimators of all quantiles
+    std::vector<P2Quantile> quantiles;
+  };
+
+  std::vector<std::string> names_;
+  std::vector<real_t> quantiles_;
+  bool keep_repetitions_;
+  std::vector<Series> series_;
+  TimeSeries metadata_;
+  std::vector<std::pair<real_t, real_t>> municipality_series_;
+  std::vector<TimeSeries> repetitions_data_;
+  size_t repetitions_ = 0;
+  bool aborted_ = false;
+  std::string metric_name_;
+  std::function<real_t(const TimeSeries&)> metric_;
+  RunningMoments metric_moments_;
+};
+
+// The quantiles of SimParam::repetition_quantile
+inline std::vector<real_t> GetRepetitionQuantiles(const SimParam* sparam) {
+  auto p = sparam->repetition_quantile;
+  if (p <= 0 || p >= 1) {
+    return {};
+  }
+  auto low = std::min(p, 1 - p);
+  return {low, 0.5, 1 - low};
+}
+
+// Whether an experiment needs another repetition: until it has
+// `repetitions`, and beyond that while the 95% confidence interval of the
+// mean of its metric is wider than SimParam::repetition_ci_target (relative
+// to the mean), up to SimParam::max_repetitions. Aborted experiments get no
+// more repetitions.
+inline bool NeedsMoreRepetitions(const RepetitionAggregator& aggregate,
+                                 uint64_t repetitions,
+                                 const SimParam* sparam) {
+  auto done = aggregate.GetNumRepetitions();
+  if (done < repetitions) {
+    return true;
+  }
+  const auto& metric = aggregate.GetMetric();
+  if (sparam->repetition_ci_target <= 0 || aggregate.IsAborted() ||
+      aggregate.GetMetricName().empty() || done >= sparam->max_repetitions ||
+      !std::isfinite(metric.mean)) {
+    return false;
+  }
+  return metric.GetHalfWidth() >
+         sparam->repetition_ci_target * std::abs(metric.mean);
+}
+
+// Simulates the repetitions of `param`, like the Experiment of the
+// MultiSimulation, but aggregates their results as they complete (see
+// RepetitionAggregator). Simulates at least `repetitions`, and more while
+// the metric of the aggregate has not converged (see NeedsMoreRepetitions).
+// Returns the error of their mean against `observed`, which is passed on to
+// `export_results` with the aggregate.
+inline real_t StreamingExperiment(
+    const std::function<void(Param*, TimeSeries*)>& simulate,
+    uint64_t repetitions, const Param& param,
+    RepetitionAggregator* aggregate, const TimeSeries& observed,
+    const std::function<real_t(const TimeSeries&, const TimeSeries&)>&
+        compute_error,
+    const std::function<void(const RepetitionAggregator&, const Param&,
+                             real_t)>& export_results) {
+  const auto* sparam = param.Get<SimParam>();
+  while (NeedsMoreRepetitions(*aggregate, repetitions, sparam)) {
+    // Simulate consumes the parameters
+    Param repetition_param(param);
+    TimeSeries result;
+    simulate(&repetition_param, &result);
+    aggregate->Add(result);
+  }
+  auto err = compute_error(observed, aggregate->GetSummary());
+  export_results(*aggregate, param, err);
+  return err;
+}
+
+}  // namespace bdm
+
+#endif  // REPETITION_AGGREGATOR_H_
@@ -0,0 +1,228 @@
+#ifndef SCENARIO_TREE_H_
+#define SCENARIO_TREE_H_
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "biodynamo.h"
+#include "core/multi_simulation/optimization_param.h"
+
+#include <json.hpp>
+
+#include "branching.h"
+#include "calibration.h"
+#include "cbs-covid.h"
+#include "data_processing_helpers.h"
+#include "repetition_aggregator.h"
+#include "sim_param.h"
+
+namespace bdm {
+
+// The phase at whose start (see BranchPlan::phase) the SimParam parameter
+// `name` first changes a run, i.e. before which all values of it simulate the
+// same. -1 if a change of it cannot be applied to a running simulation, e.g.
+// because it shapes the population.
+inline int DivergencePhase(const std::string& name) {
+  static const std::map<std::string, int> kPhases = {
+      {"beta1", 0},
+      {"phase_1_hours", 1},
+      {"beta2", 2},
+      {"phase_2_hours", 2},
+      {"phase_2_mobility_reduction", 2},
+      {"phase_2_homeschooling_parents", 2},
+      {"phase_3_hours", 3},
+      {"phase_3_mobility_reduction", 3},
+      // Also the rate of phase 3 (see PhaseToBeta)
+      {"beta4", 3},
+      {"phase_4_hours", 4},
+      {"phase_4_mobility_reduction", 4}};
+  auto it = kPhases.find(name);
+  return it == kPhases.end() ? -1 : it->second;
+}
+
+// The simulated hour at which the phase `phase` of Simulate starts (see
+// BranchPlan::phase); kNumPhases + 1 is the end of the run
+inline uint64_t PhaseStartHour(const SimParam* sparam, uint8_t phase) {
+  const uint32_t durations[] = {sparam->phase_1_hours, sparam->phase_2_hours,
+                                sparam->phase_3_hours, sparam->phase_4_hours};
+  uint64_t hour = 0;
+  if (phase >= 1) {
+    hour = sparam->init_infection_time;
+  }
+  for (uint8_t p = 1; p < phase && p <= kNumPhases; p++) {
+    hour += durations[p - 1];
+  }
+  return hour;
+}
+
+// The parameter values of one level of a scenario tree: the combinations of
+// the values of the swept parameters that diverge at `phase`
+struct ScenarioLevel {
+  uint8_t phase = 0;
+  std::vector<nlohmann::json> patches;
+};
+
+// Groups the combinations of the values of the optimization parameters by the
+// phase at which they diverge (see DivergencePhase). The parameters that
+// cannot be branched are combined into `roots`, each of which is simulated
+// from the start.
+inline std::vector<ScenarioLevel> GroupByDivergence(
+    const OptimizationParam* opt_param, std::vector<nlohmann::json>* roots) {
+  std::map<int, std::vector<nlohmann::json>> combinations;
+  for (auto* opt : opt_param->params) {
+    auto phase = opt->GetGroupName() == "bdm::SimParam"
+                     ? DivergencePhase(opt->GetParamName())
+                     : -1;
+    auto& level = combinations[phase];
+    if (level.empty()) {
+      level.emplace_back(nlohmann::json::object());
+    }
+    std::vector<nlohmann::json> combined;
+    for (auto& patch : level) {
+      for (uint32_t n = 0; n < opt->GetNumElements(); n++) {
+        auto next = patch;
+        next[opt->GetGroupName()][opt->GetParamName()] = opt->GetValue(n);
+        combined.push_back(next);
+      }
+    }
+    level = std::move(combined);
+  }
+  *roots = combinations.count(-1) != 0
+               ? combinations[-1]
+               : std::vector<nlohmann::json>{nlohmann::json::object()};
+  std::vector<ScenarioLevel> levels;
+  for (auto& entry : combinations) {
+    if (entry.first >= 0) {
+      levels.push_back({static_cast<uint8_t>(entry.first), entry.second});
+    }
+  }
+  return levels;
+}
+
+// Builds the plan of the levels `level, ...` of a scenario tree below a run
+// with the parameters `param`. The leaves are ordered by the patches of the
+// first level, then by those of the next level, etc., and their parameters
+// are appended to `leaves`. Adds the hours that the branches simulate to
+// `hours`, and numbers their runs from `*run` on.
+inline BranchPlan BuildScenarioTree(const std::vector<ScenarioLevel>& levels,
+                                    size_t level, const Param& param,
+                                    uint64_t* run, std::vector<Param>* leaves,
+                                    uint64_t* hours) {
+  BranchPlan plan;
+  plan.phase = levels[level].phase;
+  for (const auto& patch : levels[level].patches) {
+    Param branch(param);
+    branch.MergeJsonPatch(patch.dump());
+    const auto* sparam = branch.Get<SimParam>();
+    plan.patches.push_back(patch.dump());
+    plan.runs.push_back((*run)++);
+    auto end = level + 1 < levels.size() ? levels[level + 1].phase
+                                         : kNumPhases + 1;
+    *hours += PhaseStartHour(sparam, end) - PhaseStartHour(sparam, plan.phase);
+    if (level + 1 < levels.size()) {
+      plan.subplans.push_back(
+          BuildScenarioTree(levels, level + 1, branch, run, leaves, hours));
+    } else {
+      leaves->push_back(branch);
+    }
+  }
+  return plan;
+}
+
+// Sweeps over all combinations of the values of the optimization parameters,
+// like the "ParameterSweep" of the MultiSimulation, but as a tree of scenarios:
+// the points that only differ in parameters of later phases share the run up
+// to the phase at which they diverge, which is simulated once and forked (see
+// ForkBranches). All repetitions of the sweep are trees of their own, with
+// their own random numbers; within a tree, the points share the random numbers
+// up to their divergence. Reports the simulated hours against a flat sweep.
+inline void ScenarioTreeSweep(int argc, const char** argv, const Param* param,
+                              const std::string& output_dir) {
+  auto* opt_param = param->Get<OptimizationParam>();
+  std::vector<nlohmann::json> roots;
+  auto levels = GroupByDivergence(opt_param, &roots);
+  auto repetitions = std::max(opt_param->repetition, 1u);
+
+  TimeSeries observed;
+  ImportObservedData(&observed);
+
+  uint64_t tree_hours = 0;
+  uint64_t flat_hours = 0;
+  size_t points = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (const auto& root : roots) {
+    Param root_param(*param);
+    root_param.MergeJsonPatch(root.dump());
+    // The results per leaf, aggregated as the repetitions complete
+    std::vector<RepetitionAggregator> aggregates;
+    std::vector<Param> leaves;
+    for (uint32_t r = 0; r < repetitions; r++) {
+      leaves.clear();
+      uint64_t hours = 0;
+      std::vector<TimeSeries> tree_results;
+      if (levels.empty()) {
+        leaves.push_back(root_param);
+        hours = PhaseStartHour(root_param.Get<SimParam>(), kNumPhases + 1);
+        tree_results.resize(1);
+        Param run_param(root_param);
+        Simulate(argc, argv, &tree_results[0], &run_param);
+      } else {
+        // The root is the current run, the branches are numbered after it
+        uint64_t run = *GetRunIndex() + 1;
+        auto plan =
+            BuildScenarioTree(levels, 0, root_param, &run, &leaves, &hours);
+        hours += PhaseStartHour(root_param.Get<SimParam>(), plan.phase);
+        Param run_param(root_param);
+        TimeSeries unused;
+        SimulateImpl(argc, argv, &unused, &run_param, &plan, &tree_results);
+        *GetRunIndex() = run;
+      }
+      while (aggregates.size() < leaves.size()) {
+        aggregates.push_back(
+            MakeRepetitionAggregator(root_param.Get<SimParam>(), &observed));
+      }
+      for (size_t l = 0; l < leaves.size(); l++) {
+        aggregates[l].Add(tree_results[l]);
+      }
+      tree_hours += hours;
+      for (const auto& leaf : leaves) {
+        flat_hours += PhaseStartHour(leaf.Get<SimParam>(), kNumPhases + 1);
+      }
+    }
+
+    for (size_t l = 0; l < leaves.size(); l++) {
+      // The leaves whose metric has not converged over the repetitions of the
+      // tree get further repetitions of their own
+      while (NeedsMoreRepetitions(aggregates[l], repetitions,
+                                  leaves[l].Get<SimParam>())) {
+        TimeSeries result;
+        Param run_param(leaves[l]);
+        Simulate(argc, argv, &result, &run_param);
+        auto hours = PhaseStartHour(leaves[l].Get<SimParam>(), kNumPhases + 1);
+        tree_hours += hours;
+        flat_hours += hours;
+        aggregates[l].Add(result);
+      }
+      auto err = ComputeError(observed, aggregates[l].GetSummary());
+      ReportCalibrationError(err);
+      ExportResults(aggregates[l], leaves[l], err, output_dir);
+      points++;
+    }
+  }
+  std::chrono::duration<double> duration =
+      std::chrono::steady_clock::now() - start;
+  auto speedup =
+      static_cast<double>(flat_hours) / std::max<uint64_t>(tree_hours, 1);
+  std::cout << "Scenario tree: " << points << " points, " << tree_hours
+            << " simulated hours instead of " << flat_hours
+            << " for a flat sweep (speedup " << speedup << "), "
+            << duration.count() << " s" << std::endl;
+}
+
+}  // namespace bdm
+
+#endif  // SCENARIO_TREE_H_
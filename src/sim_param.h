@@ -22,15 +22,91 @@ class SimParam : public ParamGroup {
 
   // Amount of times to repeat the simulation (for statistical reasons)
   int repeat = 0;
-  // Mode at which to execute this simulation (single simulation or distributed
-  // fitting)
+  // Mode at which to execute this simulation (single simulation,
+  // "multi-fidelity" fitting, a "scenario-tree" sweep or distributed fitting)
   std::string mode = "sim-and-analytical";
   uint64_t population_size = 17000;
+  // Keep the persons read from the register data, including their travel
+  // schedules, for all simulations of this process (see PopulationCache).
+  // Lower resolutions are served from the cache without reading the register
+  // again. Note that the repetitions then share the same travel schedules.
+  bool cache_population = false;
+  // Select the agents from the register data stratified over (municipality,
+  // demography), such that each combination gets its proportional share (see
+  // StratifiedOrder), instead of a random subset
+  bool stratified_sampling = true;
+  // Merge the susceptible persons of municipalities without initial
+  // infections into super agents of this weight, per (municipality,
+  // demography). Once persons of a super agent get exposed, they are split off
+  // into agents of their own (1 disables super agents)
+  uint32_t super_agent_weight = 1;
+  // Run the municipalities without initial infections as a compartmental SEIR
+  // model per demography (see Metapopulation), until they have
+  // `metapopulation_threshold` infectious persons (in agent units). Only with
+  // register data; the persons that are not instantiated yet are kept in the
+  // PopulationCache. Their travel schedules are drawn anew for each run,
+  // unless `cache_population` is set. Disables `fast_forward_night`.
+  bool hybrid_metapopulation = false;
+  real_t metapopulation_threshold = 1;
+  // Destinations with a smaller share of the away hours of a municipality are
+  // dropped from the coupling between the compartmental municipalities
+  real_t metapopulation_mobility_cutoff = 0.001;
+  // Simulate the repetitions of "sim-and-analytical" in this many concurrent
+  // worker processes, each with an equal share of the threads (see
+  // RunConcurrentRepetitions)
+  uint32_t concurrent_repetitions = 1;
+  // Fork the repetitions of the same parameters from one simulation at the
+  // start of this phase (0 forks right after the population was built; -1
+  // disables it). The forked processes share the population copy-on-write and
+  // run with one thread each (see ForkBranches).
+  int fork_phase = -1;
+  // Simulate up to this many repetitions of the same parameters in one run:
+  // each person carries the disease courses of all repetitions (see
+  // DiseaseLanes), while the population, the travel schedules and the
+  // situations are shared. The other repetitions are returned by the next
+  // calls of Simulate with the same parameters. Requires `step_hours` 1,
+  // `super_agent_weight` 1 and no `hybrid_metapopulation`, and disables
+  // `fast_forward_night`.
+  uint32_t ensemble_lanes = 1;
   // Flag to export affected population per demography over time
   bool export_affected = false;
   real_t init_infection_rate = 0.1;
   int init_infection_time = 17 * 24;
+  // Stream the infectious persons per home municipality and the persons per
+  // location to a file per run every this many hours (see
+  // MunicipalitySeriesWriter; 0 disables it). ExportResults moves the files of
+  // the repetitions into the output directory of the experiment.
   int export_infected_per_timestep_frequency = 0;
+  // The directory of these files while the runs are simulated
+  std::string municipality_series_dir = "output/municipality_series";
+  // Compress these files with gzip (requires zlib)
+  bool compress_municipality_series = false;
+  // Besides appending each experiment to the ExperimentStore of the study,
+  // write a directory per experiment with its mean time series as CSV files
+  // and its param.json (see ExportResults)
+  bool experiment_directories = false;
+  // The exports of experiments that may be pending while the next ones are
+  // simulated (see ExportQueue); 0 exports them on the simulating thread
+  uint32_t export_queue_capacity = 2;
+  // Besides the median, export this quantile and its complement of the
+  // repetitions of an experiment per point (see RepetitionAggregator), e.g.
+  // 0.05. The estimators of the three quantiles take about as much memory as
+  // 25 repetitions; 0 only exports the mean and standard deviation.
+  real_t repetition_quantile = 0;
+  // Also store the full results of each repetition of an experiment, which
+  // are otherwise only aggregated as they complete
+  bool keep_repetitions = false;
+  // Add repetitions to an experiment beyond `repeat` (or the repetitions of
+  // the OptimizationParam) until the 95% confidence interval of the mean of
+  // `repetition_ci_metric` is narrower than this fraction of the mean on
+  // either side, up to `max_repetitions` (0 disables it; see
+  // NeedsMoreRepetitions). Not supported by the MultiSimulation, whose
+  // Experiment runs a fixed number of repetitions.
+  real_t repetition_ci_target = 0;
+  // The metric per repetition: "mse" against the observed data, or
+  // "peak_hospitalized"
+  std::string repetition_ci_metric = "mse";
+  uint64_t max_repetitions = 50;
   // Average number of interactions per day per person. From: https://journals.plos.org/plosmedicine/article?id=10.1371/journal.pmed.0050074
   real_t avg_interactions = 13.4;
   // Average number of interactions per day per person using the mixing matrices found in src/data/
@@ -74,6 +150,59 @@ class SimParam : public ParamGroup {
   int homestay_sigma = 6;
   real_t initial_infection_scaling = 10;
   real_t initial_exposed_infected_ratio = 3;
+  // Advance the night hours, in which no transmission happens, in a single
+  // sweep over the agents instead of one sweep per hour. The results are the
+  // same in distribution. Not used together with `--exportstats`
+  bool fast_forward_night = true;
+  // The number of hours per timestep; must divide 24 and the duration of each
+  // phase. With 1 (the reference) every hour is simulated. Larger values trade
+  // accuracy for speed, e.g. for parameter sweeps: situations and locations
+  // still follow the hourly schedules, and the disease timers advance by the
+  // step length, but the infected fractions are only updated once per step.
+  // A susceptible person gets infected with probability 1 - exp(-sum(lambda))
+  // over the hourly rates lambda of the step. Compared to the hourly
+  // reference, this probability is off by at most sum(lambda^2) / 2 per step,
+  // plus the effect of using the fractions of the start of the step, which
+  // are off by at most the fraction of persons that turn infectious within
+  // `step_hours` hours. Statistics are collected once per step.
+  uint32_t step_hours = 1;
+  // In the calibration modes (all but "sim-and-analytical" and
+  // "scenario-tree", see MayStopEarly), stop simulating after the last hour
+  // that ComputeError needs, and only record the hospitalizations. Off by
+  // default, such that sweeps record all series; the "multi-fidelity"
+  // calibration turns it on.
+  bool calibration_horizon = false;
+  // Abort a calibration run as soon as its error is known to exceed this
+  // threshold (0 disables it)
+  real_t abort_mse_threshold = 0;
+  // Abort a calibration run as soon as its error is known to exceed the best
+  // error of this process so far times this factor (0 disables it; the
+  // "multi-fidelity" calibration uses 1 then). Both abort rules only apply to
+  // calibrations with one repetition per point.
+  real_t abort_best_mse_factor = 0;
+  // Solve each calibration point with the deterministic metapopulation model
+  // first (see SolveAnalytical), and skip the agent run if its analytical error
+  // exceeds the best analytical error of this process times this factor (0
+  // disables the pre-screen)
+  real_t analytical_prescreen_factor = 0;
+  // Train a Gaussian process surrogate on the errors of all completed
+  // calibration points, persisted in this JSON file (empty disables it), and
+  // skip the agent runs of points that are confidently bad: their predicted
+  // error, `surrogate_confidence` standard deviations below the mean, exceeds
+  // the best error so far times `surrogate_skip_factor`. Points are only
+  // skipped once the surrogate has `surrogate_min_samples` samples. A new
+  // store can be trained on the output directories below
+  // `surrogate_import_dir`.
+  std::string surrogate_file = "";
+  std::string surrogate_import_dir = "";
+  real_t surrogate_confidence = 2;
+  real_t surrogate_skip_factor = 2;
+  uint32_t surrogate_min_samples = 10;
+  // The "multi-fidelity" mode screens the candidates at `fidelity_rungs`
+  // population sizes, each `fidelity_eta` times larger than the one before,
+  // and only promotes the best 1 / `fidelity_eta` of them to the next one
+  real_t fidelity_eta = 3;
+  uint32_t fidelity_rungs = 3;
 };
 
 }  // namespace bdm
@@ -0,0 +1,43 @@
+#ifndef STEP_CONTEXT_H_
+#define STEP_CONTEXT_H_
+
+#include <stdint.h>
+
+#include "core/simulation.h"
+
+#include "model_facts.h"
+
+namespace bdm {
+
+class CovidEnvironment;
+class SimParam;
+class UpdateStatisticsOp;
+
+/// Read-only state that is shared by all agents within one timestep. It is
+/// built once per timestep (see UpdateStepContextOp), such that the code that
+/// runs per agent does not have to look up the scheduler, the parameters or
+/// the operations of the simulation.
+struct StepContext {
+  uint64_t timestep = 0;
+  // The number of hours of a timestep, and the first hour of this timestep
+  uint32_t step_hours = 1;
+  uint64_t hour = 0;
+  uint8_t hour_of_day = 0;
+  uint16_t hour_of_week = 0;
+  uint8_t phase = 0;
+  HourRegime regime = HourRegime::kAsleep;
+  // True if the persons were already advanced past this timestep (see
+  // FastForwardAsleepHours), such that their behaviors must not run again
+  bool fast_forward = false;
+  // The transmission rate of the active phase
+  real_t beta = 0;
+  // The weight of `hour_of_day` in the daily sleep pattern
+  real_t sleep_weight = 0;
+  const SimParam* sparam = nullptr;
+  const CovidEnvironment* env = nullptr;
+  const UpdateStatisticsOp* stats = nullptr;
+};
+
+}  // namespace bdm
+
+#endif  // STEP_CONTEXT_H_
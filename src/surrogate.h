@@ -0,0 +1,474 @@
+#ifndef SURROGATE_H_
+#define SURROGATE_H_
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "biodynamo.h"
+#include "core/multi_simulation/optimization_param.h"
+
+#include <json.hpp>
+
+#include "experiment_store.h"
+#include "sim_param.h"
+
+namespace bdm {
+
+// Gaussian process regression with a squared exponential kernel. The inputs
+// are scaled to [0, 1] per dimension (over the training points), such that a
+// single length scale fits all parameters. The prior mean and variance are the
+// mean and variance of the training targets.
+class GaussianProcess {
+ public:
+  explicit GaussianProcess(real_t length_scale = 0.3,
+                           real_t relative_noise = 1e-2)
+      : length_scale_(length_scale), relative_noise_(relative_noise) {}
+
+  // Fits the process to the targets `y` at the points `x`
+  void Fit(const std::vector<std::vector<real_t>>& x,
+           const std::vector<real_t>& y) {
+    n_ = x.size();
+    dims_ = n_ == 0 ? 0 : x[0].size();
+    lower_.assign(dims_, std::numeric_limits<real_t>::infinity());
+    upper_.assign(dims_, -std::numeric_limits<real_t>::infinity());
+    for (const auto& point : x) {
+      for (size_t i = 0; i < dims_; i++) {
+        lower_[i] = std::min(lower_[i], point[i]);
+        upper_[i] = std::max(upper_[i], point[i]);
+      }
+    }
+    x_.clear();
+    for (const auto& point : x) {
+      x_.push_back(Scale(point));
+    }
+
+    mean_ = 0;
+    for (auto v : y) {
+      mean_ += v;
+    }
+    mean_ = n_ == 0 ? 0 : mean_ / n_;
+    variance_ = 0;
+    for (auto v : y) {
+      variance_ += (v - mean_) * (v - mean_);
+    }
+    variance_ = n_ < 2 ? 1 : std::max<real_t>(variance_ / (n_ - 1), 1e-12);
+
+    // Cholesky decomposition of the kernel matrix (lower triangular, row major)
+    chol_.assign(n_ * n_, 0);
+    for (size_t i = 0; i < n_; i++) {
+      for (size_t j = 0; j <= i; j++) {
+        real_t sum = Kernel(x_[i], x_[j]);
+        if (i == j) {
+          sum += relative_noise_ * variance_;
+        }
+        for (size_t k = 0; k < j; k++) {
+          sum -= chol_[i * n_ + k] * chol_[j * n_ + k];
+        }
+        chol_[i * n_ + j] = i == j ? std::sqrt(std::max<real_t>(sum, 1e-12))
+                                   : sum / chol_[j * n_ + j];
+      }
+    }
+    // alpha = K^-1 (y - mean)
+    alpha_.resize(n_);
+    for (size_t i = 0; i < n_; i++) {
+      alpha_[i] = y[i] - mean_;
+    }
+    SolveLower(&alpha_);
+    SolveUpper(&alpha_);
+  }
+
+  size_t GetNumPoints() const { return n_; }
+
+  // The predicted mean and variance at `point`
+  void Predict(const std::vector<real_t>& point, real_t* mean,
+               real_t* variance) const {
+    if (n_ == 0) {
+      *mean = 0;
+      *variance = std::numeric_limits<real_t>::infinity();
+      return;
+    }
+    auto scaled = Scale(point);
+    std::vector<real_t> k(n_);
+    *mean = mean_;
+    for (size_t i = 0; i < n_; i++) {
+      k[i] = Kernel(scaled, x_[i]);
+      *mean += k[i] * alpha_[i];
+    }
+    SolveLower(&k);
+    real_t explained = 0;
+    for (auto v : k) {
+      explained += v * v;
+    }
+    *variance = std::max<real_t>(variance_ - explained, 0);
+  }
+
+ private:
+  std::vector<real_t> Scale(const std::vector<real_t>& point) const {
+    std::vector<real_t> scaled(dims_);
+    for (size_t i = 0; i < dims_; i++) {
+      auto range = upper_[i] - lower_[i];
+      scaled[i] = range > 0 ? (point[i] - lower_[i]) / range : 0;
+    }
+    return scaled;
+  }
+
+  real_t Kernel(const std::vector<real_t>& a,
+                const std::vector<real_t>& b) const {
+    real_t distance = 0;
+    for (size_t i = 0; i < dims_; i++) {
+      distance += (a[i] - b[i]) * (a[i] - b[i]);
+    }
+    return variance_ *
+           std::exp(-distance / (2 * length_scale_ * length_scale_));
+  }
+
+  // Solves L z = v in place
+  void SolveLower(std::vector<real_t>* v) const {
+    for (size_t i = 0; i < n_; i++) {
+      for (size_t k = 0; k < i; k++) {
+        (*v)[i] -= chol_[i * n_ + k] * (*v)[k];
+      }
+      (*v)[i] /= chol_[i * n_ + i];
+    }
+  }
+
+  // Solves L^T z = v in place
+  void SolveUpper(std::vector<real_t>* v) const {
+    for (size_t i = n_; i-- > 0;) {
+      for (size_t k = i + 1; k < n_; k++) {
+        (*v)[i] -= chol_[k * n_ + i] * (*v)[k];
+      }
+      (*v)[i] /= chol_[i * n_ + i];
+    }
+  }
+
+  real_t length_scale_;
+  real_t relative_noise_;
+  size_t n_ = 0;
+  size_t dims_ = 0;
+  real_t mean_ = 0;
+  real_t variance_ = 1;
+  std::vector<real_t> lower_;
+  std::vector<real_t> upper_;
+  std::vector<std::vector<real_t>> x_;
+  std::vector<real_t> chol_;
+  std::vector<real_t> alpha_;
+};
+
+// Emulates the calibration error as a function of the optimization parameters
+// (see SimParam::surrogate_file). It is trained on the errors of all completed
+// experiments (see ExportResults), which are persisted in a JSON file, such
+// that later studies over the same parameters start with a trained surrogate.
+// Processes that share the file (e.g. the ranks of a calibration) merge their
+// samples into it (see Save). Each experiment is a sample only once,
+// identified by its UUID (or, if it has none, by its parameters and error),
+// however often it is imported. The Gaussian process models the logarithm of
+// the error, which varies more evenly than the error itself.
+class Surrogate {
+ public:
+  static Surrogate* GetInstance() {
+    static Surrogate kSurrogate;
+    return &kSurrogate;
+  }
+
+  // Uses the file `path` as the store of the samples, for the parameters that
+  // are optimized in `opt_param`. Samples of other parameters are dropped.
+  void Open(const std::string& path, const OptimizationParam* opt_param) {
+    std::vector<std::string> features;
+    for (auto* opt : opt_param->params) {
+      features.push_back(opt->GetGroupName() + "." + opt->GetParamName());
+    }
+    Open(path, features);
+  }
+
+  // Uses the file `path` as the store of the samples of the parameters
+  // `features`, each "<group>.<parameter>" (e.g. "bdm::SimParam.beta1")
+  void Open(const std::string& path, const std::vector<std::string>& features) {
+    if (path == path_ && features == features_) {
+      return;
+    }
+    path_ = path;
+    features_ = features;
+    samples_.clear();
+    errors_.clear();
+    ids_.clear();
+    known_ids_.clear();
+    known_points_.clear();
+    std::vector<std::vector<real_t>> samples;
+    std::vector<real_t> errors;
+    std::vector<std::string> ids;
+    ReadSamples(&samples, &errors, &ids);
+    for (size_t i = 0; i < samples.size(); i++) {
+      Insert(samples[i], errors[i], ids[i]);
+    }
+    fitted_ = false;
+    Log::Info("Surrogate", "Loaded ", samples_.size(), " samples from ", path_);
+  }
+
+  bool IsOpen() const { return !path_.empty(); }
+
+  // Adds the errors of the experiments that ExportResults wrote below `dir`
+  // (the experiment stores and param.json files), e.g. to train a new store
+  // on earlier studies. Experiments that are already samples are skipped.
+  void ImportExperiments(const std::string& dir) {
+    auto* handle = opendir(dir.c_str());
+    if (handle == nullptr) {
+      return;
+    }
+    size_t imported = 0;
+    while (auto* entry = readdir(handle)) {
+      std::string name = entry->d_name;
+      if (name == "." || name == "..") {
+        continue;
+      }
+      auto path = dir + "/" + name;
+      if (name == "param.json") {
+        // In the directory that is named after the experiment
+        std::ifstream file(path);
+        auto j = nlohmann::json::parse(file, nullptr, false);
+        imported += ImportExperiment(j, dir.substr(dir.rfind('/') + 1));
+      } else if (path == ExperimentStoreFile(dir)) {
+        std::vector<StoredExperiment> experiments;
+        ExperimentStore(path).Read(&experiments);
+        for (const auto& experiment : experiments) {
+          imported += ImportExperiment(
+              nlohmann::json::parse(experiment.param, nullptr, false),
+              experiment.uuid);
+        }
+      } else if (entry->d_type == DT_DIR) {
+        ImportExperiments(path);
+      }
+    }
+    closedir(handle);
+    if (imported != 0) {
+      fitted_ = false;
+      Save();
+    }
+  }
+
+  // Adds the error of the experiment `id` with the parameters `j` (see
+  // WriteResults). Returns whether it was new and usable: the error of an
+  // aborted run is only a lower bound, and skipped runs have none.
+  bool ImportExperiment(const nlohmann::json& j, const std::string& id) {
+    if (j.is_discarded() || !j.contains("mse") || !j["mse"].is_number() ||
+        j.value("aborted", false) || j.value("skipped", false)) {
+      return false;
+    }
+    return Insert(Features(j), j["mse"].get<real_t>(), id);
+  }
+
+  size_t GetNumSamples() const { return samples_.size(); }
+
+  // The values of the optimized parameters in the JSON representation of a
+  // Param (see Param::ToJsonString). Empty if one of them is missing.
+  std::vector<real_t> Features(const nlohmann::json& param) const {
+    std::vector<real_t> x;
+    for (const auto& feature : features_) {
+      auto dot = feature.find('.');
+      auto group = param.find(feature.substr(0, dot));
+      if (group == param.end()) {
+        return {};
+      }
+      auto value = group->find(feature.substr(dot + 1));
+      if (value == group->end() || !value->is_number()) {
+        return {};
+      }
+      x.push_back(value->get<real_t>());
+    }
+    return x;
+  }
+
+  // Adds the error of the completed experiment `id` and saves the store
+  void AddSample(const std::vector<real_t>& x, real_t mse,
+                 const std::string& id = "") {
+    if (Insert(x, mse, id)) {
+      Save();
+    }
+  }
+
+  // The lowest error of all samples
+  real_t GetBestError() const {
+    real_t best = std::numeric_limits<real_t>::infinity();
+    for (auto e : errors_) {
+      best = std::min(best, e);
+    }
+    return best;
+  }
+
+  // The predicted error at `x`, and the error that is `confidence` standard
+  // deviations (of the logarithm) below it
+  void Predict(const std::vector<real_t>& x, real_t confidence,
+               real_t* predicted, real_t* lower_bound) {
+    Fit();
+    real_t mean = 0;
+    real_t variance = 0;
+    gp_.Predict(x, &mean, &variance);
+    *predicted = std::exp(mean);
+    *lower_bound = std::exp(mean - confidence * std::sqrt(variance));
+  }
+
+  // Decides if the point `x` is confidently bad: even `confidence` standard
+  // deviations below its prediction, its error is above the best error so far
+  // times `factor`. Never skips before the surrogate has `min_samples`.
+  bool ShouldSkip(const std::vector<real_t>& x, const SimParam* sparam) {
+    if (x.size() != features_.size() ||
+        samples_.size() < sparam->surrogate_min_samples) {
+      return false;
+    }
+    real_t predicted = 0;
+    real_t lower_bound = 0;
+    Predict(x, sparam->surrogate_confidence, &predicted, &lower_bound);
+    return lower_bound > GetBestError() * sparam->surrogate_skip_factor;
+  }
+
+ private:
+  Surrogate() {}
+
+  // Adds a sample if it is valid and not known yet. Returns whether it was
+  // added.
+  bool Insert(const std::vector<real_t>& x, real_t mse,
+              const std::string& id) {
+    // Runs that were ruled out are reported with the largest error
+    if (x.size() != features_.size() || !std::isfinite(mse) || mse <= 0 ||
+        mse >= std::numeric_limits<real_t>::max() ||
+        (!id.empty() && known_ids_.count(id) != 0) ||
+        !known_points_.emplace(x, mse).second) {
+      return false;
+    }
+    if (!id.empty()) {
+      known_ids_.insert(id);
+    }
+    samples_.push_back(x);
+    errors_.push_back(mse);
+    ids_.push_back(id);
+    fitted_ = false;
+    return true;
+  }
+
+  void Fit() {
+    if (fitted_) {
+      return;
+    }
+    std::vector<real_t> log_errors(errors_.size());
+    for (size_t i = 0; i < errors_.size(); i++) {
+      log_errors[i] = std::log(errors_[i]);
+    }
+    gp_.Fit(samples_, log_errors);
+    fitted_ = true;
+  }
+
+  // Reads the samples of the store, if it has the same features
+  void ReadSamples(std::vector<std::vector<real_t>>* samples,
+                   std::vector<real_t>* errors,
+                   std::vector<std::string>* ids) const {
+    std::ifstream file(path_);
+    if (!file) {
+      return;
+    }
+    auto j = nlohmann::json::parse(file, nullptr, false);
+    if (j.is_discarded() ||
+        j.value("features", std::vector<std::string>()) != features_) {
+      return;
+    }
+    for (auto& sample : j["samples"]) {
+      samples->push_back(sample["x"].get<std::vector<real_t>>());
+      errors->push_back(sample["mse"].get<real_t>());
+      ids->push_back(sample.value("id", ""));
+    }
+  }
+
+  // Merges the samples that other processes saved in the meantime, and writes
+  // all of them. The store is locked with fcntl for the whole update (like
+  // the ExperimentStore), and written to a temporary file of this process
+  // first, such that it is never left half written.
+  void Save() {
+    auto lock_path = path_ + ".lock";
+    int fd = open(lock_path.c_str(), O_RDWR | O_CREAT, 0644);
+    struct flock lock = {};
+    lock.l_type = F_WRLCK;
+    lock.l_whence = SEEK_SET;
+    int locked = -1;
+    while (fd >= 0 && (locked = fcntl(fd, F_SETLKW, &lock)) != 0 &&
+           errno == EINTR) {
+    }
+    if (locked != 0) {
+      Log::Warning("Surrogate", "Could not lock ", lock_path);
+      if (fd >= 0) {
+        close(fd);
+      }
+      return;
+    }
+
+    std::vector<std::vector<real_t>> saved;
+    std::vector<real_t> saved_errors;
+    std::vector<std::string> saved_ids;
+    ReadSamples(&saved, &saved_errors, &saved_ids);
+    for (size_t i = 0; i < saved.size(); i++) {
+      Insert(saved[i], saved_errors[i], saved_ids[i]);
+    }
+
+    nlohmann::json j;
+    j["features"] = features_;
+    j["samples"] = nlohmann::json::array();
+    for (size_t i = 0; i < samples_.size(); i++) {
+      j["samples"].push_back(
+          {{"x", samples_[i]}, {"mse", errors_[i]}, {"id", ids_[i]}});
+    }
+    auto tmp = path_ + ".tmp." + std::to_string(getpid());
+    bool written = false;
+    {
+      std::ofstream file(tmp);
+      file << j.dump(2);
+      written = static_cast<bool>(file.flush());
+    }
+    if (!written || std::rename(tmp.c_str(), path_.c_str()) != 0) {
+      Log::Warning("Surrogate", "Could not write ", path_);
+      std::remove(tmp.c_str());
+    }
+    // Also releases the lock
+    close(fd);
+  }
+
+  std::string path_;
+  std::vector<std::string> features_;
+  std::vector<std::vector<real_t>> samples_;
+  std::vector<real_t> errors_;
+  // The UUIDs of the experiments of the samples (empty if not known)
+  std::vector<std::string> ids_;
+  std::set<std::string> known_ids_;
+  std::set<std::pair<std::vector<real_t>, real_t>> known_points_;
+  GaussianProcess gp_;
+  bool fitted_ = false;
+};
+
+// Opens the surrogate of this calibration if it is enabled (see
+// SimParam::surrogate_file). Returns nullptr otherwise.
+inline Surrogate* GetSurrogate(const Param* param) {
+  auto* sparam = param->Get<SimParam>();
+  auto* opt_param = param->Get<OptimizationParam>();
+  if (sparam->surrogate_file.empty() || opt_param->params.empty()) {
+    return nullptr;
+  }
+  auto* surrogate = Surrogate::GetInstance();
+  bool was_open = surrogate->IsOpen();
+  surrogate->Open(sparam->surrogate_file, opt_param);
+  if (!was_open && !sparam->surrogate_import_dir.empty()) {
+    surrogate->ImportExperiments(sparam->surrogate_import_dir);
+  }
+  return surrogate;
+}
+
+}  // namespace bdm
+
+#endif  // SURROGATE_H_
@@ -3,6 +3,7 @@
 
 #include "initialization.h"
 #include "mobility_data.h"
+#include "operations/update_step_context_op.h"
 #include "person.h"
 
 #define TEST_NAME typeid(*this).name()
@@ -29,9 +30,10 @@ TEST(ChangeBehavior, Run) {
   Person home_working_parent(Demographic::kHigherAgeWorking, 50, kFemale, 29, 29);
 
   ChangeSituationBehavior behavior;
-  behavior.Run(&unemployed_home_person);
-  behavior.Run(&middle_working);
-  behavior.Run(&home_working_parent);
+  auto ctx = MakeStepContext(&simulation);
+  behavior.Run(&unemployed_home_person, ctx);
+  behavior.Run(&middle_working, ctx);
+  behavior.Run(&home_working_parent, ctx);
 
   // Situations at midnight (timestep 0)
   EXPECT_EQ(kHome, unemployed_home_person.situation_);
@@ -40,9 +42,10 @@ TEST(ChangeBehavior, Run) {
 
   // Skip to 10 am
   simulation.Simulate(10);
-  behavior.Run(&unemployed_home_person);
-  behavior.Run(&middle_working);
-  behavior.Run(&home_working_parent);
+  ctx = MakeStepContext(&simulation);
+  behavior.Run(&unemployed_home_person, ctx);
+  behavior.Run(&middle_working, ctx);
+  behavior.Run(&home_working_parent, ctx);
 
   EXPECT_EQ(kHome, unemployed_home_person.situation_);
   EXPECT_EQ(kWork, middle_working.situation_);
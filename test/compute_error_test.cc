@@ -1,4 +1,5 @@
 #include <gtest/gtest.h>
+#include <numeric>
 #include "biodynamo.h"
 
 #include "data_processing_helpers.h"
@@ -18,4 +19,42 @@ TEST(CbsCovid, ImportObservedData) {
   EXPECT_EQ(15u, data.size());
 }
 
+TEST(CbsCovid, ComputeErrorUsesSimulatedHours) {
+  TimeSeries observed;
+  std::vector<real_t> observed_vec;
+  for (real_t hour = 384; hour <= 720; hour += kHoursPerDay) {
+    observed_vec.push_back(hour);
+  }
+  observed.Add("observed_hospitalization", {}, observed_vec);
+
+  // Hourly timesteps
+  std::vector<real_t> hours(800);
+  std::iota(hours.begin(), hours.end(), 0);
+  TimeSeries hourly;
+  hourly.Add("ts_hospitalized", hours, hours);
+  EXPECT_EQ(0, ComputeError(observed, hourly));
+
+  // Timesteps of 4 hours: the x-value is the last hour of each timestep, so
+  // the samples at 3:00, 7:00, ... are used, and 23:00 for the end of the day
+  std::vector<real_t> coarse_hours;
+  for (real_t hour = 3; hour < 800; hour += 4) {
+    coarse_hours.push_back(hour);
+  }
+  TimeSeries coarse;
+  coarse.Add("ts_hospitalized", coarse_hours, coarse_hours);
+  EXPECT_NEAR(1, ComputeError(observed, coarse), 1e-9);
+}
+
+TEST(CbsCovid, PartialError) {
+  std::vector<real_t> observed = {1, 2, 3, 4};
+  EXPECT_EQ(0, PartialError(observed, {}));
+  // (1 + 4) / 4, the missing values count as zero
+  EXPECT_NEAR(1.25, PartialError(observed, {2, 4}), 1e-9);
+  EXPECT_NEAR(1.5, PartialError(observed, {2, 4, 3, 3}), 1e-9);
+
+  EXPECT_EQ(721u, GetCalibrationHorizon(1));
+  EXPECT_EQ(724u, GetCalibrationHorizon(4));
+  EXPECT_EQ(744u, GetCalibrationHorizon(24));
+}
+
 }  // namespace bdm
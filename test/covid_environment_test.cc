@@ -17,28 +17,76 @@ TEST(CovidEnvironment, AdjustMixingMatrices) {
 
   simulation.SetEnvironment(env);
 
-  auto& mixmat_home = env->GetMixingMatrix(kHome);
-  auto& mixmat_work = env->GetMixingMatrix(kWork);
-  auto& mixmat_other = env->GetMixingMatrix(kOther);
-  auto& mixmat_school = env->GetMixingMatrix(kSchool);
-  auto& mixmat_workschool = env->GetMixingMatrix(kWorkSchool);
+  auto eps = abs_error<real_t>::value;
+  EXPECT_EQ(0u, env->GetPhase());
+  EXPECT_NEAR(6.874619913482362676e-01, env->GetMixingMatrix(kHome)[0][0], eps);
+  EXPECT_NEAR(6.997546340816274135e-02, env->GetMixingMatrix(kWork)[3][2], eps);
+  EXPECT_NEAR(1.474070253869433467e+00, env->GetMixingMatrix(kOther)[10][6], eps);
+  EXPECT_NEAR(1.884050302777406927e+00, env->GetMixingMatrix(kSchool)[2][1], eps);
+  EXPECT_NEAR(2.707680440007707912e+00, env->GetMixingMatrix(kWorkSchool)[1][1], eps);
+
+  AdjustMixingMatrices(1);
+
+  EXPECT_NEAR(6.874619913482362676e-01 * 1.915564191997508603e-01, env->GetMixingMatrix(kHome)[0][0], eps);
+  EXPECT_NEAR(6.997546340816274135e-02 * 2.490211607097619906e-01, env->GetMixingMatrix(kWork)[3][2], eps);
+
+  // Phase 3 keeps the contact structure of phase 2
+  AdjustMixingMatrices(2);
+
+  EXPECT_NEAR(6.874619913482362676e-01 * 1.915564191997508603e-01, env->GetMixingMatrix(kHome)[0][0], eps);
+  EXPECT_NEAR(6.997546340816274135e-02 * 2.490211607097619906e-01, env->GetMixingMatrix(kWork)[3][2], eps);
+
+  AdjustMixingMatrices(3);
+
+  EXPECT_NEAR(6.874619913482362676e-01 * 1.915564191997508603e-01 * 1.553163510433659189e+00, env->GetMixingMatrix(kHome)[0][0], eps);
+  EXPECT_NEAR(6.997546340816274135e-02 * 2.490211607097619906e-01 * 5.313340380932151108e-01, env->GetMixingMatrix(kWork)[3][2], eps);
+}
+
+// Phase changes do not depend on the history of previous phase changes
+TEST(CovidEnvironment, JumpToPhase) {
+  Simulation simulation(TEST_NAME);
+
+  CovidEnvironment* env = new CovidEnvironment();
+
+  simulation.SetEnvironment(env);
 
   auto eps = abs_error<real_t>::value;
-  EXPECT_NEAR(6.874619913482362676e-01, mixmat_home[0][0], eps);
-  EXPECT_NEAR(6.997546340816274135e-02, mixmat_work[3][2], eps);
-  EXPECT_NEAR(1.474070253869433467e+00, mixmat_other[10][6], eps);
-  EXPECT_NEAR(1.884050302777406927e+00, mixmat_school[2][1], eps);
-  EXPECT_NEAR(2.707680440007707912e+00, mixmat_workschool[1][1], eps);
+  AdjustMixingMatrices(3);
+  EXPECT_NEAR(6.874619913482362676e-01 * 1.915564191997508603e-01 * 1.553163510433659189e+00, env->GetMixingMatrix(kHome)[0][0], eps);
 
   AdjustMixingMatrices(0);
+  EXPECT_NEAR(6.874619913482362676e-01, env->GetMixingMatrix(kHome)[0][0], eps);
 
-  EXPECT_NEAR(6.874619913482362676e-01 * 1.915564191997508603e-01, mixmat_home[0][0], eps);
-  EXPECT_NEAR(6.997546340816274135e-02 * 2.490211607097619906e-01, mixmat_work[3][2], eps);
+  AdjustMixingMatrices(3);
+  EXPECT_NEAR(6.874619913482362676e-01 * 1.915564191997508603e-01 * 1.553163510433659189e+00, env->GetMixingMatrix(kHome)[0][0], eps);
+}
 
-  AdjustMixingMatrices(2);
+TEST(Interventions, HomeStayShares) {
+  SimParam sparam;
+  sparam.phase_2_mobility_reduction = 0.05;
+  sparam.phase_3_mobility_reduction = 0.1;
+  sparam.phase_2_homeschooling_parents = 0.01;
+  std::array<real_t, kNumDemographies> population;
+  population.fill(100);
+
+  // The reductions are floats
+  const real_t eps = 1e-5;
+  auto shares = HomeStayShares(&sparam, 0, population);
+  for (auto share : shares) {
+    EXPECT_EQ(0, share);
+  }
+
+  // 55 workers at home, spread evenly, plus 11 homeschooling parents
+  shares = HomeStayShares(&sparam, 1, population);
+  EXPECT_NEAR(1, shares[kPrimarySchoolChildren], eps);
+  EXPECT_NEAR(0.275, shares[kHigherAgeWorking], eps);
+  EXPECT_NEAR(0.385, shares[kMiddleAgeWorking], eps);
+  EXPECT_EQ(0, shares[kElderly]);
 
-  EXPECT_NEAR(6.874619913482362676e-01 * 1.915564191997508603e-01 * 1.553163510433659189e+00, mixmat_home[0][0], eps);
-  EXPECT_NEAR(6.997546340816274135e-02 * 2.490211607097619906e-01 * 5.313340380932151108e-01, mixmat_work[3][2], eps);
+  // 55 more workers, spread over the 72.5 + 61.5 that are not at home yet
+  shares = HomeStayShares(&sparam, 2, population);
+  EXPECT_NEAR(0.275 + 0.55 * 72.5 / 134, shares[kHigherAgeWorking], eps);
+  EXPECT_NEAR(0.385 + 0.55 * 61.5 / 134, shares[kMiddleAgeWorking], eps);
 }
 
 }  // namespace bdm
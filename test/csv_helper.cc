@@ -1,4 +1,6 @@
 #include <gtest/gtest.h>
+#include <cmath>
+#include <fstream>
 #include "biodynamo.h"
 
 #include "csv_helper.h"
@@ -44,4 +46,79 @@ TEST(CsvHelper, CsvToVector) {
   EXPECT_EQ(kNumMunicipalities, municipality_population_.size());
 }
 
+// Writes `content` to a file named after the test
+inline std::string WriteCsv(const std::string& name,
+                            const std::string& content) {
+  auto file = name + ".csv";
+  std::ofstream out(file, std::ios::binary);
+  out << content;
+  return file;
+}
+
+TEST(CsvHelper, ParseCsv) {
+  auto file = WriteCsv(TEST_NAME,
+                       "code,value\r\n\"1680\",0.5\r\n738, 2e3 \r\n\n"
+                       "9,n/a\n4\n");
+  CsvTable<float> table;
+  CsvOptions options;
+  options.header_row = 0;
+  EXPECT_EQ("", ParseCsv(file, options, &table));
+  ASSERT_EQ(4u, table.rows);
+  ASSERT_EQ(2u, table.cols);
+  EXPECT_EQ(1680.f, table[0][0]);
+  EXPECT_EQ(0.5f, table[0][1]);
+  EXPECT_EQ(2000.f, table[1][1]);
+  EXPECT_TRUE(std::isnan(table[2][1]));
+  EXPECT_EQ(4.f, table[3][0]);
+  // "n/a" and the missing value of the ragged last row
+  EXPECT_TRUE(std::isnan(table[3][1]));
+  EXPECT_EQ(2u, table.invalid);
+
+  CsvTable<int> codes;
+  options.column = 0;
+  EXPECT_EQ("", ParseCsv(file, options, &codes));
+  EXPECT_EQ((std::vector<int>{1680, 738, 9, 4}), codes.values);
+
+  options.column = 1;
+  options.validate = true;
+  EXPECT_NE("", ParseCsv(file, options, &table));
+  options.column = -1;
+  EXPECT_NE("", ParseCsv("missing.csv", options, &table));
+  remove(file.c_str());
+}
+
+TEST(CsvHelper, ParseCsvColumns) {
+  auto file = WriteCsv(TEST_NAME, "a,b,c,d\n1,2,3,4\n5,x,7,8,9\n10,11\n");
+  CsvTable<int> table;
+  CsvOptions options;
+  options.header_row = 0;
+  options.columns = {3, 0, 1};
+  EXPECT_EQ("", ParseCsv(file, options, &table));
+  ASSERT_EQ(3u, table.rows);
+  ASSERT_EQ(3u, table.cols);
+  EXPECT_EQ((std::vector<int>{4, 1, 2, 8, 5, 0, 0, 10, 11}), table.values);
+  // "x" and the missing column of the last row
+  EXPECT_EQ(2u, table.invalid);
+
+  options.validate = true;
+  options.columns = {0, 2};
+  auto error = ParseCsv(file, options, &table);
+  EXPECT_NE(std::string::npos, error.find("line 4 has no column 3")) << error;
+  options.columns = {1, 1};
+  EXPECT_NE("", ParseCsv(file, options, &table));
+  remove(file.c_str());
+}
+
+TEST(CsvHelper, ParseCsvValidate) {
+  auto file = WriteCsv(TEST_NAME, "1,2,3\n4,5\n");
+  CsvTable<double> table;
+  CsvOptions options;
+  EXPECT_EQ("", ParseCsv(file, options, &table));
+  EXPECT_EQ(6u, table.values.size());
+  options.validate = true;
+  auto error = ParseCsv(file, options, &table);
+  EXPECT_NE(std::string::npos, error.find("line 2")) << error;
+  remove(file.c_str());
+}
+
 }  // namespace bdm
@@ -0,0 +1,74 @@
+#include <gtest/gtest.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "biodynamo.h"
+
+#include "experiment_store.h"
+
+#define TEST_NAME typeid(*this).name()
+
+namespace bdm {
+
+TEST(ExperimentStore, AppendAndRead) {
+  ExperimentStore store(std::string(TEST_NAME) + ".store");
+  remove(store.GetPath().c_str());
+  remove(store.GetIndexPath().c_str());
+
+  StoredSeries hospitalized;
+  hospitalized.name = "ts_hospitalized";
+  hospitalized.x = {0, 1, 2};
+  hospitalized.y = {3, 4, 5};
+  hospitalized.y_error_low = {2, 3, 4};
+  hospitalized.y_error_high = {4, 5, 6};
+  StoredSeries exposed;
+  exposed.name = "ts_exposed";
+  exposed.x = {0, 1};
+  exposed.y = {7, 8};
+
+  // Concurrent writers, e.g. the ranks of a calibration
+  const int kWriters = 4;
+  const int kAppends = 25;
+  std::vector<pid_t> pids;
+  for (int w = 0; w < kWriters; w++) {
+    auto pid = fork();
+    if (pid == 0) {
+      bool appended = true;
+      for (int a = 0; a < kAppends; a++) {
+        auto param = "{\"writer\": " + std::to_string(w) + "}";
+        appended &= store.Append("uuid-" + std::to_string(w), param,
+                                 w + 0.5, {hospitalized, exposed});
+      }
+      _exit(appended ? 0 : 1);
+    }
+    pids.push_back(pid);
+  }
+  for (auto pid : pids) {
+    int status = 0;
+    waitpid(pid, &status, 0);
+    EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  }
+
+  std::vector<StoredExperiment> experiments;
+  ASSERT_TRUE(store.Read(&experiments));
+  ASSERT_EQ(static_cast<size_t>(kWriters * kAppends), experiments.size());
+  std::vector<int> per_writer(kWriters);
+  for (const auto& experiment : experiments) {
+    auto w = experiment.uuid.back() - '0';
+    ASSERT_TRUE(w >= 0 && w < kWriters);
+    per_writer[w]++;
+    EXPECT_EQ("{\"writer\": " + std::to_string(w) + "}", experiment.param);
+    EXPECT_EQ(w + 0.5, experiment.mse);
+    ASSERT_EQ(2u, experiment.series.size());
+    EXPECT_EQ(hospitalized.y, experiment.series[0].y);
+    EXPECT_EQ(hospitalized.y_error_high, experiment.series[0].y_error_high);
+    EXPECT_EQ("ts_exposed", experiment.series[1].name);
+    EXPECT_EQ(exposed.x, experiment.series[1].x);
+    EXPECT_TRUE(experiment.series[1].y_error_low.empty());
+  }
+  EXPECT_EQ(std::vector<int>(kWriters, kAppends), per_writer);
+
+  remove(store.GetPath().c_str());
+  remove(store.GetIndexPath().c_str());
+}
+
+}  // namespace bdm
@@ -0,0 +1,56 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <vector>
+#include "biodynamo.h"
+
+#include "export_queue.h"
+
+#define TEST_NAME typeid(*this).name()
+
+namespace bdm {
+
+TEST(ExportQueue, RunsInOrderWithBoundedBacklog) {
+  ExportQueue queue(2);
+  std::atomic<int> pending(0);
+  std::atomic<int> max_pending(0);
+  std::vector<int> order;
+  for (int i = 0; i < 10; i++) {
+    auto now = ++pending;
+    max_pending = std::max(max_pending.load(), now);
+    EXPECT_EQ("", queue.Push([&, i]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds(2));
+      order.push_back(i);
+      pending--;
+    }));
+  }
+  EXPECT_EQ("", queue.Flush());
+  EXPECT_EQ((std::vector<int>{0, 1, 2, 3, 4, 5, 6, 7, 8, 9}), order);
+  // Push waits while two tasks are pending, so at most three have been
+  // handed over and not finished yet
+  EXPECT_LE(max_pending.load(), 3);
+}
+
+TEST(ExportQueue, PropagatesErrors) {
+  ExportQueue queue(2);
+  int ran = 0;
+  queue.Push([&]() { throw std::runtime_error("disk full"); });
+  queue.Wait();
+  // Tasks after the failed one are not run, and the error is reported
+  EXPECT_EQ("disk full", queue.Push([&]() { ran++; }));
+  EXPECT_EQ("disk full", queue.Flush());
+  EXPECT_EQ(0, ran);
+  // The error is reported once
+  EXPECT_EQ("", queue.Push([&]() { ran++; }));
+  EXPECT_EQ("", queue.Flush());
+  EXPECT_EQ(1, ran);
+
+  queue.SetCapacity(0);
+  EXPECT_EQ("synchronous",
+            queue.Push([]() { throw std::runtime_error("synchronous"); }));
+  EXPECT_EQ("synchronous", queue.Flush());
+}
+
+}  // namespace bdm
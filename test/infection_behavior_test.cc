@@ -0,0 +1,109 @@
+#include <gtest/gtest.h>
+#include "biodynamo.h"
+
+#include "behaviors/infection_behavior.h"
+#include "disease_lanes.h"
+#include "person.h"
+#include "step_context.h"
+
+#define TEST_NAME typeid(*this).name()
+
+namespace bdm {
+
+TEST(InfectionBehavior, FastForwardEqualsHourlyUpdates) {
+  Simulation simulation(TEST_NAME);
+  auto* random = simulation.GetRandom();
+
+  InfectionBehavior hourly;
+  hourly.initialized_ = true;
+  hourly.hospitalize_person_ = true;
+  hourly.incubation_time_threshold_ = 5;
+  hourly.infection_time_threshold_ = 20;
+  hourly.hospitalization_time_threshold_ = 10;
+  hourly.hospital_length_of_stay_ = 10;
+  InfectionBehavior fast_forwarded = hourly;
+
+  Person p1(Demographic::kHigherAgeUnemployed);
+  p1.state_ = State::kExposed;
+  Person p2(Demographic::kHigherAgeUnemployed);
+  p2.state_ = State::kExposed;
+
+  StepContext ctx;
+  std::vector<bool> hospitalized;
+  // Exceeds all thresholds, such that every state is visited
+  for (int i = 0; i < 100; i++) {
+    hourly.Update<false>(&p1, ctx);
+    hospitalized.push_back(p1.hospitalized_);
+  }
+
+  std::vector<bool> reported(100, false);
+  int all_hours = 0;
+  // In two steps, such that the second one takes the shortcut for recovered
+  // persons that are done with the hospital
+  fast_forwarded.FastForward(
+      &p2, 60, random,
+      [&](uint32_t h, Person* p) { reported[h] = p->hospitalized_; },
+      [&](Person* p) { all_hours++; });
+  fast_forwarded.FastForward(
+      &p2, 40, random,
+      [&](uint32_t h, Person* p) { reported[60 + h] = p->hospitalized_; },
+      [&](Person* p) { all_hours++; });
+
+  EXPECT_EQ(p1.state_, p2.state_);
+  EXPECT_EQ(State::kRecovered, p2.state_);
+  EXPECT_EQ(p1.hospitalized_, p2.hospitalized_);
+  EXPECT_EQ(hourly.hospitalization_time_, fast_forwarded.hospitalization_time_);
+  EXPECT_EQ(hourly.time_in_hospital_, fast_forwarded.time_in_hospital_);
+  EXPECT_EQ(1, all_hours);
+  EXPECT_EQ(hospitalized, reported);
+}
+
+TEST(InfectionBehavior, LanesProgressLikeUpdate) {
+  Simulation simulation(TEST_NAME);
+
+  InfectionBehavior hourly;
+  hourly.initialized_ = true;
+  hourly.hospitalize_person_ = true;
+  hourly.incubation_time_threshold_ = 5;
+  hourly.infection_time_threshold_ = 20;
+  hourly.hospitalization_time_threshold_ = 10;
+  hourly.hospital_length_of_stay_ = 10;
+
+  Person p1(Demographic::kHigherAgeUnemployed);
+  p1.state_ = State::kExposed;
+  // Lane 0 follows `hourly`, lane 1 is never hospitalized and lane 2 stays
+  // susceptible
+  Person p2(Demographic::kHigherAgeUnemployed);
+  p2.lanes_.assign(DiseaseLanes::kNumFields * 3, 0);
+  DiseaseLanes lanes(&p2);
+  for (uint32_t l = 0; l < 3; l++) {
+    lanes[DiseaseLanes::kState][l] =
+        l < 2 ? State::kExposed : State::kSusceptible;
+    lanes[DiseaseLanes::kFlags][l] = l == 0 ? DiseaseLanes::kHospitalize : 0;
+    lanes[DiseaseLanes::kIncubationThreshold][l] = 5;
+    lanes[DiseaseLanes::kInfectionThreshold][l] = 20;
+    lanes[DiseaseLanes::kHospitalizationThreshold][l] = 10;
+    lanes[DiseaseLanes::kLengthOfStay][l] = 10;
+  }
+
+  StepContext ctx;
+  bool ever_hospitalized = false;
+  for (int i = 0; i < 100; i++) {
+    hourly.Update<false>(&p1, ctx);
+    InfectionBehavior::UpdateLanes<false>(&p2, ctx);
+    auto flags = lanes[DiseaseLanes::kFlags];
+    EXPECT_EQ(p1.hospitalized_, (flags[0] & DiseaseLanes::kHospitalized) != 0);
+    EXPECT_EQ(p1.state_, lanes[DiseaseLanes::kState][0]);
+    EXPECT_EQ(p1.state_, lanes[DiseaseLanes::kState][1]);
+    EXPECT_EQ(0u, flags[1] & DiseaseLanes::kHospitalized);
+    ever_hospitalized |= p1.hospitalized_;
+  }
+  EXPECT_TRUE(ever_hospitalized);
+  EXPECT_EQ(State::kRecovered, p1.state_);
+  EXPECT_EQ(State::kSusceptible, lanes[DiseaseLanes::kState][2]);
+  EXPECT_EQ(hourly.hospitalization_time_,
+            lanes[DiseaseLanes::kHospitalizationTime][0]);
+  EXPECT_EQ(hourly.time_in_hospital_, lanes[DiseaseLanes::kTimeInHospital][0]);
+}
+
+}  // namespace bdm
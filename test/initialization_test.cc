@@ -1,4 +1,5 @@
 #include <gtest/gtest.h>
+#include <numeric>
 #include "biodynamo.h"
 
 #include "initialization.h"
@@ -11,6 +12,7 @@ namespace bdm {
 TEST(Initialization, InitializeWeeklyTravelSchedule) {
   Param::RegisterParamGroup(new SimParam());
   Simulation simulation(TEST_NAME);
+  simulation.SetEnvironment(new CovidEnvironment());
   InitializeMobilityData();
   Person person;
 
@@ -58,4 +60,40 @@ TEST(Initialization, WorkstatusToDemographic) {
 TEST(Initialization, MunicipalityToLocation) {
 }
 
+TEST(Initialization, PopulationCache) {
+  auto* cache = PopulationCache::GetInstance();
+  cache->SetSource(TEST_NAME, true, 0);
+  EXPECT_EQ(0u, cache->GetNumPersons());
+
+  Person person(kStudents, 20, kFemale, 3, 3);
+  auto* schedule = person.GetWeeklyTravelSchedule();
+  std::iota(schedule->begin(), schedule->end(), 0);
+  cache->Resize(2);
+  cache->Store(1, person);
+
+  Person restored;
+  cache->RestoreSchedule(1, &restored);
+  EXPECT_EQ(*schedule, *restored.GetWeeklyTravelSchedule());
+  EXPECT_EQ(kStudents, cache->GetDemography(1));
+  EXPECT_EQ(20, cache->GetAge(1));
+  EXPECT_EQ(kFemale, cache->GetGender(1));
+  EXPECT_EQ(3, cache->GetMunicipality(1));
+
+  // The same key keeps the persons
+  cache->SetSource(TEST_NAME, true, 0);
+  EXPECT_EQ(2u, cache->GetNumPersons());
+
+  // A different order of the register rows invalidates the cache
+  cache->SetSource(TEST_NAME, false, 0);
+  EXPECT_EQ(0u, cache->GetNumPersons());
+  cache->Resize(2);
+  cache->SetSource(TEST_NAME, false, 1);
+  EXPECT_EQ(0u, cache->GetNumPersons());
+
+  // A different source invalidates the cache
+  cache->Resize(2);
+  cache->SetSource("other", false, 1);
+  EXPECT_EQ(0u, cache->GetNumPersons());
+}
+
 }  // namespace bdm
@@ -0,0 +1,80 @@
+#include <gtest/gtest.h>
+#include "biodynamo.h"
+
+#include "input_bundle.h"
+
+#define TEST_NAME typeid(*this).name()
+
+namespace bdm {
+
+TEST(InputBundle, MatchesInputFiles) {
+  const auto& bundle = InputBundle::Get();
+  auto m_freq = bundle.GetMatrix<float>("M_freq.csv");
+  ASSERT_EQ(kNumMunicipalities, m_freq.size());
+  ASSERT_EQ(kNumMunicipalities, m_freq.GetNumCols());
+  EXPECT_NEAR(920436.79643959f, m_freq[1][0], 1e-9);
+  EXPECT_NEAR(7118231.18197822f, m_freq[7][1], 1e-9);
+
+  auto population = bundle.GetArray<uint32_t>("inwoners_gemeente_2018.csv");
+  ASSERT_EQ(kNumMunicipalities, population.size());
+  EXPECT_EQ(25390u, population[0]);
+
+  MatrixView<real_t> mix_h;
+  auto path = GetDataDir() + "/Mix_h.csv";
+  ASSERT_TRUE(bundle.Lookup(path, true, 0, -1, &mix_h));
+  EXPECT_EQ(kNumDemographies, mix_h.size());
+  EXPECT_EQ(kNumDemographies, mix_h.GetNumCols());
+  // Read in another way than the bundle, or from another directory
+  EXPECT_FALSE(bundle.Lookup(path, true, 0, 0, &mix_h));
+  EXPECT_FALSE(bundle.Lookup("/elsewhere/Mix_h.csv", true, 0, -1, &mix_h));
+}
+
+TEST(InputBundle, BundleFile) {
+  auto file = std::string(TEST_NAME) + "_input_bundle.bin";
+  ASSERT_TRUE(InputBundle::WriteFile(GetDataDir(), file));
+  InputBundle from_file(GetDataDir(), file);
+  EXPECT_TRUE(from_file.IsFromFile());
+  auto observed = InputBundle::Get().GetArray<real_t>(
+      "observed_hospital_doubling.csv");
+  auto observed_from_file =
+      from_file.GetArray<real_t>("observed_hospital_doubling.csv");
+  ASSERT_EQ(observed.size(), observed_from_file.size());
+  EXPECT_TRUE(std::equal(observed.begin(), observed.end(),
+                         observed_from_file.begin()));
+  remove(file.c_str());
+}
+
+TEST(InputBundle, SharedBetweenInstances) {
+  const auto& bundle = InputBundle::Get();
+  InputBundle other(GetDataDir());
+  EXPECT_EQ(bundle.GetName(), other.GetName());
+  EXPECT_EQ(bundle.IsShared(), other.IsShared());
+  auto codes = bundle.GetArray<uint32_t>("Gemeenten2018.csv");
+  auto other_codes = other.GetArray<uint32_t>("Gemeenten2018.csv");
+  ASSERT_EQ(codes.size(), other_codes.size());
+  EXPECT_TRUE(std::equal(codes.begin(), codes.end(), other_codes.begin()));
+}
+
+TEST(InputBundle, ReplacesCorruptSegment) {
+  InputBundle::Unlink(GetDataDir());
+  auto name = InputBundle(GetDataDir()).GetName();
+  InputBundle::Unlink(GetDataDir());
+  // A segment that was not completed by its creator
+  int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+  ASSERT_LE(0, fd);
+  std::vector<char> garbage(4096, 1);
+  ASSERT_EQ(static_cast<ssize_t>(garbage.size()),
+            write(fd, garbage.data(), garbage.size()));
+  close(fd);
+
+  InputBundle replaced(GetDataDir());
+  EXPECT_TRUE(replaced.IsShared());
+  InputBundle attached(GetDataDir());
+  EXPECT_TRUE(attached.IsShared());
+  auto codes = InputBundle::Get().GetArray<uint32_t>("Gemeenten2018.csv");
+  auto attached_codes = attached.GetArray<uint32_t>("Gemeenten2018.csv");
+  ASSERT_EQ(codes.size(), attached_codes.size());
+  EXPECT_TRUE(std::equal(codes.begin(), codes.end(), attached_codes.begin()));
+}
+
+}  // namespace bdm
@@ -0,0 +1,84 @@
+#include <gtest/gtest.h>
+#include "biodynamo.h"
+
+#include "metapopulation.h"
+
+#define TEST_NAME typeid(*this).name()
+
+namespace bdm {
+
+// Residents of municipality 0 spend their away hours in municipality 0 and 1;
+// all others stay at home
+Metapopulation MakeMetapopulation() {
+  std::vector<std::vector<float>> mobility(
+      kNumMunicipalities, std::vector<float>(kNumMunicipalities, 0));
+  for (size_t m = 0; m < kNumMunicipalities; m++) {
+    mobility[m][m] = 1;
+  }
+  mobility[0][1] = 1;
+  // Below the cutoff
+  mobility[0][2] = 0.0001;
+  Metapopulation meta;
+  meta.SetMobility(mobility, mobility, 0.001);
+  return meta;
+}
+
+TEST(Metapopulation, Mobility) {
+  auto meta = MakeMetapopulation();
+  // Students do not scale their home share (see kDemographyHomeStayScaling)
+  const auto& destinations = meta.GetDestinations(0, kStudents);
+  ASSERT_EQ(2u, destinations.size());
+  EXPECT_EQ(0u, destinations[0].location);
+  EXPECT_EQ(1u, destinations[1].location);
+  EXPECT_NEAR(0.5, destinations[0].share, 1e-6);
+  EXPECT_NEAR(0.5, destinations[1].share, 1e-6);
+  ASSERT_EQ(1u, meta.GetDestinations(1, kStudents).size());
+}
+
+TEST(Metapopulation, StepAndPresence) {
+  auto meta = MakeMetapopulation();
+  for (size_t i = 0; i < 100; i++) {
+    meta.AddMember(0, kStudents, i);
+  }
+  meta.GetCompartments(0, kStudents).susceptible -= 10;
+  meta.GetCompartments(0, kStudents).exposed += 10;
+  TransitionRates rates;
+  rates.incubation = 0.1;
+  rates.recovery = 0.1;
+  meta.SetRates(rates);
+
+  // Nobody is infectious yet, so only the exposed progress
+  MunicipalityGrid fractions{};
+  ContactRates contacts{};
+  for (auto& row : contacts) {
+    row.fill(1);
+  }
+  meta.Step(12, 1, contacts, fractions);
+  const auto& c = meta.GetCompartments(0, kStudents);
+  EXPECT_NEAR(90, c.susceptible, 1e-6);
+  EXPECT_NEAR(10 * std::exp(-0.1), c.exposed, 1e-6);
+  EXPECT_NEAR(100, c.Total(), 1e-6);
+  EXPECT_LT(0, meta.GetInfectious(0));
+
+  // Infected fractions elsewhere infect the residents that travel there
+  fractions[1][kStudents] = 0.5;
+  meta.Step(12, 1, contacts, fractions);
+  EXPECT_GT(90, c.susceptible);
+  EXPECT_NEAR(100, c.Total(), 1e-6);
+
+  // During the day, half of the away hours are spent in municipality 1
+  MunicipalityGrid total{};
+  MunicipalityGrid infectious{};
+  meta.AddPresence(HourRegime::kDaytime, &total, &infectious);
+  EXPECT_NEAR(50, total[0][kStudents], 1e-6);
+  EXPECT_NEAR(50, total[1][kStudents], 1e-6);
+  EXPECT_NEAR(c.infectious / 2, infectious[1][kStudents], 1e-6);
+
+  // An active municipality is not part of the metapopulation anymore
+  meta.SetActive(0);
+  EXPECT_TRUE(meta.IsActive(0));
+  EXPECT_EQ(0, meta.GetInfectious(0));
+  EXPECT_TRUE(meta.GetMembers(0).empty());
+}
+
+}  // namespace bdm
@@ -11,11 +11,12 @@ namespace bdm {
 
 TEST(MobilityData, DrawDirichlet) {
   Simulation simulation(TEST_NAME);
+  simulation.SetEnvironment(new CovidEnvironment());
   InitializeMobilityData();
   Person person;
 
   std::vector<uint16_t> other_locations(10);
-  auto mobility_data = MobilityData::GetInstance();
+  auto* mobility_data = GetMobilityData();
   mobility_data->DrawDirichlet(&person, &other_locations);
   for (const auto& loc : other_locations) {
     EXPECT_NE(person.GetHomeLocation(), loc);
@@ -0,0 +1,60 @@
+#include <gtest/gtest.h>
+#include <fstream>
+#include "biodynamo.h"
+
+#include "municipality_series.h"
+
+#define TEST_NAME typeid(*this).name()
+
+namespace bdm {
+
+// Reads an uncompressed file of MunicipalitySeriesWriter
+inline std::vector<MunicipalitySeriesRecord> ReadMunicipalitySeries(
+    const std::string& path, MunicipalitySeriesHeader* header) {
+  std::ifstream in(path, std::ios::binary);
+  in.read(reinterpret_cast<char*>(header), sizeof(*header));
+  std::vector<MunicipalitySeriesRecord> records;
+  MunicipalitySeriesRecord record;
+  while (in.read(reinterpret_cast<char*>(&record), sizeof(record))) {
+    records.push_back(record);
+  }
+  return records;
+}
+
+TEST(MunicipalitySeries, AppendAndBranch) {
+  auto path = MunicipalitySeriesFile(".", 1, 0, false);
+  auto branch_path = MunicipalitySeriesFile(".", 1, 1, false);
+  std::array<uint64_t, kNumMunicipalities> infected{};
+  std::array<uint64_t, kNumMunicipalities> located{};
+  MunicipalitySeriesWriter writer(path, 24, false);
+  // More records than fit into one batch
+  uint32_t records = MunicipalitySeriesWriter::kBatchSize + 10;
+  for (uint32_t r = 0; r < records; r++) {
+    infected[7] = r;
+    located[kNumMunicipalities - 1] = 2 * r;
+    writer.Append(24 * r, infected, located);
+  }
+  writer.Flush();
+  writer.Branch(branch_path);
+  writer.Append(24 * records, infected, located);
+  writer.Flush();
+
+  MunicipalitySeriesHeader header;
+  auto parent = ReadMunicipalitySeries(path, &header);
+  EXPECT_EQ(24u, header.frequency);
+  EXPECT_EQ(kNumMunicipalities, header.num_municipalities);
+  ASSERT_EQ(records, parent.size());
+  EXPECT_EQ(24u * 5, parent[5].hour);
+  EXPECT_EQ(5.f, parent[5].infected[7]);
+  EXPECT_EQ(10.f, parent[5].located[kNumMunicipalities - 1]);
+
+  auto branch = ReadMunicipalitySeries(branch_path, &header);
+  ASSERT_EQ(records + 1, branch.size());
+  EXPECT_EQ(24u * records, branch.back().hour);
+
+  writer.Discard();
+  EXPECT_FALSE(std::ifstream(branch_path).good());
+  remove(path.c_str());
+}
+
+}  // namespace bdm
@@ -0,0 +1,91 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include "biodynamo.h"
+
+#include "register_sampling.h"
+
+#define TEST_NAME typeid(*this).name()
+
+namespace bdm {
+
+TEST(RegisterSampling, StratifiedOrderKeepsMargins) {
+  // 90 students in municipality 0, 9 in municipality 1 and 1 in municipality 2
+  std::vector<RegisterPerson> persons;
+  for (int i = 0; i < 100; i++) {
+    uint16_t location = i < 90 ? 0 : (i < 99 ? 1 : 2);
+    persons.push_back({location, 20, kStudents, 0});
+  }
+
+  auto count = [&](const std::vector<size_t>& order, uint16_t location) {
+    return std::count_if(order.begin(), order.end(), [&](size_t i) {
+      return persons[i].location == location;
+    });
+  };
+
+  auto order = StratifiedOrder(persons, 10);
+  ASSERT_EQ(10u, order.size());
+  EXPECT_EQ(9, count(order, 0));
+  EXPECT_EQ(1, count(order, 1));
+  EXPECT_EQ(0, count(order, 2));
+
+  auto larger = StratifiedOrder(persons, 60);
+  EXPECT_EQ(54, count(larger, 0));
+  EXPECT_EQ(5, count(larger, 1));
+  EXPECT_EQ(1, count(larger, 2));
+  // A smaller population is a prefix of a larger one
+  EXPECT_TRUE(std::equal(order.begin(), order.end(), larger.begin()));
+
+  // Another seed takes other persons from the same cells
+  auto reseeded = StratifiedOrder(persons, 10, 1);
+  EXPECT_EQ(9, count(reseeded, 0));
+  EXPECT_EQ(1, count(reseeded, 1));
+  EXPECT_FALSE(std::equal(order.begin(), order.end(), reseeded.begin()));
+
+  // All persons, each one once
+  auto all = StratifiedOrder(persons, 1000);
+  ASSERT_EQ(100u, all.size());
+  std::sort(all.begin(), all.end());
+  for (size_t i = 0; i < all.size(); i++) {
+    EXPECT_EQ(i, all[i]);
+  }
+}
+
+TEST(RegisterSampling, GroupIntoAgents) {
+  // 7 persons in municipality 0 (hot) and 7 in municipality 1
+  std::vector<RegisterPerson> persons;
+  for (int i = 0; i < 14; i++) {
+    uint16_t location = i < 7 ? 0 : 1;
+    persons.push_back({location, 20, kStudents, 0});
+  }
+  std::vector<bool> hot(kNumMunicipalities, false);
+  hot[0] = true;
+
+  auto agents = GroupIntoAgents(
+      persons.size(), [&](size_t i) { return persons[i].location; },
+      [&](size_t i) { return persons[i].demography; }, hot, 3);
+  // 7 agents of weight one, two super agents of weight 3 and one of weight 1
+  ASSERT_EQ(10u, agents.size());
+  uint32_t weight = 0;
+  for (size_t a = 0; a < 7; a++) {
+    EXPECT_EQ(a, agents[a].first);
+    EXPECT_EQ(1u, agents[a].second);
+  }
+  for (auto& agent : agents) {
+    weight += agent.second;
+  }
+  EXPECT_EQ(14u, weight);
+  EXPECT_EQ(7u, agents[7].first);
+  EXPECT_EQ(3u, agents[7].second);
+  EXPECT_EQ(10u, agents[8].first);
+  EXPECT_EQ(3u, agents[8].second);
+  EXPECT_EQ(13u, agents[9].first);
+  EXPECT_EQ(1u, agents[9].second);
+
+  // Weight one disables the super agents
+  EXPECT_EQ(14u, GroupIntoAgents(
+                     persons.size(), [&](size_t i) { return persons[i].location; },
+                     [&](size_t i) { return persons[i].demography; }, hot, 1)
+                     .size());
+}
+
+}  // namespace bdm
@@ -0,0 +1,125 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+#include "biodynamo.h"
+
+#include "repetition_aggregator.h"
+
+#define TEST_NAME typeid(*this).name()
+
+namespace bdm {
+
+TEST(P2Quantile, ExactForFewValues) {
+  P2Quantile quantile;
+  for (double x : {4.0, 1.0, 3.0}) {
+    quantile.Add(x, 0.5);
+  }
+  EXPECT_DOUBLE_EQ(3, quantile.Get(0.5));
+  EXPECT_DOUBLE_EQ(1, quantile.Get(0));
+  EXPECT_DOUBLE_EQ(4, quantile.Get(1));
+}
+
+TEST(P2Quantile, ApproximatesQuantiles) {
+  std::mt19937 rng(42);
+  std::normal_distribution<double> normal(10, 2);
+  std::vector<double> values(5000);
+  for (auto& x : values) {
+    x = normal(rng);
+  }
+  for (double p : {0.05, 0.5, 0.95}) {
+    P2Quantile quantile;
+    for (auto x : values) {
+      quantile.Add(x, p);
+    }
+    auto sorted = values;
+    std::sort(sorted.begin(), sorted.end());
+    auto exact = sorted[static_cast<size_t>(p * (sorted.size() - 1))];
+    EXPECT_NEAR(exact, quantile.Get(p), 0.1);
+  }
+}
+
+TEST(RepetitionAggregator, MeanAndStandardDeviation) {
+  RepetitionAggregator aggregate({"ts_infected", "ts_missing"}, {0.5}, false);
+  TimeSeries first;
+  first.Add("ts_infected", {0, 1, 2}, {1, 2, 3});
+  first.Add("resolution", {0}, {0.5});
+  TimeSeries second;
+  second.Add("ts_infected", {0, 1}, {3, 6});
+  aggregate.Add(first);
+  aggregate.Add(second);
+
+  EXPECT_EQ(2u, aggregate.GetNumRepetitions());
+  EXPECT_TRUE(aggregate.GetRepetitions().empty());
+  auto summary = aggregate.GetSummary();
+  EXPECT_FALSE(summary.Contains("ts_missing"));
+  EXPECT_EQ(0.5, summary.GetYValues("resolution")[0]);
+  const auto& mean = summary.GetYValues("ts_infected");
+  ASSERT_EQ(3u, mean.size());
+  EXPECT_NEAR(2, mean[0], 1e-9);
+  EXPECT_NEAR(4, mean[1], 1e-9);
+  // Only the first repetition reached the last point
+  EXPECT_NEAR(3, mean[2], 1e-9);
+  const auto& stddev = summary.GetYErrorHigh("ts_infected");
+  EXPECT_NEAR(std::sqrt(2), stddev[0], 1e-9);
+  EXPECT_NEAR(std::sqrt(8), stddev[1], 1e-9);
+  EXPECT_NEAR(0, stddev[2], 1e-9);
+
+  auto median = RepetitionAggregator::GetQuantileName("ts_infected", 0.5);
+  EXPECT_TRUE(summary.Contains(median));
+  EXPECT_NEAR(4, summary.GetYValues(median)[1], 1e-9);
+}
+
+TEST(StudentT975, MatchesTheDistribution) {
+  EXPECT_NEAR(12.706, StudentT975(1), 1e-3);
+  EXPECT_NEAR(2.042, StudentT975(30), 1e-3);
+  EXPECT_NEAR(2.0211, StudentT975(40), 1e-4);
+  EXPECT_NEAR(1.9799, StudentT975(120), 1e-4);
+}
+
+TEST(RepetitionAggregator, RepeatsUntilTheIntervalConverges) {
+  SimParam sparam;
+  sparam.repetition_ci_target = 0.1;
+  sparam.max_repetitions = 6;
+  auto metric = [](const TimeSeries& result) {
+    return result.GetYValues("ts_hospitalized")[0];
+  };
+  auto add = [](RepetitionAggregator* aggregate, real_t value) {
+    TimeSeries result;
+    result.Add("ts_hospitalized", {0}, {value});
+    aggregate->Add(result);
+  };
+
+  // Converged after the minimum of three repetitions
+  RepetitionAggregator quiet({"ts_hospitalized"}, {}, false);
+  quiet.SetMetric("peak", metric);
+  for (real_t value : {10.0, 10.1, 9.9}) {
+    EXPECT_TRUE(NeedsMoreRepetitions(quiet, 3, &sparam));
+    add(&quiet, value);
+  }
+  EXPECT_FALSE(NeedsMoreRepetitions(quiet, 3, &sparam));
+  EXPECT_NEAR(10, quiet.GetMetric().mean, 1e-9);
+  EXPECT_LT(quiet.GetMetric().GetHalfWidth(), 1);
+
+  // Noisy repetitions continue up to the maximum
+  RepetitionAggregator noisy({"ts_hospitalized"}, {}, false);
+  noisy.SetMetric("peak", metric);
+  for (real_t value : {1.0, 20.0, 5.0, 12.0, 2.0}) {
+    add(&noisy, value);
+    EXPECT_TRUE(NeedsMoreRepetitions(noisy, 3, &sparam));
+  }
+  add(&noisy, 15);
+  EXPECT_FALSE(NeedsMoreRepetitions(noisy, 3, &sparam));
+
+  // Without a target, the number of repetitions is fixed
+  sparam.repetition_ci_target = 0;
+  RepetitionAggregator fixed({"ts_hospitalized"}, {}, false);
+  fixed.SetMetric("peak", metric);
+  for (real_t value : {1.0, 20.0, 5.0}) {
+    add(&fixed, value);
+  }
+  EXPECT_FALSE(NeedsMoreRepetitions(fixed, 3, &sparam));
+}
+
+}  // namespace bdm
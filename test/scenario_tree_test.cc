@@ -0,0 +1,105 @@
+#include <gtest/gtest.h>
+#include "biodynamo.h"
+
+#include "scenario_tree.h"
+
+#define TEST_NAME typeid(*this).name()
+
+namespace bdm {
+
+TEST(ScenarioTree, PhaseStartHour) {
+  SimParam sparam;
+  EXPECT_EQ(0u, PhaseStartHour(&sparam, 0));
+  EXPECT_EQ(408u, PhaseStartHour(&sparam, 1));
+  EXPECT_EQ(408u + 336, PhaseStartHour(&sparam, 2));
+  EXPECT_EQ(408u + 336 + 264, PhaseStartHour(&sparam, 3));
+  EXPECT_EQ(408u + 336 + 264 + 1176, PhaseStartHour(&sparam, 4));
+  EXPECT_EQ(408u + 336 + 264 + 1176 + 504, PhaseStartHour(&sparam, 5));
+}
+
+TEST(ScenarioTree, BuildScenarioTree) {
+  Param::RegisterParamGroup(new SimParam());
+  Simulation simulation(TEST_NAME);
+  EXPECT_EQ(3, DivergencePhase("beta4"));
+  EXPECT_EQ(-1, DivergencePhase("population_size"));
+
+  // 2 values of beta3 times 3 values of beta4
+  std::vector<ScenarioLevel> levels(2);
+  levels[0].phase = 3;
+  levels[1].phase = 4;
+  for (real_t beta3 : {0.4, 0.5}) {
+    levels[0].patches.push_back({{"bdm::SimParam", {{"beta3", beta3}}}});
+  }
+  for (real_t beta4 : {0.1, 0.2, 0.3}) {
+    levels[1].patches.push_back({{"bdm::SimParam", {{"beta4", beta4}}}});
+  }
+  uint64_t run = 1;
+  uint64_t hours = 0;
+  std::vector<Param> leaves;
+  auto plan = BuildScenarioTree(levels, 0, *simulation.GetParam(), &run,
+                                &leaves, &hours);
+
+  EXPECT_EQ(3, plan.phase);
+  ASSERT_EQ(2u, plan.subplans.size());
+  EXPECT_EQ(4, plan.subplans[1].phase);
+  EXPECT_EQ(6u, plan.GetNumLeaves());
+  EXPECT_EQ(9u, run);
+  ASSERT_EQ(6u, leaves.size());
+  EXPECT_NEAR(0.5, leaves[4].Get<SimParam>()->beta3, 1e-6);
+  EXPECT_NEAR(0.2, leaves[4].Get<SimParam>()->beta4, 1e-6);
+  // Phase 3 is simulated once per value of beta3, phase 4 once per leaf
+  EXPECT_EQ(2u * 1176 + 6u * 504, hours);
+}
+
+TEST(ScenarioTree, RunsToTheEnd) {
+  SimParam sparam;
+  sparam.calibration_horizon = true;
+  sparam.mode = "multi-fidelity";
+  EXPECT_TRUE(MayStopEarly(&sparam));
+  EXPECT_LT(GetRunHorizon(&sparam), PhaseStartHour(&sparam, 2));
+  // Even with the horizon, the branches of later phases are simulated
+  sparam.mode = "scenario-tree";
+  EXPECT_FALSE(MayStopEarly(&sparam));
+  EXPECT_GT(GetRunHorizon(&sparam), PhaseStartHour(&sparam, kNumPhases + 1));
+}
+
+// Leaves that only diverge after the calibration horizon get results of
+// their own, which cover all phases
+TEST(ScenarioTree, LeavesDivergeAtLaterPhases) {
+  Param::RegisterParamGroup(new SimParam());
+  Simulation simulation(TEST_NAME);
+  Param root(*simulation.GetParam());
+  root.MergeJsonPatch(
+      R"({"bdm::SimParam": {"mode": "scenario-tree",
+                             "population_size": 2000}})");
+
+  std::vector<ScenarioLevel> levels(1);
+  levels[0].phase = DivergencePhase("beta2");
+  ASSERT_GE(levels[0].phase, 2);
+  for (real_t beta2 : {0.0, 1.0}) {
+    levels[0].patches.push_back({{"bdm::SimParam", {{"beta2", beta2}}}});
+  }
+  uint64_t run = *GetRunIndex() + 1;
+  uint64_t hours = 0;
+  std::vector<Param> leaves;
+  auto plan = BuildScenarioTree(levels, 0, root, &run, &leaves, &hours);
+
+  const char* argv[] = {TEST_NAME, "--randominit"};
+  Param run_param(root);
+  TimeSeries unused;
+  std::vector<TimeSeries> results;
+  SimulateImpl(2, argv, &unused, &run_param, &plan, &results);
+  *GetRunIndex() = run;
+
+  ASSERT_EQ(2u, results.size());
+  const auto* sparam = root.Get<SimParam>();
+  auto end = PhaseStartHour(sparam, kNumPhases + 1);
+  for (const auto& result : results) {
+    ASSERT_TRUE(result.Contains("ts_exposed"));
+    EXPECT_GE(result.GetXValues("ts_exposed").back() + 1, end);
+  }
+  EXPECT_NE(results[0].GetYValues("ts_exposed"),
+            results[1].GetYValues("ts_exposed"));
+}
+
+}  // namespace bdm
@@ -0,0 +1,195 @@
+#include <gtest/gtest.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <string>
+#include "biodynamo.h"
+
+#include "surrogate.h"
+
+#define TEST_NAME typeid(*this).name()
+
+namespace bdm {
+
+TEST(Surrogate, GaussianProcessInterpolates) {
+  // A smooth function of two parameters on a 5 x 5 grid
+  auto f = [](real_t a, real_t b) { return std::sin(3 * a) + b * b; };
+  std::vector<std::vector<real_t>> x;
+  std::vector<real_t> y;
+  for (int i = 0; i < 5; i++) {
+    for (int j = 0; j < 5; j++) {
+      x.push_back({i * 0.25, 10 + j * 2.5});
+      y.push_back(f(i * 0.25, 10 + j * 2.5));
+    }
+  }
+  GaussianProcess gp;
+  gp.Fit(x, y);
+  ASSERT_EQ(25u, gp.GetNumPoints());
+
+  real_t mean = 0;
+  real_t variance = 0;
+  // Close to the training points
+  gp.Predict({0.5, 15}, &mean, &variance);
+  EXPECT_NEAR(f(0.5, 15), mean, 0.05 * std::abs(f(0.5, 15)));
+  real_t variance_at_sample = variance;
+  // In between the training points
+  gp.Predict({0.625, 16.25}, &mean, &variance);
+  EXPECT_NEAR(f(0.625, 16.25), mean, 0.05 * std::abs(f(0.625, 16.25)));
+  // Far away from all training points the prediction is uncertain
+  real_t far_mean = 0;
+  real_t far_variance = 0;
+  gp.Predict({5, 100}, &far_mean, &far_variance);
+  EXPECT_GT(far_variance, 10 * variance_at_sample);
+}
+
+TEST(Surrogate, ShouldSkip) {
+  std::string path = std::string(TEST_NAME) + ".json";
+  remove(path.c_str());
+  auto* surrogate = Surrogate::GetInstance();
+  surrogate->Open(path, std::vector<std::string>{"bdm::SimParam.beta1"});
+  SimParam sparam;
+  sparam.surrogate_min_samples = 10;
+  sparam.surrogate_confidence = 2;
+  sparam.surrogate_skip_factor = 2;
+
+  // The error grows by orders of magnitude from beta1 0 to 0.9
+  for (int i = 0; i < 10; i++) {
+    EXPECT_FALSE(surrogate->ShouldSkip({0.9}, &sparam));
+    surrogate->AddSample({i * 0.1}, std::exp(1 + 10 * i * 0.1));
+  }
+  EXPECT_NEAR(std::exp(1), surrogate->GetBestError(), 1e-9);
+  EXPECT_TRUE(surrogate->ShouldSkip({0.9}, &sparam));
+  EXPECT_TRUE(surrogate->ShouldSkip({0.85}, &sparam));
+  EXPECT_FALSE(surrogate->ShouldSkip({0}, &sparam));
+  EXPECT_FALSE(surrogate->ShouldSkip({0.05}, &sparam));
+  // Points without all features are never skipped
+  EXPECT_FALSE(surrogate->ShouldSkip({}, &sparam));
+}
+
+TEST(Surrogate, SaveAndReload) {
+  std::string path = std::string(TEST_NAME) + ".json";
+  remove(path.c_str());
+  remove((path + ".other").c_str());
+  std::vector<std::string> features = {"bdm::SimParam.beta1",
+                                       "bdm::SimParam.beta2"};
+  auto* surrogate = Surrogate::GetInstance();
+  surrogate->Open(path, features);
+  surrogate->AddSample({0.1, 0.2}, 3);
+  surrogate->AddSample({0.3, 0.4}, 5);
+  // Invalid samples are dropped
+  surrogate->AddSample({0.5}, 1);
+  surrogate->AddSample({0.5, 0.6}, 0);
+
+  surrogate->Open(path + ".other", features);
+  EXPECT_EQ(0u, surrogate->GetNumSamples());
+  surrogate->Open(path, features);
+  EXPECT_EQ(2u, surrogate->GetNumSamples());
+  EXPECT_NEAR(3, surrogate->GetBestError(), 1e-9);
+  // Samples of other parameters are not loaded
+  surrogate->Open(path, std::vector<std::string>{"bdm::SimParam.beta3"});
+  EXPECT_EQ(0u, surrogate->GetNumSamples());
+}
+
+TEST(Surrogate, ConcurrentSaves) {
+  std::string path = std::string(TEST_NAME) + ".json";
+  remove(path.c_str());
+  std::vector<std::string> features = {"bdm::SimParam.beta1"};
+  auto* surrogate = Surrogate::GetInstance();
+  surrogate->Open(path + ".other", features);
+
+  // Concurrent processes, e.g. the ranks of a calibration, that each add
+  // their own samples to the same store
+  const int kProcesses = 4;
+  const int kSamples = 10;
+  std::vector<pid_t> pids;
+  for (int p = 0; p < kProcesses; p++) {
+    auto pid = fork();
+    ASSERT_GE(pid, 0);
+    if (pid == 0) {
+      surrogate->Open(path, features);
+      for (int i = 0; i < kSamples; i++) {
+        surrogate->AddSample({static_cast<real_t>(p * kSamples + i)}, 1 + i);
+      }
+      _exit(0);
+    }
+    pids.push_back(pid);
+  }
+  for (auto pid : pids) {
+    int status = 0;
+    waitpid(pid, &status, 0);
+    EXPECT_EQ(0, WEXITSTATUS(status));
+  }
+
+  surrogate->Open(path, features);
+  EXPECT_EQ(static_cast<size_t>(kProcesses * kSamples),
+            surrogate->GetNumSamples());
+}
+
+TEST(Surrogate, ImportsEachExperimentOnce) {
+  std::string path = std::string(TEST_NAME) + ".json";
+  std::string dir = std::string(TEST_NAME) + "_study";
+  remove(path.c_str());
+  remove(ExperimentStoreFile(dir).c_str());
+  remove(ExperimentStore(ExperimentStoreFile(dir)).GetIndexPath().c_str());
+  mkdir(dir.c_str(), 0755);
+  auto param = [](real_t beta1, real_t mse) {
+    nlohmann::json j;
+    j["bdm::SimParam"]["beta1"] = beta1;
+    j["mse"] = mse;
+    return j;
+  };
+  ExperimentStore store(ExperimentStoreFile(dir));
+  ASSERT_TRUE(store.Append("a", param(0.1, 2).dump(), 2, {}));
+  ASSERT_TRUE(store.Append("b", param(0.2, 3).dump(), 3, {}));
+  // An experiment that was also written to its own directory
+  mkdir((dir + "/b").c_str(), 0755);
+  std::ofstream(dir + "/b/param.json") << param(0.2, 3).dump();
+
+  auto* surrogate = Surrogate::GetInstance();
+  std::vector<std::string> features = {"bdm::SimParam.beta1"};
+  surrogate->Open(path + ".other", features);
+  surrogate->Open(path, features);
+  surrogate->ImportExperiments(dir);
+  EXPECT_EQ(2u, surrogate->GetNumSamples());
+  // Importing again, also after reopening the store, adds nothing
+  surrogate->ImportExperiments(dir);
+  EXPECT_EQ(2u, surrogate->GetNumSamples());
+  surrogate->Open(path + ".other", features);
+  surrogate->Open(path, features);
+  EXPECT_EQ(2u, surrogate->GetNumSamples());
+  surrogate->ImportExperiments(dir);
+  surrogate->AddSample({0.1}, 2, "a");
+  EXPECT_EQ(2u, surrogate->GetNumSamples());
+  surrogate->Open(path + ".other", features);
+  surrogate->Open(path, features);
+  EXPECT_EQ(2u, surrogate->GetNumSamples());
+}
+
+TEST(Surrogate, SkipsRunsWithoutError) {
+  std::string path = std::string(TEST_NAME) + ".json";
+  remove(path.c_str());
+  auto* surrogate = Surrogate::GetInstance();
+  surrogate->Open(path, std::vector<std::string>{"bdm::SimParam.beta1"});
+  nlohmann::json j;
+  j["bdm::SimParam"]["beta1"] = 0.1;
+  j["mse"] = 2;
+  auto aborted = j;
+  aborted["aborted"] = true;
+  EXPECT_FALSE(surrogate->ImportExperiment(aborted, "aborted"));
+  auto skipped = j;
+  skipped["skipped"] = true;
+  skipped["mse"] = std::numeric_limits<real_t>::max();
+  EXPECT_FALSE(surrogate->ImportExperiment(skipped, "skipped"));
+  // Skipped runs of stores without the flags
+  skipped.erase("skipped");
+  EXPECT_FALSE(surrogate->ImportExperiment(skipped, "old"));
+  j["aborted"] = false;
+  j["skipped"] = false;
+  EXPECT_TRUE(surrogate->ImportExperiment(j, "completed"));
+  EXPECT_EQ(1u, surrogate->GetNumSamples());
+}
+
+}  // namespace bdm
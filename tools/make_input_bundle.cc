@@ -0,0 +1,33 @@
+// -----------------------------------------------------------------------------
+//
+// Copyright (C) 2021 CERN & University of Surrey for the benefit of the
+// BioDynaMo collaboration. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+//
+// See the LICENSE file distributed with this work for details.
+// See the NOTICE file distributed with this work for additional information
+// regarding copyright ownership.
+//
+// -----------------------------------------------------------------------------
+
+// Converts the input files of the model into the bundle file that the
+// simulation maps instead of parsing them (see InputBundle). Run by the build:
+//   make-input-bundle <data dir> <bundle file>
+#include <iostream>
+
+#include "input_bundle.h"
+
+int main(int argc, const char** argv) {
+  if (argc != 3) {
+    std::cerr << "Usage: " << argv[0] << " <data dir> <bundle file>"
+              << std::endl;
+    return 1;
+  }
+  if (!bdm::InputBundle::WriteFile(argv[1], argv[2])) {
+    std::cerr << "Could not write " << argv[2] << std::endl;
+    return 1;
+  }
+  return 0;
+}